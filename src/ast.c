@@ -1,8 +1,14 @@
 #include <stdlib.h>
+#include <string.h>
 #include "types.h"
 
 void initialize_ast(ast_t *ast) {
 	ast->root = NULL;
+	ast->temps_used = 0;
+	ast->temps_cap = 0;
+	ast->temps = NULL;
+	ast->branches = 0;
+	ast->shape = 0;
 }
 
 void add_statement(ast_t *ast, statement_t stat) {
@@ -25,6 +31,177 @@ void add_statement(ast_t *ast, statement_t stat) {
 	traverse->next->next = NULL;
 }
 
+void clean_expression(exp_t *exp) {
+	// A failed parse can leave operands that were never allocated.
+	if (exp == NULL)
+		return;
+	if (exp->type == bin_exp) {
+		clean_expression(exp->binExp.leftOperand);
+		free(exp->binExp.leftOperand);
+		clean_expression(exp->binExp.rightOperand);
+		free(exp->binExp.rightOperand);
+	} else if (exp->type == unary_exp) {
+		clean_expression(exp->unaryExp.operand);
+		free(exp->unaryExp.operand);
+	} else if (exp->type == assign_exp) {
+		clean_expression(exp->assignExp.rvalue);
+		free(exp->assignExp.rvalue);
+	}
+}
+
+void clean_statement(statement_t *stat) {
+	if (stat->type == ret_stat) {
+		clean_expression(stat->retStat.exp);
+		free(stat->retStat.exp);
+	} else if (stat->type == print_stat) {
+		clean_expression(stat->printStat.exp);
+		free(stat->printStat.exp);
+	} else if (stat->type == decl_stat) {
+		if (stat->declStat.rvalue != NULL) {
+			clean_expression(stat->declStat.rvalue);
+			free(stat->declStat.rvalue);
+		}
+	} else if (stat->type == simple_stat) {
+		clean_expression(stat->simpleStat.exp);
+		free(stat->simpleStat.exp);
+	} else if (stat->type == if_stat) {
+		clean_expression(stat->ifStat.cond);
+		free(stat->ifStat.cond);
+	} else if (stat->type == while_stat) {
+		clean_expression(stat->whileStat.cond);
+		free(stat->whileStat.cond);
+	}
+}
+
+// Given the start of a block, find the end_block that closes it.
+statement_node_t *block_end(statement_node_t *start) {
+	int blocks = 0;
+	for (statement_node_t *node = start; node != NULL; node = node->next) {
+		if (node->stat.type == start_block)
+			++blocks;
+		else if (node->stat.type == end_block && --blocks == 0)
+			return node;
+	}
+	return NULL;
+}
+
+// Where the expression of a statement is, so that it can be replaced,
+// NULL if it has none.
+exp_t **statement_expression(statement_t *stat) {
+	if (stat->type == ret_stat || stat->type == print_stat || stat->type == simple_stat)
+		return &(stat->unaryStat.exp);
+	if (stat->type == decl_stat)
+		return (stat->declStat.rvalue != NULL) ? &(stat->declStat.rvalue) : NULL;
+	if (stat->type == if_stat || stat->type == while_stat)
+		return &(stat->ifStat.cond);
+	return NULL;
+}
+
+// Link a new statement right before 'node'.
+statement_node_t *insert_statement_before(ast_t *ast, statement_node_t *node, statement_t stat) {
+	statement_node_t *new_node = malloc(sizeof(statement_node_t));
+	new_node->stat = stat;
+	new_node->next = node;
+	new_node->prev = node->prev;
+	if (node->prev != NULL)
+		node->prev->next = new_node;
+	else
+		ast->root = new_node;
+	node->prev = new_node;
+	return new_node;
+}
+
+// A variable name that can't clash with the ones of the
+// source, as it is not a valid identifier.
+char *new_temporary(ast_t *ast) {
+	if (ast->temps_used >= ast->temps_cap) {
+		ast->temps_cap = (ast->temps_cap) ? 2 * ast->temps_cap : 16;
+		ast->temps = realloc(ast->temps, ast->temps_cap * sizeof(char *));
+	}
+	char *name = malloc(16);
+	snprintf(name, 16, ".t%d", ast->temps_used);
+	ast->temps[(ast->temps_used)++] = name;
+	return name;
+}
+
+void clean_temporaries(ast_t *ast) {
+	for (int i = 0; i < ast->temps_used; ++i)
+		free(ast->temps[i]);
+	free(ast->temps);
+	ast->temps = NULL;
+	ast->temps_used = ast->temps_cap = 0;
+}
+
+// Unlink a statement from the list and free it.
+void remove_statement(ast_t *ast, statement_node_t *node) {
+	if (node->prev != NULL)
+		node->prev->next = node->next;
+	else
+		ast->root = node->next;
+	if (node->next != NULL)
+		node->next->prev = node->prev;
+	clean_statement(&node->stat);
+	free(node);
+}
+
+// Remove all the statements from 'first' up to and including 'last'.
+void remove_statements(ast_t *ast, statement_node_t *first, statement_node_t *last) {
+	statement_node_t *next;
+	int done = 0;
+	for (statement_node_t *node = first; !done; node = next) {
+		next = node->next;
+		done = (node == last);
+		remove_statement(ast, node);
+	}
+}
+
+// A new expression, equal to 'exp'. The names are shared
+// (they belong to the tokens), the rest is allocated.
+exp_t *copy_expression(exp_t *exp) {
+	exp_t *copy = malloc(sizeof(exp_t));
+	*copy = *exp;
+	if (exp->type == unary_exp) {
+		copy->unaryExp.operand = copy_expression(exp->unaryExp.operand);
+	} else if (exp->type == bin_exp) {
+		copy->binExp.leftOperand = copy_expression(exp->binExp.leftOperand);
+		copy->binExp.rightOperand = copy_expression(exp->binExp.rightOperand);
+	} else if (exp->type == assign_exp) {
+		copy->assignExp.rvalue = copy_expression(exp->assignExp.rvalue);
+	}
+	return copy;
+}
+
+// Whether 'a' and 'b' are the same expression, and so (if they
+// don't have side effects) they have the same value.
+int same_expression(exp_t *a, exp_t *b) {
+	if (a->type != b->type)
+		return 0;
+	if (a->type == int_exp)
+		return a->intExp == b->intExp;
+	if (a->type == id_exp)
+		return !strcmp(a->id, b->id);
+	if (a->type == unary_exp)
+		return !strcmp(a->unaryExp.operator, b->unaryExp.operator) &&
+			same_expression(a->unaryExp.operand, b->unaryExp.operand);
+	if (a->type == bin_exp)
+		return !strcmp(a->binExp.operator, b->binExp.operator) &&
+			same_expression(a->binExp.leftOperand, b->binExp.leftOperand) &&
+			same_expression(a->binExp.rightOperand, b->binExp.rightOperand);
+	return 0;
+}
+
+// In this language, assignments are the only side effects.
+int has_side_effects(exp_t *exp) {
+	if (exp->type == assign_exp)
+		return 1;
+	if (exp->type == unary_exp)
+		return has_side_effects(exp->unaryExp.operand);
+	if (exp->type == bin_exp)
+		return has_side_effects(exp->binExp.leftOperand) ||
+			has_side_effects(exp->binExp.rightOperand);
+	return 0;
+}
+
 void printTabs(int tabs) {
 	for(int i = 0; i < tabs; ++i)
 		printf("\t");
@@ -92,8 +269,12 @@ void print_statement(statement_t *stat, int tabs) {
 		printf("Id: %s\n", stat->declStat.id);
 		printf("-----\n");
 		printf("Value: \n");
-		if(stat->declStat.rvalue != NULL)
+		if(stat->declStat.rvalue != NULL) {
 			print_expression(stat->declStat.rvalue, tabs + 1);
+		} else if(stat->declStat.uninitialized) {
+			printTabs(tabs + 1);
+			printf("(never read)\n");
+		}
 	} else if(stat->type == simple_stat) {
 		print_expression(stat->simpleStat.exp, tabs + 1);
 	} else if(stat->type == if_stat) {
@@ -5,6 +5,18 @@
 
 void initialize_ast(ast_t *);
 void add_statement(ast_t *, statement_t);
+void clean_expression(exp_t *);
+void clean_statement(statement_t *);
+statement_node_t *block_end(statement_node_t *);
+exp_t **statement_expression(statement_t *);
+statement_node_t *insert_statement_before(ast_t *, statement_node_t *, statement_t);
+char *new_temporary(ast_t *);
+void clean_temporaries(ast_t *);
+void remove_statement(ast_t *, statement_node_t *);
+void remove_statements(ast_t *, statement_node_t *, statement_node_t *);
+exp_t *copy_expression(exp_t *);
+int same_expression(exp_t *, exp_t *);
+int has_side_effects(exp_t *);
 void print_expression(exp_t *, int);
 void print_statement(statement_t *, int);
 void print_ast(ast_t *);
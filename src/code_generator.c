@@ -1,12 +1,19 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "ast.h"
 #include "utils.h"
 #include "types.h"
 #include "runtime_table.h"
+#include "regalloc.h"
+#include "peephole.h"
+#include "profile.h"
+#include "schedule.h"
+#include "typing.h"
 
 // NOTE(stefanos): A note on code architecture. Throughout the project,
 // I did error handling with having a single return point for a function,
@@ -44,255 +51,1851 @@ internal statement_t *peek_statement(gen_t *gen) {
 internal int assemble_block(gen_t *);
 internal int assemble_statement(gen_t *gen);
 
-internal void initialize_assembly(FILE *output) {
+// Appends formatted assembly to the output buffer.
+internal void emit(gen_t *gen, const char *fmt, ...) {
+	va_list args;
+	for (;;) {
+		size_t avail = gen->out_cap - gen->out_len;
+		va_start(args, fmt);
+		int n = vsnprintf(gen->out + gen->out_len, avail, fmt, args);
+		va_end(args);
+		if (n < 0)
+			return;
+		if ((size_t) n < avail) {
+			gen->out_len += n;
+			return;
+		}
+		// Didn't fit, double the buffer and format again.
+		gen->out_cap = 2 * gen->out_cap + n;
+		gen->out = realloc(gen->out, gen->out_cap);
+	}
+}
+
+// Same as emit(), but the assembly goes at 'pos' of the output buffer,
+// for what we know only after we have generated the code that follows.
+internal void emit_at(gen_t *gen, size_t pos, const char *fmt, ...) {
+	char text[128];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+
+	size_t len = strlen(text);
+	emit(gen, "%s", text);
+	memmove(gen->out + pos + len, gen->out + pos, gen->out_len - len - pos);
+	memcpy(gen->out + pos, text, len);
+}
+
+internal void initialize_assembly(gen_t *gen) {
 
 	// Initialize data segment with a pre-formatted string.
 	// Only used by print statements.
-	fprintf(output, ".data\n");
-	fprintf(output, "fmt: .asciz \"int: %%d\\n\"\n");
+	emit(gen, ".data\n");
+	emit(gen, "fmt: .asciz \"int: %%d\\n\"\n");
 	
 	// Initialize text segment
 	// Use Intel syntax
-	fprintf(output, ".intel_syntax noprefix\n");
+	emit(gen, ".intel_syntax noprefix\n");
 	// Align instructions to 4-byte boundary (not really needed)
-	fprintf(output, ".align 4\n");
-	fprintf(output, ".text\n");
-
-
-	// function epilogue (same for every function for now)
-	fprintf(output, ".func_epilogue:\n");
-	fprintf(output, "mov rsp, rbp\n");
-	fprintf(output, "pop rbp\n");
-	fprintf(output, "ret\n");
-
+	emit(gen, ".align 4\n");
+	emit(gen, ".text\n");
 }
 
-internal void initialize_generator(gen_t *gen, ast_t *input, FILE *output) {
+internal void initialize_generator(gen_t *gen, ast_t *input, const dicc_options *options,
+								 profile_t *profile, dicc_sink *sink) {
 	gen->label = 1;
 	gen->curr_loop_label = 0;
-	gen->output = output;
+	gen->frame_pointer = 1;
+	gen->red_zone = 0;
+	gen->num_saved = 0;
+	gen->temp_base = 0;
+	gen->temps = 0;
+	gen->max_temps = 0;
+	gen->options = options;
+	gen->sink = sink;
+	gen->out_cap = 4096;
+	gen->out_len = 0;
+	gen->out = malloc(gen->out_cap);
+	gen->cold = NULL;
+	gen->cold_len = 0;
+	gen->cold_cap = 0;
+	gen->profile = profile;
 	gen->curr_stat = input->root;
 	initialize_table(&(gen->table));
 }
 
-internal int assemble_expression(gen_t *gen, exp_t *exp, int line) {
-	FILE *output = gen->output;
+/*******
+NOTE: Expressions are evaluated in registers, not with a stack
+machine. The registers below are handed out in order: the result of a
+(sub)expression that is evaluated with 'k' registers already busy goes to
+scratch_reg[k] and the evaluation may freely use scratch_reg[k+1...].
+That means that scratch_reg[0] (rax) gets the result of the whole expression.
+
+They are all caller-saved, so we don't have to preserve them. Some
+registers are left out on purpose:
+- rdx, because idiv and the one-operand imul (see divide_by_constant())
+  write to it.
+- r9 and r10, which hold local variables (see regalloc.c).
+- the last one of the table (r11), which is not handed out, but only used to
+  get back a value that was spilled to the frame (see evaluate_operands()).
+
+To use as few registers as possible, every expression is first labelled
+with the number of registers it needs (Sethi-Ullman numbering), and for
+binary expressions the operand that needs more registers is evaluated first.
+Only when both operands need more registers than we have left, the first
+result is kept in a slot of the frame (see assemble_function()).
+
+An int is computed in the 32-bit halves of the registers (eax and so on) and
+a long in the whole of them (see typing.c). The 32-bit instructions don't need
+the REX prefix (apart from r8-r15) and a 32-bit division is much faster. An int
+that is an operand of a long operation is sign-extended with a movsxd first,
+and a long that is assigned to an int is truncated by using the lower half
+of its register.
+*******/
+#define NUM_SCRATCH 5
+
+global_var const char *scratch_reg[NUM_SCRATCH + 1] = {
+	"rax", "rcx", "rsi", "rdi", "r8", "r11"
+};
+
+// Their low bytes, for the set* instructions.
+global_var const char *scratch_reg8[NUM_SCRATCH + 1] = {
+	"al", "cl", "sil", "dil", "r8b", "r11b"
+};
+
+// Their 32-bit names, for the ints.
+global_var const char *scratch_reg32[NUM_SCRATCH + 1] = {
+	"eax", "ecx", "esi", "edi", "r8d", "r11d"
+};
+
+// scratch_reg[k], for a long if 'wide' is set, or else for an int.
+internal const char *scratch(int k, int wide) {
+	return (wide) ? scratch_reg[k] : scratch_reg32[k];
+}
+
+// The name of the register 'reg' (given with its 64-bit name) for a long
+// if 'wide' is set, or else for an int.
+internal const char *register_name(const char *reg, int wide) {
+	const char *names[][2] = {
+		{ "rax", "eax" }, { "rbx", "ebx" }, { "rcx", "ecx" }, { "rdx", "edx" },
+		{ "rsi", "esi" }, { "rdi", "edi" }, { "rbp", "ebp" }, { "r8", "r8d" },
+		{ "r9", "r9d" }, { "r10", "r10d" }, { "r11", "r11d" }, { "r12", "r12d" },
+		{ "r13", "r13d" }, { "r14", "r14d" }, { "r15", "r15d" }
+	};
+	if (wide)
+		return reg;
+	for (int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); ++i) {
+		if (!strcmp(reg, names[i][0]))
+			return names[i][1];
+	}
+	return reg;
+}
+
+// The size of a memory operand, when nothing else in the instruction says it.
+internal const char *memory_size(int wide) {
+	return (wide) ? "qword ptr " : "dword ptr ";
+}
+
+// If exactly one of the operands of a multiplication is a constant,
+// return it (and the other one in 'other').
+internal exp_t *constant_factor(exp_t *exp, exp_t **other) {
+	if (exp->binExp.operator[0] != '*')
+		return NULL;
+	if (exp->binExp.rightOperand->type == int_exp) {
+		*other = exp->binExp.leftOperand;
+		return exp->binExp.rightOperand;
+	}
+	if (exp->binExp.leftOperand->type == int_exp) {
+		*other = exp->binExp.rightOperand;
+		return exp->binExp.leftOperand;
+	}
+	return NULL;
+}
+
+// If the divisor of a division or modulo is a constant, return it.
+internal exp_t *constant_divisor(exp_t *exp) {
+	char op = exp->binExp.operator[0];
+	if ((op == '/' || op == '%') && exp->binExp.rightOperand->type == int_exp &&
+		exp->binExp.rightOperand->intExp != 0)
+		return exp->binExp.rightOperand;
+	return NULL;
+}
+
+internal int is_logical(exp_t *exp) {
+	return exp->type == bin_exp && (!strcmp(exp->binExp.operator, "&&") ||
+									!strcmp(exp->binExp.operator, "||"));
+}
+
+internal int evaluate(gen_t *gen, exp_t *exp, int k, int line);
+
+// Evaluate 'exp' into scratch_reg[k], as a long if 'wide' is set, or as an
+// int. An int becomes a long with a sign extension, and a long becomes an int
+// by using only the lower half of the register.
+internal int evaluate_as(gen_t *gen, exp_t *exp, int k, int wide, int line) {
+	if (wide && !exp->wide && exp->type == int_exp) {
+		emit(gen, "mov %s, %d\n", scratch_reg[k], exp->intExp);
+		return 1;
+	}
+	if(!evaluate(gen, exp, k, line))
+		return 0;
+	if (wide && !exp->wide)
+		emit(gen, "movsxd %s, %s\n", scratch_reg[k], scratch_reg32[k]);
+	return 1;
+}
+
+// 'dst' is the register that gets the result, and it is one of
+// 'lhs' and 'rhs' (the registers holding the left and right operand).
+// 'is_unsigned' is set if a division can treat them as unsigned, and
+// 'wide' if the operation is done in long.
+internal void assemble_operation(gen_t *gen, char *operator, int dst, int lhs, int rhs, int is_unsigned, int wide) {
+	// The operand that is not in the destination register.
+	int other = (dst == lhs) ? rhs : lhs;
+	const char *d = scratch(dst, wide);
+
+	if (operator[0] == '+')
+		emit(gen, "add %s, %s\n", d, scratch(other, wide));
+	else if (operator[0] == '*') {
+		// Constant factors are strength-reduced before we get
+		// here (see multiply_by_constant()).
+		emit(gen, "imul %s, %s\n", d, scratch(other, wide));
+	} else if (operator[0] == '-') {
+		// The result of a subtraction goes to its first
+		// operand, so compute it there and move it if we have to.
+		emit(gen, "sub %s, %s\n", scratch(lhs, wide), scratch(rhs, wide));
+		if (dst != lhs)
+			emit(gen, "mov %s, %s\n", d, scratch(lhs, wide));
+	} else if (operator[0] == '/' || operator[0] == '%') {
+		// The command for integer division is: idiv dst
+		// where 'dst' some register.
+		// The division is computed as (rdx:rax) / dst, or
+		// (edx:eax) / dst for an int, and the quotient is
+		// saved in rax and the remainder in rdx (obviously,
+		// dst can't be either rax or rdx).
+		// rdx is never handed out, but rax is scratch_reg[0], so
+		// the dividend has to be swapped into it.
+		int is_mod = (operator[0] == '%');
+		const char *l = scratch(lhs, wide);
+		const char *r = scratch(rhs, wide);
+		const char *acc = scratch(0, wide);
+		const char *rem = (wide) ? "rdx" : "edx";
+		// rdx (or edx) gets the sign of the dividend. An unsigned division
+		// needs it to be zero instead, and div is also faster than idiv.
+		const char *extend = (is_unsigned) ? "xor edx, edx" : (wide) ? "cqo" : "cdq";
+		const char *divide = (is_unsigned) ? "div" : "idiv";
+
+		if (lhs == 0) {
+			// Dividend already in rax (so 'dst' is rax).
+			emit(gen, "%s\n", extend);
+			emit(gen, "%s %s\n", divide, r);
+			if (is_mod)
+				emit(gen, "mov %s, %s\n", acc, rem);
+		} else if (rhs == 0) {
+			// Divisor in rax (so 'dst' is rax), swap them.
+			emit(gen, "xchg %s, %s\n", acc, l);
+			emit(gen, "%s\n", extend);
+			emit(gen, "%s %s\n", divide, l);
+			if (is_mod)
+				emit(gen, "mov %s, %s\n", acc, rem);
+		} else {
+			// rax holds a value of an outer expression. Swap it
+			// with the dividend and bring it back afterwards (all of
+			// it, as it may be a long).
+			emit(gen, "xchg rax, %s\n", scratch_reg[lhs]);
+			emit(gen, "%s\n", extend);
+			emit(gen, "%s %s\n", divide, r);
+			if (is_mod) {
+				emit(gen, "mov rax, %s\n", scratch_reg[lhs]);
+				emit(gen, "mov %s, %s\n", d, rem);
+			} else {
+				emit(gen, "xchg rax, %s\n", scratch_reg[lhs]);
+				if (dst != lhs)
+					emit(gen, "mov %s, %s\n", d, l);
+			}
+		}
+	}
+	// NOTE: Logical AND/OR never get here, they
+	// need jumps to skip their second operand (see assemble_logical()),
+	// and neither do comparisons (see assemble_comparison()).
+}
+
+internal int log2_exact(long long value) {
+	if (value <= 0 || (value & (value - 1)))
+		return -1;
+	int n = 0;
+	while (value >>= 1)
+		++n;
+	return n;
+}
+
+// Factors that a single lea can multiply with.
+internal int lea_scale(long long value) {
+	if (value == 3 || value == 5 || value == 9)
+		return (int) value - 1;
+	return 0;
+}
+
+// Multiply scratch_reg[k] by a constant, as a long if 'wide' is set.
+// NOTE: imul takes 3 cycles, while lea, shl, add and sub
+// take 1. So we try to write the multiplication as at most two of them
+// (or three, when two of them can run in parallel), and fall
+// back to imul otherwise.
+internal void multiply_by_constant(gen_t *gen, int k, long long value, int wide) {
+	const char *d = scratch(k, wide);
+	// The address of a lea is always computed with the 64-bit registers.
+	// For an int, we keep the lower half of it, which doesn't depend
+	// on the upper halves of the registers.
+	const char *a = scratch_reg[k];
+	// Free, since the operand has already been evaluated.
+	const char *tmp = scratch(k + 1, wide);
+	int n;
+
+	if (value == 0) {
+		emit(gen, "xor %s, %s\n", d, d);
+	} else if (value == 1) {
+		// nothing to do
+	} else if (value == -1) {
+		emit(gen, "neg %s\n", d);
+	} else if ((n = log2_exact(value)) != -1) {
+		emit(gen, "shl %s, %d\n", d, n);
+	} else if (value < 0 && (n = log2_exact(-value)) != -1) {
+		emit(gen, "shl %s, %d\n", d, n);
+		emit(gen, "neg %s\n", d);
+	} else {
+		// value = scale * 2^n, where a lea does the scale.
+		for (n = 0; (value >> n) % 2 == 0; ++n);
+		int scale = lea_scale(value >> n);
+		if (scale) {
+			emit(gen, "lea %s, [%s + %s*%d]\n", d, a, a, scale);
+			if (n)
+				emit(gen, "shl %s, %d\n", d, n);
+			return;
+		}
+
+		// value = scale1 * scale2, two leas.
+		for (int first = 3; first <= 9; first += (first == 3) ? 2 : 4) {
+			if (value % first == 0 && lea_scale(value / first)) {
+				emit(gen, "lea %s, [%s + %s*%d]\n", d, a, a, lea_scale(first));
+				emit(gen, "lea %s, [%s + %s*%d]\n", d, a, a, lea_scale(value / first));
+				return;
+			}
+		}
+
+		// value = 2^n + 1 or 2^n - 1.
+		if ((n = log2_exact(value - 1)) != -1 || (n = log2_exact(value + 1)) != -1) {
+			emit(gen, "mov %s, %s\n", tmp, d);
+			emit(gen, "shl %s, %d\n", d, n);
+			if (log2_exact(value - 1) != -1)
+				emit(gen, "add %s, %s\n", d, tmp);
+			else
+				emit(gen, "sub %s, %s\n", d, tmp);
+			return;
+		}
+
+		emit(gen, "imul %s, %s, %lld\n", d, d, value);
+	}
+}
+
+/*******
+NOTE: Division by a constant 'd' can be done with a multiplication
+by (roughly) 2^(64 + s) / d, keeping the high 64 bits of the 128-bit product and
+shifting them right by 's'. The multiplier (the "magic number") and 's' are
+computed so that the result is exact for every 64-bit dividend. An int
+dividend is sign-extended and divided the same way, and the lower half of
+the quotient is its quotient.
+See Granlund and Montgomery, "Division by Invariant Integers using
+Multiplication", or chapter 10 of Hacker's Delight, where this is taken from.
+*******/
+typedef struct {
+	long long multiplier;
+	int shift;
+} magic_t;
+
+// 'd' has to be >= 3 and not a power of 2.
+internal magic_t signed_magic(long long d) {
+	const unsigned long long two63 = 1ULL << 63;
+	unsigned long long ad = d;
+	unsigned long long anc = two63 - 1 - two63 % ad;   // |nc|
+	unsigned long long q1 = two63 / anc;
+	unsigned long long r1 = two63 - q1 * anc;
+	unsigned long long q2 = two63 / ad;
+	unsigned long long r2 = two63 - q2 * ad;
+	unsigned long long delta;
+	int p = 63;
+
+	do {
+		++p;
+		q1 = 2 * q1;
+		r1 = 2 * r1;
+		if (r1 >= anc) {
+			++q1;
+			r1 -= anc;
+		}
+		q2 = 2 * q2;
+		r2 = 2 * r2;
+		if (r2 >= ad) {
+			++q2;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	magic_t magic = { .multiplier = (long long) (q2 + 1), .shift = p - 64 };
+	return magic;
+}
+
+// Divide scratch_reg[k] by a (non-zero) constant, or take the remainder,
+// as a long if 'wide' is set.
+// C division truncates towards zero, so a negative dividend needs
+// a correction compared to the plain shift. If the range analysis found
+// that the dividend is never negative, there's nothing to correct.
+internal void divide_by_constant(gen_t *gen, int k, long long divisor, int is_mod, int nonnegative, int wide) {
+	const char *d = scratch(k, wide);
+	// Free, since the dividend has already been evaluated.
+	const char *tmp = scratch(k + 1, wide);
+	int bits = (wide) ? 64 : 32;
+	// n / -d == -(n / d) and n % -d == n % d
+	long long abs_divisor = (divisor < 0) ? -divisor : divisor;
+	int n = log2_exact(abs_divisor);
+
+	if (abs_divisor == 1) {
+		if (is_mod)
+			emit(gen, "xor %s, %s\n", d, d);
+		else if (divisor < 0)
+			emit(gen, "neg %s\n", d);
+	} else if (n != -1 && nonnegative) {
+		if (is_mod) {
+			emit(gen, "and %s, %lld\n", d, abs_divisor - 1);
+		} else {
+			emit(gen, "shr %s, %d\n", d, n);
+			if (divisor < 0)
+				emit(gen, "neg %s\n", d);
+		}
+	} else if (n != -1) {
+		// Add 2^n - 1 to negative dividends, so that
+		// the shift rounds towards zero.
+		emit(gen, "mov %s, %s\n", tmp, d);
+		if (n > 1)
+			emit(gen, "sar %s, %d\n", tmp, bits - 1);
+		emit(gen, "shr %s, %d\n", tmp, bits - n);
+		emit(gen, "add %s, %s\n", tmp, d);
+		if (is_mod) {
+			// n % 2^n = n - (rounded n with the low bits cleared)
+			emit(gen, "and %s, %lld\n", tmp, -abs_divisor);
+			emit(gen, "sub %s, %s\n", d, tmp);
+		} else {
+			emit(gen, "sar %s, %d\n", tmp, n);
+			emit(gen, "mov %s, %s\n", d, tmp);
+			if (divisor < 0)
+				emit(gen, "neg %s\n", d);
+		}
+	} else if (nonnegative && (gen->options->features & DICC_BMI2)) {
+		// mulx multiplies by rdx, which is never handed out, into any register
+		// and the product is unsigned, which is the same for a dividend that is
+		// never negative. So the multiplier needs no correction and rax
+		// stays where it is. With the same register for both halves, it
+		// gets the high one.
+		magic_t magic = signed_magic(abs_divisor);
+		d = scratch_reg[k];
+		if (!wide)
+			emit(gen, "movsxd %s, %s\n", d, scratch_reg32[k]);
+		emit(gen, "mov rdx, %lld\n", magic.multiplier);
+		emit(gen, "mulx rdx, rdx, %s\n", d);
+		if (magic.shift)
+			emit(gen, "shr rdx, %d\n", magic.shift);
+
+		if (is_mod) {
+			emit(gen, "imul rdx, rdx, %lld\n", abs_divisor);
+			emit(gen, "sub %s, rdx\n", d);
+		} else {
+			emit(gen, "mov %s, rdx\n", d);
+			if (divisor < 0)
+				emit(gen, "neg %s\n", scratch(k, wide));
+		}
+	} else {
+		// The one-operand imul multiplies by rax and writes
+		// rdx:rax, so the dividend has to be in rax. If rax holds
+		// a value of an outer expression, swap it out and back.
+		magic_t magic = signed_magic(abs_divisor);
+		d = scratch_reg[k];
+		tmp = scratch_reg[k + 1];
+		if (!wide)
+			emit(gen, "movsxd %s, %s\n", d, scratch_reg32[k]);
+		if (k != 0)
+			emit(gen, "xchg rax, %s\n", d);
+
+		emit(gen, "mov %s, rax\n", tmp);
+		emit(gen, "mov rax, %lld\n", magic.multiplier);
+		emit(gen, "imul %s\n", tmp);
+		// The multiplier didn't fit as a positive 64-bit
+		// number, so we multiplied by (multiplier - 2^64).
+		if (magic.multiplier < 0)
+			emit(gen, "add rdx, %s\n", tmp);
+		if (magic.shift)
+			emit(gen, "sar rdx, %d\n", magic.shift);
+		emit(gen, "mov rax, rdx\n");
+		if (!nonnegative) {
+			// Add 1 if the quotient is negative.
+			emit(gen, "shr rax, 63\n");
+			emit(gen, "add rax, rdx\n");
+		}
+
+		if (is_mod) {
+			emit(gen, "imul rax, rax, %lld\n", abs_divisor);
+			emit(gen, "sub %s, rax\n", tmp);
+			emit(gen, "mov rax, %s\n", tmp);
+		} else if (divisor < 0) {
+			emit(gen, "neg rax\n");
+		}
+
+		if (k != 0)
+			emit(gen, "xchg rax, %s\n", d);
+	}
+}
+
+/******* INSTRUCTION SELECTION *******/
+// NOTE: An expression tree can be covered with instructions in more
+// than one way. a + b*4 + 1, with a and b in registers, can be a mov, a shl and
+// two adds or a single lea rax, [rbx + r12*4 + 1], and in x + y, with y on the
+// stack, y doesn't need a register of its own: add rax, [rbp - 8].
+// Every way to cover a node (and maybe some of the nodes under it) with
+// instructions is a tile. Like a BURS (bottom-up rewrite system) code generator,
+// we find the cheapest cover bottom-up: the cost of a tile is the cost of its
+// instructions (see the table below) plus the cost of the subtrees that it
+// leaves for other tiles, and every node gets its cheapest tile.
+// The cost of a node is the cost of getting its value into a register. An integer
+// or a variable can also be used directly as an operand (see operand_cost()).
+//
+// Every node is also labelled with the number of registers needed to evaluate it
+// without spilling (Sethi-Ullman numbering, see the top of the file), as
+// its tile says, and evaluate() emits the instructions of the tiles.
+
+typedef enum {
+	TILE_LEAF,        // mov r, imm / mov r, var
+	TILE_UNARY,       // neg r / not r / (for !) cmp r, 0 and a sete
+	TILE_LOGICAL,     // && and ||, with jumps (see assemble_logical())
+	TILE_MUL_CONST,   // see multiply_by_constant()
+	TILE_DIV_CONST,   // see divide_by_constant()
+	TILE_REG_REG,     // both operands in registers: op r1, r2
+	TILE_REG_SRC,     // op r, imm/var/[mem] for the right operand
+	TILE_SRC_REG,     // the same for the left one, if they can be swapped
+	TILE_SRC_SRC,     // cmp var, imm/var (comparisons only)
+	TILE_INC,         // inc r / dec r, for +1 and -1
+	TILE_LEA,         // lea r, [base + index*scale + disp]
+} tile_t;
+
+// Rough costs of the instructions, in cycles.
+#define COST_ALU 1      // mov, add, sub, neg, lea, shifts etc.
+#define COST_LOAD 1     // a memory operand, on top of its instruction
+#define COST_IMUL 3
+#define COST_IDIV 25
+#define COST_SETCC 2    // with the zeroing of the register
+#define COST_BRANCH 2
+
+// What the operation of 'exp' (a binary expression) costs, when
+// both operands are there already.
+internal int operation_cost(exp_t *exp) {
+	char op = exp->binExp.operator[0];
+	if (op == '*')
+		return COST_IMUL;
+	if (op == '/' || op == '%')
+		return COST_IDIV;
+	if (strchr("<>=!", op))
+		return COST_ALU + COST_SETCC;
+	return COST_ALU;
+}
+
+// Roughly, what multiply_by_constant() emits.
+internal int multiply_cost(long long value) {
+	int n;
+	if (value == 0 || value == 1 || value == -1 || log2_exact(value) != -1)
+		return COST_ALU;
+	if (value < 0 && log2_exact(-value) != -1)
+		return 2 * COST_ALU;
+	for (n = 0; (value >> n) % 2 == 0; ++n);
+	if (lea_scale(value >> n))
+		return (n) ? 2 * COST_ALU : COST_ALU;
+	// Two leas, a shl and an add or sub, or an imul.
+	return COST_IMUL;
+}
+
+// Roughly, what divide_by_constant() emits.
+internal int divide_cost(long long divisor, int nonnegative) {
+	long long abs_divisor = (divisor < 0) ? -divisor : divisor;
+	if (log2_exact(abs_divisor) != -1)
+		return (nonnegative) ? COST_ALU : 5 * COST_ALU;
+	return COST_IMUL + 4 * COST_ALU;
+}
+
+// What it costs to use 'exp' directly as an operand: nothing for an
+// integer or a variable in a register, a load for a variable on the stack,
+// and -1 if it has to be evaluated in a register.
+internal int operand_cost(gen_t *gen, exp_t *exp) {
+	if (exp->type == int_exp)
+		return 0;
+	if (exp->type == id_exp) {
+		int index = search(&(gen->table), exp->id);
+		if (index == -1)
+			return -1;
+		return (gen->table.data[index].reg != NULL) ? 0 : COST_LOAD;
+	}
+	return -1;
+}
+
+internal int in_register(gen_t *gen, exp_t *exp) {
+	return exp->type == id_exp && operand_cost(gen, exp) == 0;
+}
+
+internal int in_memory(gen_t *gen, exp_t *exp) {
+	return exp->type == id_exp && operand_cost(gen, exp) == COST_LOAD;
+}
+
+// How an instruction names the slot of 'bytes' bytes at the offset 'slot'
+// of the frame (see assemble_function()).
+internal const char *slot_operand(gen_t *gen, int slot, int bytes, char *buffer, size_t size) {
+	if (gen->frame_pointer)
+		snprintf(buffer, size, "[rbp - %d]", 8 * gen->num_saved + slot + bytes);
+	else if (gen->red_zone)
+		snprintf(buffer, size, "[rsp - %d]", slot + bytes);
+	else if (slot)
+		snprintf(buffer, size, "[rsp + %d]", slot);
+	else
+		snprintf(buffer, size, "[rsp]");
+	return buffer;
+}
+
+// How an instruction names the variable at 'index' of the table.
+internal const char *variable_operand(gen_t *gen, int index, char *buffer, size_t size) {
+	table_t *table = &(gen->table);
+	int wide = table->data[index].wide;
+	if (table->data[index].reg != NULL)
+		return register_name(table->data[index].reg, wide);
+	return slot_operand(gen, table->data[index].slot, (wide) ? 8 : 4, buffer, size);
+}
+
+// How an instruction names 'exp', which operand_cost() accepted.
+internal const char *operand(gen_t *gen, exp_t *exp, char *buffer, size_t size) {
+	if (exp->type == int_exp) {
+		snprintf(buffer, size, "%d", exp->intExp);
+		return buffer;
+	}
+	return variable_operand(gen, search(&(gen->table), exp->id), buffer, size);
+}
+
+internal int is_comparison(exp_t *exp) {
+	return exp->type == bin_exp && strchr("<>=!", exp->binExp.operator[0]) != NULL;
+}
+
+// Whether the operands can change places (a comparison mirrors its operator).
+internal int can_swap(exp_t *exp) {
+	char op = exp->binExp.operator[0];
+	return op == '+' || op == '*' || is_comparison(exp);
+}
+
+// Whether the binary expression 'exp' is computed in long. A comparison is an
+// int, but it compares in long if either of its operands is one.
+internal int operation_width(exp_t *exp) {
+	if (is_comparison(exp))
+		return exp->binExp.leftOperand->wide || exp->binExp.rightOperand->wide;
+	return exp->wide;
+}
+
+// Whether 'exp' can be used directly as an operand of an operation of the width
+// 'wide'. An int variable has to be sign-extended in a register for a long one.
+internal int same_width(exp_t *exp, int wide) {
+	return exp->type == int_exp || exp->wide == wide;
+}
+
+typedef struct {
+	exp_t *base;    // NULL if there's none
+	exp_t *index;   // same
+	int scale;
+	long long disp;
+} address_t;
+
+// 'wide' is the width of the whole address. An int in a long address is
+// sign-extended on its own, so it isn't split into more terms.
+internal int add_address_term(exp_t *exp, address_t *addr, int sign, int wide) {
+	exp_t *other, *factor;
+	int split = (exp->type == bin_exp && exp->wide == wide);
+
+	if (exp->type == int_exp) {
+		addr->disp += sign * (long long) exp->intExp;
+		return 1;
+	}
+	if (sign > 0 && split && exp->binExp.operator[0] == '+')
+		return add_address_term(exp->binExp.leftOperand, addr, 1, wide) &&
+			add_address_term(exp->binExp.rightOperand, addr, 1, wide);
+	if (sign > 0 && split && exp->binExp.operator[0] == '-' &&
+		exp->binExp.rightOperand->type == int_exp)
+		return add_address_term(exp->binExp.leftOperand, addr, 1, wide) &&
+			add_address_term(exp->binExp.rightOperand, addr, -1, wide);
+	if (sign < 0)
+		return 0;
+
+	factor = (split) ? constant_factor(exp, &other) : NULL;
+	if (factor != NULL && (factor->intExp == 2 || factor->intExp == 4 || factor->intExp == 8)) {
+		// Only the index can be scaled.
+		if (addr->index != NULL && addr->scale == 1 && addr->base == NULL)
+			addr->base = addr->index;
+		else if (addr->index != NULL)
+			return 0;
+		addr->index = other;
+		addr->scale = factor->intExp;
+	} else if (addr->base == NULL) {
+		addr->base = exp;
+	} else if (addr->index == NULL) {
+		addr->index = exp;
+		addr->scale = 1;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+// Whether a single lea can compute 'exp'. Every part of the address that
+// isn't a variable in a register (of the width of 'exp') has to be computed,
+// and we allow only one of them, so that it's as cheap in registers as the rest.
+// An int is computed in the 64-bit registers too, only its lower half is kept.
+internal int match_address(gen_t *gen, exp_t *exp, address_t *addr, exp_t **computed) {
+	char op = exp->binExp.operator[0];
+	addr->base = NULL;
+	addr->index = NULL;
+	addr->scale = 1;
+	addr->disp = 0;
+	*computed = NULL;
+
+	if ((op != '+' && op != '-') || !add_address_term(exp, addr, 1, exp->wide))
+		return 0;
+	if (addr->base == NULL && addr->index == NULL)
+		return 0;
+	if (addr->disp < INT_MIN || addr->disp > INT_MAX)
+		return 0;
+	exp_t *parts[2] = { addr->base, addr->index };
+	for (int i = 0; i < 2; ++i) {
+		if (parts[i] == NULL || (in_register(gen, parts[i]) && parts[i]->wide == exp->wide))
+			continue;
+		if (*computed != NULL)
+			return 0;
+		*computed = parts[i];
+	}
+	return 1;
+}
+
+// Use 'tile' for 'exp' if it is cheaper than what it has (or as cheap,
+// but needs fewer registers).
+internal void consider_tile(exp_t *exp, tile_t tile, int need, int cost) {
+	if (cost < exp->cost || (cost == exp->cost && need < exp->need)) {
+		exp->tile = tile;
+		exp->need = need;
+		exp->cost = cost;
+	}
+}
+
+internal void select_binary(gen_t *gen, exp_t *exp);
+
+// Pick the tiles of 'exp' and label it with the number of registers it needs.
+internal int select_tiles(gen_t *gen, exp_t *exp) {
+	if (exp->type == unary_exp) {
+		exp_t *operand = exp->unaryExp.operand;
+		select_tiles(gen, operand);
+		exp->tile = TILE_UNARY;
+		exp->need = operand->need;
+		exp->cost = operand->cost + COST_ALU;
+		if (exp->unaryExp.operator[0] == '!')
+			exp->cost += COST_SETCC;
+	} else if (exp->type == bin_exp) {
+		select_binary(gen, exp);
+	} else if (exp->type == assign_exp) {
+		select_tiles(gen, exp->assignExp.rvalue);
+		exp->tile = TILE_LEAF;
+		exp->need = exp->assignExp.rvalue->need;
+		exp->cost = exp->assignExp.rvalue->cost + COST_ALU;
+	} else {
+		exp->tile = TILE_LEAF;
+		exp->need = 1;
+		exp->cost = COST_ALU;
+	}
+	return exp->need;
+}
+
+internal void select_binary(gen_t *gen, exp_t *exp) {
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	char op = exp->binExp.operator[0];
+	int left_need = select_tiles(gen, left);
+	int right_need = select_tiles(gen, right);
+	int more = (left_need > right_need) ? left_need : right_need;
+	int wide = operation_width(exp);
+	exp_t *other, *factor, *divisor, *computed;
+	address_t addr;
+	int src;
+
+	if (is_logical(exp)) {
+		// One after the other, nothing is kept in between.
+		exp->tile = TILE_LOGICAL;
+		exp->need = more;
+		exp->cost = left->cost + right->cost + COST_BRANCH;
+		return;
+	}
+
+	// If they need the same number, then while we evaluate
+	// the second one, we need one more to keep the first.
+	exp->tile = TILE_REG_REG;
+	exp->need = (left_need == right_need) ? left_need + 1 : more;
+	exp->cost = left->cost + right->cost + operation_cost(exp);
+
+	// Multiplication and division by a constant don't need the constant in a register.
+	if ((factor = constant_factor(exp, &other)) != NULL) {
+		exp->tile = TILE_MUL_CONST;
+		exp->need = other->need;
+		exp->cost = other->cost + multiply_cost(factor->intExp);
+	} else if ((divisor = constant_divisor(exp)) != NULL) {
+		exp->tile = TILE_DIV_CONST;
+		exp->need = left_need;
+		exp->cost = left->cost + divide_cost(divisor->intExp, left->nonnegative);
+		return;
+	}
+	if (op == '/' || op == '%')
+		return;
+
+	// inc and dec are as fast as an add, but shorter.
+	if ((op == '+' || op == '-') && right->type == int_exp &&
+		(right->intExp == 1 || right->intExp == -1))
+		consider_tile(exp, TILE_INC, left_need, left->cost + COST_ALU);
+	if (factor == NULL && same_width(right, wide) && (src = operand_cost(gen, right)) != -1)
+		consider_tile(exp, TILE_REG_SRC, left_need, left->cost + src + operation_cost(exp));
+	if (factor == NULL && can_swap(exp) && same_width(left, wide) && (src = operand_cost(gen, left)) != -1)
+		consider_tile(exp, TILE_SRC_REG, right_need, right->cost + src + operation_cost(exp));
+	// cmp can't compare two memory operands, or have an immediate first.
+	if (is_comparison(exp) && left->type == id_exp && same_width(left, wide) && same_width(right, wide) &&
+		operand_cost(gen, left) != -1 && operand_cost(gen, right) != -1 &&
+		!(in_memory(gen, left) && in_memory(gen, right)))
+		consider_tile(exp, TILE_SRC_SRC, 1,
+			operand_cost(gen, left) + operand_cost(gen, right) + operation_cost(exp));
+	if (match_address(gen, exp, &addr, &computed)) {
+		if (computed != NULL)
+			consider_tile(exp, TILE_LEA, computed->need, computed->cost + COST_ALU);
+		else
+			consider_tile(exp, TILE_LEA, 1, COST_ALU);
+	}
+}
+
+// Evaluate both operands of a binary expression, the result going to
+// scratch_reg[k], in the width of its operation. Their registers are
+// returned in 'lhs' and 'rhs' (one of them is k).
+internal int evaluate_operands(gen_t *gen, exp_t *exp, int k, int *lhs, int *rhs, int line) {
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	int wide = operation_width(exp);
+
+	// Registers left for us, including the one of the result.
+	int available = NUM_SCRATCH - k;
+	int lighter = (left->need < right->need) ? left->need : right->need;
+
+	if (lighter < available) {
+		// Evaluate the heavier operand first, so that the other one
+		// can use all the registers but the one holding the first result.
+		if (left->need >= right->need) {
+			*lhs = k;
+			*rhs = k + 1;
+			if(!evaluate_as(gen, left, *lhs, wide, line) || !evaluate_as(gen, right, *rhs, wide, line))
+				return 0;
+		} else {
+			*rhs = k;
+			*lhs = k + 1;
+			if(!evaluate_as(gen, right, *rhs, wide, line) || !evaluate_as(gen, left, *lhs, wide, line))
+				return 0;
+		}
+	} else {
+		// Both of them need more registers than we've got. Keep
+		// the right one in the frame while we evaluate the left one.
+		// The slots are used like a stack, for the nested ones.
+		if(!evaluate_as(gen, right, k, wide, line))
+			return 0;
+		char slot[32];
+		slot_operand(gen, gen->temp_base + 8 * gen->temps, 8, slot, sizeof(slot));
+		emit(gen, "mov %s, %s\n", slot, scratch(k, wide));
+		++(gen->temps);
+		if (gen->temps > gen->max_temps)
+			gen->max_temps = gen->temps;
+
+		if(!evaluate_as(gen, left, k, wide, line))
+			return 0;
+
+		// scratch_reg[k + 1] is free again (or it is the
+		// one that is kept for that purpose).
+		--(gen->temps);
+		*lhs = k;
+		*rhs = k + 1;
+		emit(gen, "mov %s, %s\n", scratch(*rhs, wide), slot);
+	}
+
+	return 1;
+}
+
+/******* CONDITIONS *******/
+// NOTE: The condition of an if or a while is only used to decide
+// where to jump, so we don't compute its value as 0 or 1. A comparison
+// becomes a cmp and a conditional jump, and logical AND/OR jump as soon
+// as their first operand decides the result (which is what C requires
+// anyway, as the second operand may never be evaluated).
+
+internal int assemble_condition(gen_t *gen, exp_t *exp, int k, int jump_if, const char *target, int line);
+
+// The condition code of a comparison, or its opposite when 'negate' is set.
+internal const char *condition_code(char *operator, int negate) {
+	const char *codes[][2] = {
+		{ "<", "l" }, { "<=", "le" }, { ">", "g" }, { ">=", "ge" }, { "==", "e" }, { "!=", "ne" }
+	};
+	const char *opposite[] = { "ge", "g", "le", "l", "ne", "e" };
+	for (int i = 0; i < 6; ++i) {
+		if (!strcmp(operator, codes[i][0]))
+			return (negate) ? opposite[i] : codes[i][1];
+	}
+	return NULL;
+}
+
+// The operator for the operands the other way around (a < b is b > a).
+internal char *mirrored_operator(char *operator) {
+	const char *pairs[][2] = { { "<", ">" }, { "<=", ">=" }, { ">", "<" }, { ">=", "<=" } };
+	for (int i = 0; i < 4; ++i) {
+		if (!strcmp(operator, pairs[i][0]))
+			return (char *) pairs[i][1];
+	}
+	return operator;
+}
+
+// Set the flags for the comparison 'exp' (with scratch_reg[k...] free), as its
+// tile says. Returns its operator, mirrored if the operands were swapped,
+// or NULL if something went wrong.
+internal char *assemble_comparison(gen_t *gen, exp_t *exp, int k, int line) {
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	char buffer[32], buffer2[32];
+	int lhs, rhs;
+	int wide = operation_width(exp);
+
+	if (exp->tile == TILE_SRC_SRC) {
+		// cmp needs the size if nothing else says it.
+		int sized = in_memory(gen, left) && right->type == int_exp;
+		emit(gen, "cmp %s%s, %s\n", (sized) ? memory_size(wide) : "",
+			operand(gen, left, buffer, sizeof(buffer)), operand(gen, right, buffer2, sizeof(buffer2)));
+	} else if (exp->tile == TILE_REG_SRC) {
+		if(!evaluate_as(gen, left, k, wide, line))
+			return NULL;
+		emit(gen, "cmp %s, %s\n", scratch(k, wide), operand(gen, right, buffer, sizeof(buffer)));
+	} else if (exp->tile == TILE_SRC_REG) {
+		if(!evaluate_as(gen, right, k, wide, line))
+			return NULL;
+		emit(gen, "cmp %s, %s\n", scratch(k, wide), operand(gen, left, buffer, sizeof(buffer)));
+		return mirrored_operator(exp->binExp.operator);
+	} else {
+		if(!evaluate_operands(gen, exp, k, &lhs, &rhs, line))
+			return NULL;
+		emit(gen, "cmp %s, %s\n", scratch(lhs, wide), scratch(rhs, wide));
+	}
+	return exp->binExp.operator;
+}
+
+internal void new_label(gen_t *gen, char *label, size_t size) {
+	snprintf(label, size, ".LCOND%u", gen->label);
+	++(gen->label);
+}
+
+// exp is && or ||. Jump to 'target' if its value is 'jump_if'.
+internal int assemble_logical_condition(gen_t *gen, exp_t *exp, int k, int jump_if, const char *target, int line) {
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	// The value of the left operand that decides the result:
+	// false for AND, true for OR.
+	int decides = (exp->binExp.operator[0] == '|');
+
+	if (jump_if == decides) {
+		// If the left one decides, we jump. Otherwise,
+		// the right one decides the result.
+		return assemble_condition(gen, left, k, jump_if, target, line) &&
+			assemble_condition(gen, right, k, jump_if, target, line);
+	}
+
+	// The left one decides against jumping, so it
+	// has to skip the right one.
+	char skip[32];
+	new_label(gen, skip, sizeof(skip));
+	if(!assemble_condition(gen, left, k, decides, skip, line) ||
+	   !assemble_condition(gen, right, k, jump_if, target, line))
+		return 0;
+	emit(gen, "%s:\n", skip);
+	return 1;
+}
+
+// Jump to 'target' if the value of 'exp' is 'jump_if' (as in, non-zero
+// is true) and fall through otherwise. scratch_reg[k...] are free.
+internal int assemble_condition(gen_t *gen, exp_t *exp, int k, int jump_if, const char *target, int line) {
+	if (exp->type == int_exp) {
+		if ((exp->intExp != 0) == jump_if)
+			emit(gen, "jmp %s\n", target);
+	} else if (exp->type == unary_exp && exp->unaryExp.operator[0] == '!') {
+		return assemble_condition(gen, exp->unaryExp.operand, k, !jump_if, target, line);
+	} else if (is_logical(exp)) {
+		return assemble_logical_condition(gen, exp, k, jump_if, target, line);
+	} else if (is_comparison(exp)) {
+		char *operator = assemble_comparison(gen, exp, k, line);
+		if (operator == NULL)
+			return 0;
+		emit(gen, "j%s %s\n", condition_code(operator, !jump_if), target);
+	} else {
+		if(!evaluate(gen, exp, k, line))
+			return 0;
+		emit(gen, "test %s, %s\n", scratch(k, exp->wide), scratch(k, exp->wide));
+		emit(gen, "j%s %s\n", (jump_if) ? "ne" : "e", target);
+	}
+
+	return 1;
+}
+
+// Logical AND/OR as a value: 0 or 1 in scratch_reg[k].
+internal int assemble_logical(gen_t *gen, exp_t *exp, int k, int line) {
+	const char *d = scratch_reg32[k];
+	const char *r = scratch(k, exp->binExp.rightOperand->wide);
+	int decides = (exp->binExp.operator[0] == '|');
+	char decided[32], done[32];
+	new_label(gen, decided, sizeof(decided));
+	new_label(gen, done, sizeof(done));
+
+	// If the left operand doesn't decide, the value
+	// is whether the right one is non-zero.
+	if(!assemble_condition(gen, exp->binExp.leftOperand, k, decides, decided, line) ||
+	   !evaluate(gen, exp->binExp.rightOperand, k, line))
+		return 0;
+	emit(gen, "test %s, %s\n", r, r);
+	emit(gen, "mov %s, 0\n", d);
+	emit(gen, "setne %s\n", scratch_reg8[k]);
+	emit(gen, "jmp %s\n", done);
+	emit(gen, "%s:\n", decided);
+	emit(gen, "mov %s, %d\n", d, decides);
+	emit(gen, "%s:\n", done);
+	return 1;
+}
+
+// Compute 'exp', which is a lea (see match_address()), into scratch_reg[k].
+internal int assemble_address(gen_t *gen, exp_t *exp, int k, int line) {
+	address_t addr;
+	exp_t *computed;
+	char text[64];
+	int len = 0;
+
+	match_address(gen, exp, &addr, &computed);
+	if (computed != NULL && !evaluate_as(gen, computed, k, exp->wide, line))
+		return 0;
+	exp_t *parts[2] = { addr.base, addr.index };
+	const char *regs[2] = { NULL, NULL };
+	for (int i = 0; i < 2; ++i) {
+		if (parts[i] == NULL)
+			continue;
+		if (parts[i] == computed)
+			regs[i] = scratch_reg[k];
+		else
+			regs[i] = gen->table.data[search(&(gen->table), parts[i]->id)].reg;
+	}
+
+	if (regs[0] != NULL)
+		len += snprintf(text + len, sizeof(text) - len, "%s", regs[0]);
+	if (regs[1] != NULL) {
+		len += snprintf(text + len, sizeof(text) - len, "%s%s", (regs[0]) ? " + " : "", regs[1]);
+		if (addr.scale != 1)
+			len += snprintf(text + len, sizeof(text) - len, "*%d", addr.scale);
+	}
+	if (addr.disp > 0)
+		len += snprintf(text + len, sizeof(text) - len, " + %lld", addr.disp);
+	else if (addr.disp < 0)
+		len += snprintf(text + len, sizeof(text) - len, " - %lld", -addr.disp);
+	emit(gen, "lea %s, [%s]\n", scratch(k, exp->wide), text);
+	return 1;
+}
+
+internal int assemble_binary(gen_t *gen, exp_t *exp, int k, int line) {
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	int wide = exp->wide;
+	const char *d = scratch(k, wide);
+	char buffer[32];
+	int lhs, rhs;
+	exp_t *other;
+
+	if (exp->tile == TILE_LOGICAL) {
+		return assemble_logical(gen, exp, k, line);
+	} else if (exp->tile == TILE_MUL_CONST) {
+		exp_t *factor = constant_factor(exp, &other);
+		if(!evaluate_as(gen, other, k, wide, line))
+			return 0;
+		multiply_by_constant(gen, k, factor->intExp, wide);
+	} else if (exp->tile == TILE_DIV_CONST) {
+		if(!evaluate_as(gen, left, k, wide, line))
+			return 0;
+		divide_by_constant(gen, k, right->intExp, exp->binExp.operator[0] == '%', left->nonnegative, wide);
+	} else if (exp->tile == TILE_LEA) {
+		return assemble_address(gen, exp, k, line);
+	} else if (is_comparison(exp)) {
+		char *operator = assemble_comparison(gen, exp, k, line);
+		if (operator == NULL)
+			return 0;
+		// mov doesn't change the flags (see also the peephole
+		// rules, that turn it to an xor before the cmp).
+		emit(gen, "mov %s, 0\n", d);
+		emit(gen, "set%s %s\n", condition_code(operator, 0), scratch_reg8[k]);
+	} else if (exp->tile == TILE_INC) {
+		if(!evaluate_as(gen, left, k, wide, line))
+			return 0;
+		int up = (exp->binExp.operator[0] == '+') == (right->intExp == 1);
+		emit(gen, "%s %s\n", (up) ? "inc" : "dec", d);
+	} else if (exp->tile == TILE_REG_SRC || exp->tile == TILE_SRC_REG) {
+		// The one in a register is evaluated,
+		// the other is used as it is.
+		int swapped = (exp->tile == TILE_SRC_REG);
+		if(!evaluate_as(gen, (swapped) ? right : left, k, wide, line))
+			return 0;
+		char op = exp->binExp.operator[0];
+		const char *instruction = (op == '+') ? "add" : (op == '-') ? "sub" : "imul";
+		emit(gen, "%s %s, %s\n", instruction, d,
+			operand(gen, (swapped) ? left : right, buffer, sizeof(buffer)));
+	} else {
+		if(!evaluate_operands(gen, exp, k, &lhs, &rhs, line))
+			return 0;
+		// If neither operand is negative, the division can be unsigned.
+		int is_unsigned = left->nonnegative && right->nonnegative;
+		assemble_operation(gen, exp->binExp.operator, k, lhs, rhs, is_unsigned, wide);
+	}
+	return 1;
+}
+
+// Evaluate 'exp' into scratch_reg[k], in its own width.
+internal int evaluate(gen_t *gen, exp_t *exp, int k, int line) {
 	table_t *table = &(gen->table);
+	const char *reg = scratch(k, exp->wide);
+	char buffer[32];
 
 	if (exp->type == unary_exp) {
-		if(!assemble_expression(gen, exp->unaryExp.operand, line))
+		// A long - or ~ of an int operand sign-extends it first (a ! is an int).
+		if(!evaluate_as(gen, exp->unaryExp.operand, k, exp->wide, line))
 			return 0;
 		if (exp->unaryExp.operator[0] == '-')
-			fprintf(output, "neg rax\n");
+			emit(gen, "neg %s\n", reg);
 		else if (exp->unaryExp.operator[0] == '~')
-			fprintf(output, "not rax\n");
+			emit(gen, "not %s\n", reg);
 		else if (exp->unaryExp.operator[0] == '!') {
-			// Assume that 'eax' contains our non-yet-negated value.
+			// Assume that 'reg' contains our non-yet-negated value.
 
-			// We compare 'eax' with 0.
-			fprintf(output, "cmp rax, 0\n");
+			// We compare 'reg' with 0 (in the width of
+			// the operand, ! is always an int).
+			emit(gen, "cmp %s, 0\n", scratch(k, exp->unaryExp.operand->wide));
 
-			// Then, we want to zero 'eax' (so that
+			// Then, we want to zero 'reg' (so that
 			// in the next instruction either keep it zero,
-			// or set it to 1).
-			// Zeroing with xor is faster than mov.
-			fprintf(output, "xor rax, rax\n");
+			// or set it to 1). Not with xor, because
+			// it alters the eflags values.
+			emit(gen, "mov %s, 0\n", reg);
 			
 			// If the comparison set the ZF	(zero flag), i.e.
-			// if 'eax' was 0, then we want to set its lower
-			// byte (which we call with register %al) to 1 (thus
-			// completing the negation).
-			fprintf(output, "sete al\n");
+			// if 'reg' was 0, then we want to set its lower
+			// byte to 1 (thus completing the negation).
+			emit(gen, "sete %s\n", scratch_reg8[k]);
 		}
 	} else if (exp->type == bin_exp) {
-		// get the result from the left expression into eax
-		if(!assemble_expression(gen, exp->binExp.leftOperand, line))
-			return 0;
-		// save the result on the stack
-		fprintf(output, "push rax\n");
-		increment_stack_top(table);
-		
-		// gethe result from the right expression into eax
-		if(!assemble_expression(gen, exp->binExp.rightOperand, line))
+		if(!assemble_binary(gen, exp, k, line))
 			return 0;
-
-		fprintf(output, "pop rcx\n");
-		decrement_stack_top(table);
-		
-		char *operator = exp->binExp.operator;
-		if (operator[0] == '+')
-			fprintf(output, "add rax, rcx\n");
-		else if (operator[0] == '*') {
-			// NOTE(stefanos): We can use imul for multiplication,
-			// but since we can show off and implement it using add
-			// and shift, let's do it. You can check shift and add
-			// method here: https://courses.cs.vt.edu/~cs1104/BuildingBlocks/multiply.040.html
-			// Just note that I am doing in reverse order (we're starting from
-			// the least significant bit).
-
-			int tmp_lbl = gen->label;
-			++(gen->label);
-
-			// check sign of first operand.
-			fprintf(output, "test rax, rax\n");
-			fprintf(output, "js .signed_mult_%d\n", tmp_lbl);
-			// check sign of second operand.
-			fprintf(output, "test rcx, rcx\n");
-			fprintf(output, "js .signed_mult_%d\n", tmp_lbl);
-			
-			// Unsigned multiplication
-			fprintf(output, ".unsigned_mult_%d:\n", tmp_lbl);
-			fprintf(output, "mov rdx, rax\n");  // first operand to rdx
-			fprintf(output, "xor rax, rax\n");  // rax will be the result accumulator.
-			fprintf(output, "mov rbx, rcx\n");  // second value to rbx  
-			fprintf(output, "mov rcx, 0\n");   	// value to shift by
-			// while(rdx != 0)
-			fprintf(output, ".mult_loop_%d:\n", tmp_lbl);
-			fprintf(output, "cmp rdx, 0\n");
-			fprintf(output, "je .after_mult_%d\n", tmp_lbl);
-			// if(rdx & 1) rax += rbx << rcx;
-			fprintf(output, "mov r11, rdx\n");
-			fprintf(output, "and r11, 1\n");
-			fprintf(output, "cmp r11, 0\n");
-			fprintf(output, "je .loop_end_%d\n", tmp_lbl);
-			fprintf(output, "mov r11, rbx\n");
-			fprintf(output, "shl r11, cl\n");
-			fprintf(output, "add rax, r11\n");
-			fprintf(output, ".loop_end_%d:\n", tmp_lbl);
-			// ++rcx;
-			fprintf(output, "add rcx, 1\n");
-			// rdx >>= 1;
-			fprintf(output, "shr rdx, 1\n");
-			fprintf(output, "jmp .mult_loop_%d\n", tmp_lbl);
-			
-			// Signed multiplication
-			fprintf(output, ".signed_mult_%d:\n", tmp_lbl);
-			fprintf(output, "imul rax, rcx\n");
-
-			fprintf(output, ".after_mult_%d:\n", tmp_lbl);
-		} else if (operator[0] == '-') {
-			// Remember that what we popped from the stack,
-			// into rcx, was the FIRST value in the addition.
-			// So, the subtraction is rcx - rax. But since we can't choose
-			// where we save the result, it is automatically saved in the first
-			// register and since we have the convention that the result goes
-			// to eax, we have to save it there.
-			fprintf(output, "sub rcx, rax\n");
-			fprintf(output, "mov rax, rcx\n");
-		} else if (operator[0] == '/') {
-			// The command for integer division is: idiv dst
-			// where 'dst' some register.
-			// The division is computed as (rdx:rax) / dst
-			// (be careful, 32 bit values)
-			// and the quotient is saved in rax (obviously,
-			// dst can't be either rax or rdx).
-
-			// So, rcx has divisor and rax the dividend.
-
-			// Move dividend to some temp register.
-			fprintf(output, "mov rbx, rax\n");
-			// Move divisor to rax
-			fprintf(output, "mov rax, rcx\n");
-			// extend the sign bit of rax to rdx
-			fprintf(output, "cdq\n");
-			fprintf(output, "idiv rbx\n");
-		} else if (operator[0] == '%') {
-			// Modulo is similar to division, because idiv saves the
-			// quotient (the result of the division) in rax and the remainder
-			// in rdx
-
-			fprintf(output, "mov rbx, rax\n");
-			// Move divisor to rax
-			fprintf(output, "mov rax, rcx\n");
-			// extend the sign bit of rax to rdx
-			fprintf(output, "cdq\n");
-			// remainder to rdx
-			fprintf(output, "idiv rbx\n");
-			// Move remainder to rax
-			fprintf(output, "mov rax, rdx\n");
-		} else if (operator[0] == '&') {
-			// NOTE(stefanos): I do some special handling
-			// for logical AND/OR, because x86 assembly
-			// does not support logical AND/OR, only
-			// bitwise.
-
-			if (operator[1] == '&') {    // logical and
-				fprintf(output, "\n");
-
-				// dl = rcx != 0
-				fprintf(output, "cmp rcx, 0\n");
-				fprintf(output, "setne dl\n");
-
-				// al = rax != 0
-				fprintf(output, "cmp rax, 0\n");
-				// For zeroing... First, you don't
-				// want to do it after the setne, as
-				// that will break the saved 'al' value,
-				// and second, you don't want to do it with xor,
-				// because that alters the eflags values.
-				fprintf(output, "mov rax, 0\n");
-				fprintf(output, "setne al\n");
-
-				fprintf(output, "and al, dl\n");
-			} else {    // bitwise and
-			}
-		} else if (operator[0] == '|') {
-			if (operator[1] == '|') {    // logical or
-				fprintf(output, "or rax, rcx\n");
-				// zeroing not with xor, because
-				// it alters the eflags values.
-				fprintf(output, "mov rax, 0\n");
-				fprintf(output, "setne al\n");
-			} else {    // bitwise or
-			}
-		// TODO(stefanos): Maybe change that to use the
-		// specific token types.
-		} else if (strchr("!<=>", operator[0])) {
-			// relational/equality expression
-			fprintf(output, "cmp rcx, rax\n");
-			fprintf(output, "mov rax, 0\n");
-			if (operator[0] == '!') {
-				// operator[1] has to be '='.
-				fprintf(output, "setne al\n");
-			} else if (operator[0] == '=') {
-				// operator[1] has to be '='.
-				fprintf(output, "sete al\n");
-			} else if (operator[0] == '>') {
-				if (operator[1] == '=')
-					fprintf(output, "setge al\n");
-				else
-					fprintf(output, "setg al\n");
-			} else if (operator[0] == '<') {
-				if (operator[1] == '=')
-					fprintf(output, "setle al\n");
-				else
-					fprintf(output, "setl al\n");
-			}
-		}
 	} else if (exp->type == int_exp) {
-		fprintf(output, "mov rax, %d\n", exp->intExp);
+		emit(gen, "mov %s, %d\n", reg, exp->intExp);
 	} else if (exp->type == id_exp) {
 		int index = search(table, exp->id);
 		if (index == -1) {
-			report_error(line, "Line %d: Undefined reference to identifier: %s\n", exp->id);
+			report_error(gen->sink, line, "Undefined reference to identifier: %s\n", exp->id);
 			return 0;
 		}
-		fprintf(output, "mov rax, [rbp - %d]\n", table->data[index].offset);
+		emit(gen, "mov %s, %s\n", reg, variable_operand(gen, index, buffer, sizeof(buffer)));
 	} else if (exp->type == assign_exp) {
-		if(!assemble_expression(gen, exp->assignExp.rvalue, line))
+		// It has the width of the variable.
+		if(!evaluate_as(gen, exp->assignExp.rvalue, k, exp->wide, line))
 			return 0;
 		int index = search(table, exp->assignExp.id);
 		if (index == -1) {
-			report_error(-1, "Undefined reference to identifier: %s\n", exp->assignExp.id);
+			report_error(gen->sink, line, "Undefined reference to identifier: %s\n", exp->assignExp.id);
 			return 0;
 		}
-		fprintf(output, "mov [rbp - %d], rax\n", table->data[index].offset);
+		emit(gen, "mov %s, %s\n", variable_operand(gen, index, buffer, sizeof(buffer)), reg);
 	}
 
 	// assume success
 	return 1;
 }
 
+// Evaluate a whole expression. The result is in rax.
+internal int assemble_expression(gen_t *gen, exp_t *exp, int line) {
+	select_tiles(gen, exp);
+	return evaluate(gen, exp, 0, line);
+}
+
+// Same, as a long if 'wide' is set, or as an int (see evaluate_as()).
+internal int assemble_value(gen_t *gen, exp_t *exp, int wide, int line) {
+	select_tiles(gen, exp);
+	return evaluate_as(gen, exp, 0, wide, line);
+}
+
+// If the statement 'exp' is x = x + y, x = x - y or x = y + x (or x = x * y, for a
+// variable in a register), return y: x can be changed in place, without going through
+// a scratch register, as in add rbx, rax or add qword ptr [rbp - 8], 5.
+internal exp_t *updated_by(gen_t *gen, exp_t *exp) {
+	if (exp->type != assign_exp || exp->assignExp.rvalue->type != bin_exp)
+		return NULL;
+	exp_t *rvalue = exp->assignExp.rvalue;
+	exp_t *left = rvalue->binExp.leftOperand;
+	exp_t *right = rvalue->binExp.rightOperand;
+	char op = rvalue->binExp.operator[0];
+	int index = search(&(gen->table), exp->assignExp.id);
+
+	if (index == -1 || (op != '+' && op != '-' && op != '*'))
+		return NULL;
+	// Constant factors are better strength-reduced, and
+	// there's no imul with a memory destination.
+	if (op == '*' && (right->type == int_exp || left->type == int_exp ||
+					  gen->table.data[index].reg == NULL))
+		return NULL;
+	if (left->type == id_exp && !strcmp(left->id, exp->assignExp.id))
+		return right;
+	if (op != '-' && right->type == id_exp && !strcmp(right->id, exp->assignExp.id))
+		return left;
+	return NULL;
+}
+
+internal int assemble_update(gen_t *gen, exp_t *exp, exp_t *value, int line) {
+	char op = exp->assignExp.rvalue->binExp.operator[0];
+	int index = search(&(gen->table), exp->assignExp.id);
+	int on_stack = (gen->table.data[index].reg == NULL);
+	int wide = gen->table.data[index].wide;
+	const char *instruction = (op == '+') ? "add" : (op == '-') ? "sub" : "imul";
+	char buffer[32], buffer2[32];
+	const char *dst = variable_operand(gen, index, buffer, sizeof(buffer));
+	// The size has to be said if the other operand doesn't say it.
+	const char *size = (on_stack && value->type == int_exp) ? memory_size(wide) : "";
+
+	if (op != '*' && value->type == int_exp && (value->intExp == 1 || value->intExp == -1)) {
+		int up = (op == '+') == (value->intExp == 1);
+		emit(gen, "%s %s%s\n", (up) ? "inc" : "dec", size, dst);
+	} else if (same_width(value, wide) && operand_cost(gen, value) != -1 &&
+			   !(on_stack && in_memory(gen, value))) {
+		emit(gen, "%s %s%s, %s\n", instruction, size, dst, operand(gen, value, buffer2, sizeof(buffer2)));
+	} else {
+		// The lower half of a long is enough for an int, as
+		// that's all of the result that we keep.
+		if(!assemble_value(gen, value, wide, line))
+			return 0;
+		emit(gen, "%s %s, %s\n", instruction, dst, scratch(0, wide));
+	}
+	return 1;
+}
+
+/******* PROFILING *******/
+// NOTE: With -fprofile-generate, every if and while has two
+// counters in .bss (see profile.c), which the code increments as it goes:
+//
+//     inc qword ptr .Lprofile_counts[rip + 16*branch]       (it ran)
+//     inc qword ptr .Lprofile_counts[rip + 16*branch + 8]   (its block ran)
+//
+// The inc changes only the flags, and it goes where they aren't live (before
+// the condition or at the start of a block), so nothing has to be saved
+// around it. When the program exits, the C library calls the functions of
+// .fini_array, and one of them writes the counters to the profile file.
+
+// Count that the if or while 'branch' ran (or that its block did, if 'taken').
+internal void count_branch(gen_t *gen, int branch, int taken) {
+	if (gen->options->profile_generate != NULL)
+		emit(gen, "inc qword ptr .Lprofile_counts[rip + %d]\n", 16 * branch + 8 * taken);
+}
+
+// The counters of the 'branches' and the function that writes them out.
+internal void assemble_profile_dump(gen_t *gen, int branches, unsigned int shape) {
+	emit(gen, ".bss\n");
+	emit(gen, ".align 8\n");
+	emit(gen, ".Lprofile_counts: .zero %d\n", 16 * branches);
+
+	emit(gen, ".section .rodata\n");
+	emit(gen, ".Lprofile_path: .asciz \"");
+	for (const char *cp = gen->options->profile_generate; *cp; ++cp) {
+		if (*cp == '"' || *cp == '\\')
+			emit(gen, "\\%c", *cp);
+		else if (*cp < ' ' || *cp > '~')
+			emit(gen, "\\%03o", (unsigned char) *cp);
+		else
+			emit(gen, "%c", *cp);
+	}
+	emit(gen, "\"\n");
+	emit(gen, ".Lprofile_mode: .asciz \"w\"\n");
+	emit(gen, ".Lprofile_header: .asciz \"dicc-profile %%d %u\\n\"\n", shape);
+	emit(gen, ".Lprofile_line: .asciz \"%%d %%lld %%lld\\n\"\n");
+
+	// rbx is the file, r12 the branch and r13 its counters. With the
+	// return address, the 3 pushes leave rsp aligned for the calls.
+	emit(gen, ".text\n");
+	emit(gen, ".Lprofile_dump:\n");
+	emit(gen, "push rbx\n");
+	emit(gen, "push r12\n");
+	emit(gen, "push r13\n");
+	emit(gen, "lea rdi, .Lprofile_path[rip]\n");
+	emit(gen, "lea rsi, .Lprofile_mode[rip]\n");
+	emit(gen, "call fopen\n");
+	emit(gen, "test rax, rax\n");
+	emit(gen, "je .Lprofile_done\n");
+	emit(gen, "mov rbx, rax\n");
+	emit(gen, "mov rdi, rbx\n");
+	emit(gen, "lea rsi, .Lprofile_header[rip]\n");
+	emit(gen, "mov edx, %d\n", branches);
+	emit(gen, "xor eax, eax\n");
+	emit(gen, "call fprintf\n");
+	if (branches) {
+		emit(gen, "xor r12d, r12d\n");
+		emit(gen, "lea r13, .Lprofile_counts[rip]\n");
+		emit(gen, ".Lprofile_next:\n");
+		emit(gen, "mov rdi, rbx\n");
+		emit(gen, "lea rsi, .Lprofile_line[rip]\n");
+		emit(gen, "mov edx, r12d\n");
+		emit(gen, "mov rcx, qword ptr [r13]\n");
+		emit(gen, "mov r8, qword ptr [r13 + 8]\n");
+		emit(gen, "xor eax, eax\n");
+		emit(gen, "call fprintf\n");
+		emit(gen, "add r13, 16\n");
+		emit(gen, "inc r12d\n");
+		emit(gen, "cmp r12d, %d\n", branches);
+		emit(gen, "jl .Lprofile_next\n");
+	}
+	emit(gen, "mov rdi, rbx\n");
+	emit(gen, "call fclose\n");
+	emit(gen, ".Lprofile_done:\n");
+	emit(gen, "pop r13\n");
+	emit(gen, "pop r12\n");
+	emit(gen, "pop rbx\n");
+	emit(gen, "ret\n");
+
+	emit(gen, ".section .fini_array,\"aw\"\n");
+	emit(gen, ".align 8\n");
+	emit(gen, ".quad .Lprofile_dump\n");
+}
+
+/******* IF-CONVERSION *******/
+// NOTE: An if whose branches only assign a few cheap values to
+// variables (like if (n % i == 0) { max = i; }) is done without a jump: all the
+// values are computed, then the condition, and cmov picks the ones of the
+// branch that runs:
+//
+//     mov rax, r12        (i)
+//     <n % i>
+//     test rax, rax
+//     cmove rbx, rcx      (max = i, if it was 0)
+//
+// A jump costs nothing when the CPU predicts it right, but ~15-20 cycles when
+// it doesn't, and for conditions that depend on the data it doesn't most
+// of the times. The price is that we compute the values of both branches,
+// so that's only done when they're cheap (see conversion_cost()). Division
+// is never done in a branch, as it could trap when its branch wouldn't run (e.g.
+// if (b != 0) { x = a / b; }), and neither are && and ||, which need jumps anyway.
+// A variable that lives on the stack gets its old value with a cmov from
+// memory and is stored back whatever the condition was.
+
+// The most assignments that the branches can make.
+#define MAX_SELECTIONS 4
+// The most (rough) instructions the values of the branches can take.
+#define IF_CONVERSION_BUDGET 8
+// With a profile, an if that goes the same way more than (100 - this)% of
+// the times is predicted well enough that the jump is cheaper than the cmovs.
+#define PREDICTABLE_PERCENT 10
+
+typedef struct {
+	char *id;
+	const char *reg;        // of the variable, NULL if it's on the stack
+	int slot;
+	int wide;
+	exp_t *then_value;      // NULL if the branch doesn't assign it
+	exp_t *else_value;
+	int then_scratch;       // where the values are computed
+	int else_scratch;
+} selection_t;
+
+typedef struct {
+	exp_t *cond;
+	int num;
+	selection_t sel[MAX_SELECTIONS];
+	statement_node_t *last;   // the end of the block of the if (or of the else)
+} conversion_t;
+
+// Roughly, the instructions that evaluating 'exp' takes, or -1 if it
+// can't be evaluated without jumps (or, if it's the value of a branch,
+// when its branch wouldn't run). Its variables have to be declared already.
+internal int conversion_cost(gen_t *gen, exp_t *exp, int is_cond) {
+	if (exp->type == int_exp)
+		return 1;
+	if (exp->type == id_exp)
+		return (search(&(gen->table), exp->id) != -1) ? 1 : -1;
+	if (exp->type == unary_exp) {
+		int operand = conversion_cost(gen, exp->unaryExp.operand, is_cond);
+		return (operand == -1) ? -1 : operand + 2;
+	}
+	if (exp->type == bin_exp && !is_logical(exp)) {
+		char op = exp->binExp.operator[0];
+		if ((op == '/' || op == '%') && !is_cond)
+			return -1;
+		int left = conversion_cost(gen, exp->binExp.leftOperand, is_cond);
+		int right = conversion_cost(gen, exp->binExp.rightOperand, is_cond);
+		if (left == -1 || right == -1)
+			return -1;
+		// imul takes 3 cycles, a comparison is a cmp and a setcc.
+		int cost = (op == '*') ? 3 : (op == '/' || op == '%') ? 20 : strchr("<>=!", op) ? 2 : 1;
+		return left + right + cost;
+	}
+	return -1;
+}
+
+internal int mentions_variable(exp_t *exp, char *id) {
+	if (exp->type == id_exp)
+		return !strcmp(exp->id, id);
+	if (exp->type == unary_exp)
+		return mentions_variable(exp->unaryExp.operand, id);
+	if (exp->type == bin_exp)
+		return mentions_variable(exp->binExp.leftOperand, id) ||
+			mentions_variable(exp->binExp.rightOperand, id);
+	return 0;
+}
+
+// Add the assignments of the block that starts at 'start' to 'conv'.
+// Returns 0 if it does anything else. '*cost' gets their cost.
+internal int collect_selections(gen_t *gen, statement_node_t *start, conversion_t *conv,
+								int is_else, int *cost) {
+	table_t *table = &(gen->table);
+
+	for (statement_node_t *node = start->next; node->stat.type != end_block; node = node->next) {
+		if (node->stat.type != simple_stat || node->stat.simpleStat.exp->type != assign_exp)
+			return 0;
+		exp_t *exp = node->stat.simpleStat.exp;
+		char *id = exp->assignExp.id;
+		exp_t *value = exp->assignExp.rvalue;
+		int index = search(table, id);
+		if (index == -1)
+			return 0;
+
+		int value_cost = conversion_cost(gen, value, 0);
+		if (value_cost == -1)
+			return 0;
+		// the cmov (and the store, for the stack)
+		*cost += value_cost + ((table->data[index].reg != NULL) ? 1 : 2);
+
+		selection_t *sel = NULL;
+		for (int i = 0; i < conv->num; ++i) {
+			exp_t *assigned = (is_else) ? conv->sel[i].else_value : conv->sel[i].then_value;
+			// All the values are computed before any of them is assigned,
+			// so they can't read what the block assigned before them.
+			if (assigned != NULL && mentions_variable(value, conv->sel[i].id))
+				return 0;
+			if (!strcmp(conv->sel[i].id, id)) {
+				if (assigned != NULL)
+					return 0;
+				sel = &(conv->sel[i]);
+			}
+		}
+		if (sel == NULL) {
+			if (conv->num >= MAX_SELECTIONS)
+				return 0;
+			sel = &(conv->sel[(conv->num)++]);
+			sel->id = id;
+			sel->reg = table->data[index].reg;
+			sel->slot = table->data[index].slot;
+			sel->wide = table->data[index].wide;
+			sel->then_value = NULL;
+			sel->else_value = NULL;
+		}
+		if (is_else)
+			sel->else_value = value;
+		else
+			sel->then_value = value;
+	}
+	return 1;
+}
+
+// Whether the if at 'node' is worth doing without jumps. Fills in 'conv'.
+internal int if_convertible(gen_t *gen, statement_node_t *node, conversion_t *conv) {
+	exp_t *cond = node->stat.ifStat.cond;
+	statement_node_t *then_start = node->next;
+	statement_node_t *then_end = block_end(then_start);
+	int cost = 0;
+	int budget = IF_CONVERSION_BUDGET;
+
+	// The instrumented program keeps every branch, to count it.
+	if (gen->options->opt_level < 1 || !(gen->options->features & DICC_CMOV) ||
+		gen->options->profile_generate != NULL ||
+		then_end == NULL || is_logical(cond) || conversion_cost(gen, cond, 1) == -1)
+		return 0;
+
+	// If the profile says that the condition goes both ways a lot, the jump is
+	// mispredicted often, so it's worth computing more for both branches.
+	int percent = taken_percent(gen->profile, node->stat.ifStat.branch);
+	if (percent != -1) {
+		if (percent < PREDICTABLE_PERCENT || percent > 100 - PREDICTABLE_PERCENT)
+			return 0;
+		budget *= 2;
+	}
+
+	conv->cond = cond;
+	conv->num = 0;
+	conv->last = then_end;
+	if (!collect_selections(gen, then_start, conv, 0, &cost))
+		return 0;
+	if (then_end->next != NULL && then_end->next->stat.type == else_stat) {
+		statement_node_t *else_start = then_end->next->next;
+		conv->last = block_end(else_start);
+		if (conv->last == NULL || !collect_selections(gen, else_start, conv, 1, &cost))
+			return 0;
+	}
+	if (conv->num == 0 || cost > budget)
+		return 0;
+
+	// Every value needs its own register until the cmovs,
+	// and the condition comes after them.
+	select_tiles(gen, cond);
+	int k = 0;
+	for (int i = 0; i < conv->num; ++i) {
+		exp_t *values[2] = { conv->sel[i].then_value, conv->sel[i].else_value };
+		for (int j = 0; j < 2; ++j) {
+			if (values[j] == NULL)
+				continue;
+			select_tiles(gen, values[j]);
+			if (k + values[j]->need > NUM_SCRATCH)
+				return 0;
+			++k;
+		}
+	}
+	return k + cond->need <= NUM_SCRATCH;
+}
+
+// Set the flags for 'cond' and return the condition code for when it
+// is true (and in 'negated' the one for when it is false).
+// scratch_reg[k...] are free.
+internal const char *assemble_flags(gen_t *gen, exp_t *cond, int k, const char **negated, int line) {
+	const char *code;
+
+	if (cond->type == unary_exp && cond->unaryExp.operator[0] == '!') {
+		code = assemble_flags(gen, cond->unaryExp.operand, k, negated, line);
+		const char *temp = code;
+		code = *negated;
+		*negated = temp;
+	} else if (is_comparison(cond)) {
+		char *operator = assemble_comparison(gen, cond, k, line);
+		code = condition_code(operator, 0);
+		*negated = condition_code(operator, 1);
+	} else {
+		evaluate(gen, cond, k, line);
+		emit(gen, "test %s, %s\n", scratch(k, cond->wide), scratch(k, cond->wide));
+		code = "ne";
+		*negated = "e";
+	}
+	return code;
+}
+
+internal void assemble_if_conversion(gen_t *gen, conversion_t *conv, int line) {
+	const char *code, *negated;
+	char buffer[32];
+	int wide;
+
+	// x = cond (or !cond) is just a setcc.
+	selection_t *sel = &(conv->sel[0]);
+	if (conv->num == 1 && sel->then_value != NULL && sel->else_value != NULL &&
+		sel->then_value->type == int_exp && sel->else_value->type == int_exp &&
+		sel->then_value->intExp + sel->else_value->intExp == 1 &&
+		(sel->then_value->intExp == 0 || sel->then_value->intExp == 1)) {
+		code = assemble_flags(gen, conv->cond, 0, &negated, line);
+		emit(gen, "set%s al\n", (sel->then_value->intExp) ? code : negated);
+		// The 32-bit movzx clears all of the register.
+		if (sel->reg != NULL) {
+			emit(gen, "movzx %s, al\n", register_name(sel->reg, 0));
+		} else {
+			emit(gen, "movzx eax, al\n");
+			emit(gen, "mov %s, %s\n", slot_operand(gen, sel->slot, (sel->wide) ? 8 : 4, buffer, sizeof(buffer)),
+				scratch(0, sel->wide));
+		}
+		return;
+	}
+
+	int k = 0;
+	for (int i = 0; i < conv->num; ++i) {
+		sel = &(conv->sel[i]);
+		if (sel->then_value != NULL) {
+			evaluate_as(gen, sel->then_value, k, sel->wide, line);
+			sel->then_scratch = k++;
+		}
+		if (sel->else_value != NULL) {
+			evaluate_as(gen, sel->else_value, k, sel->wide, line);
+			sel->else_scratch = k++;
+		}
+	}
+
+	code = assemble_flags(gen, conv->cond, k, &negated, line);
+
+	// mov doesn't change the flags.
+	for (int i = 0; i < conv->num; ++i) {
+		sel = &(conv->sel[i]);
+		wide = sel->wide;
+		if (sel->reg == NULL) {
+			// Pick in the register of one of the values and store it.
+			int result;
+			slot_operand(gen, sel->slot, (wide) ? 8 : 4, buffer, sizeof(buffer));
+			if (sel->then_value != NULL && sel->else_value != NULL) {
+				result = sel->then_scratch;
+				emit(gen, "cmov%s %s, %s\n", negated, scratch(result, wide), scratch(sel->else_scratch, wide));
+			} else if (sel->then_value != NULL) {
+				result = sel->then_scratch;
+				emit(gen, "cmov%s %s, %s\n", negated, scratch(result, wide), buffer);
+			} else {
+				result = sel->else_scratch;
+				emit(gen, "cmov%s %s, %s\n", code, scratch(result, wide), buffer);
+			}
+			emit(gen, "mov %s, %s\n", buffer, scratch(result, wide));
+		} else {
+			const char *reg = register_name(sel->reg, wide);
+			if (sel->then_value != NULL && sel->else_value != NULL) {
+				emit(gen, "mov %s, %s\n", reg, scratch(sel->else_scratch, wide));
+				emit(gen, "cmov%s %s, %s\n", code, reg, scratch(sel->then_scratch, wide));
+			} else if (sel->then_value != NULL) {
+				emit(gen, "cmov%s %s, %s\n", code, reg, scratch(sel->then_scratch, wide));
+			} else {
+				emit(gen, "cmov%s %s, %s\n", negated, reg, scratch(sel->else_scratch, wide));
+			}
+		}
+	}
+}
+
+/******* BLOCK LAYOUT *******/
+// NOTE: The code is laid out in the order of the source, apart from
+// two things, decided with static heuristics (Ball and Larus, "Branch
+// Prediction for Free"):
+// - A branch of an if that ends with a return or a break is an early exit,
+//   which is taken once, if at all, while the rest runs many times. Its code
+//   goes after the function, in .text.unlikely, with the cold code of the
+//   rest of the program, so the likely path falls through and the hot
+//   code takes less of the i-cache. It ends with a jump, so there's no jump
+//   back from it.
+// - The loops are rotated (see the while statement), so the target of the
+//   back edge, the start of the body, is the header that runs in every
+//   iteration. It is aligned to 16 bytes (if that takes at most 10 bytes of
+//   padding, like gcc does), so that the fetch of the body doesn't start in
+//   the middle of a 16-byte block. The padding runs once, before the loop.
+//
+// With -fprofile-use, we don't have to guess. A branch of an if that runs
+// less than COLD_PERCENT of the times the if does is cold, whatever it ends
+// with (if it doesn't end with a jump, it jumps back to the code after the
+// if), so the path that runs falls through without taking any jump. Loops
+// whose body doesn't run more than once on average aren't aligned. The ifs
+// and loops that never ran in the profile are laid out as without it.
+
+// A branch that runs less than that % of the times is moved out of the way.
+#define COLD_PERCENT 10
+
+// The last statement of the block that starts at 'start', NULL if it's empty.
+internal statement_t *last_in_block(statement_node_t *start) {
+	statement_node_t *end = block_end(start);
+	if (end == NULL || end->prev == start)
+		return NULL;
+	return &(end->prev->stat);
+}
+
+// Whether the block that starts at 'start' ends with a return or a break.
+internal int is_early_exit(statement_node_t *start) {
+	statement_t *last = last_in_block(start);
+	return last != NULL && (last->type == ret_stat || last->type == break_stat);
+}
+
+// Whether the code after the block that starts at 'start' can't be reached
+// by falling through it.
+internal int ends_with_jump(statement_node_t *start) {
+	statement_t *last = last_in_block(start);
+	return is_early_exit(start) || (last != NULL && last->type == cont_stat);
+}
+
+// Whether the loop 'branch' is worth aligning (see above).
+internal int is_hot_loop(gen_t *gen, int branch) {
+	long long runs, taken;
+	if (!branch_counts(gen->profile, branch, &runs, &taken) || runs == 0)
+		return 1;
+	return taken > runs;
+}
+
+// If the loop at 'node' is a while (1) whose body ends with if (x) { break; }
+// (which is how a do-while is parsed), return that if. Then x is what
+// decides whether the loop goes on, and it is tested at the bottom instead
+// of the 1, with one conditional jump back. The instrumented program keeps
+// the if, to count it.
+internal statement_node_t *bottom_exit(gen_t *gen, statement_node_t *node) {
+	exp_t *cond = node->stat.whileStat.cond;
+	statement_node_t *body_end = block_end(node->next);
+	if (gen->options->profile_generate != NULL || cond->type != int_exp || cond->intExp == 0 ||
+		body_end == NULL)
+		return NULL;
+
+	// if, start_block, break, end_block, right before the end of the body.
+	statement_node_t *last = body_end->prev;
+	if (last == node->next || last->stat.type != end_block)
+		return NULL;
+	statement_node_t *brk = last->prev;
+	if (brk->stat.type != break_stat || brk->prev->stat.type != start_block)
+		return NULL;
+	statement_node_t *exit = brk->prev->prev;
+	return (exit->stat.type == if_stat) ? exit : NULL;
+}
+
+// Whether 'exp' is 'id op value'.
+internal int is_operation(exp_t *exp, char *operator, char *id, int value) {
+	return exp->type == bin_exp && !strcmp(exp->binExp.operator, operator) &&
+		exp->binExp.leftOperand->type == id_exp && !strcmp(exp->binExp.leftOperand->id, id) &&
+		exp->binExp.rightOperand->type == int_exp && exp->binExp.rightOperand->intExp == value;
+}
+
+// If the loop at 'node' is while (n % 2 == 0) { n = n / 2; }, which strips the factors of 2
+// of n, return n. With BMI1, tzcnt counts them, and one shift strips them all (see target.c).
+internal char *halving_loop(gen_t *gen, statement_node_t *node) {
+	exp_t *cond = node->stat.whileStat.cond;
+	statement_node_t *body_start = node->next;
+	if (gen->options->opt_level < 1 || !(gen->options->features & DICC_BMI1) ||
+		gen->options->profile_generate != NULL)
+		return NULL;
+	if (cond->type != bin_exp || strcmp(cond->binExp.operator, "==") ||
+		cond->binExp.rightOperand->type != int_exp || cond->binExp.rightOperand->intExp != 0)
+		return NULL;
+	exp_t *mod = cond->binExp.leftOperand;
+	if (mod->type != bin_exp || mod->binExp.leftOperand->type != id_exp)
+		return NULL;
+	char *id = mod->binExp.leftOperand->id;
+	if (!is_operation(mod, "%", id, 2) || search(&(gen->table), id) == -1)
+		return NULL;
+
+	// The body is n = n / 2 only.
+	statement_node_t *update = (body_start != NULL) ? body_start->next : NULL;
+	if (update == NULL || update->stat.type != simple_stat || update->next == NULL ||
+		update->next->stat.type != end_block)
+		return NULL;
+	exp_t *exp = update->stat.simpleStat.exp;
+	if (exp->type != assign_exp || strcmp(exp->assignExp.id, id) ||
+		!is_operation(exp->assignExp.rvalue, "/", id, 2))
+		return NULL;
+	return id;
+}
+
+// Which branch of the if at 'node' is cold: 1 for the if block,
+// 2 for the else block, 0 if none (or both) are.
+internal int cold_branch(gen_t *gen, statement_node_t *node) {
+	if (gen->options->opt_level < 1)
+		return 0;
+	statement_node_t *then_end = block_end(node->next);
+	if (then_end == NULL)
+		return 0;
+	statement_node_t *else_start = NULL;
+	if (then_end->next != NULL && then_end->next->stat.type == else_stat)
+		else_start = then_end->next->next;
+
+	int then_cold, else_cold;
+	int percent = taken_percent(gen->profile, node->stat.ifStat.branch);
+	if (percent != -1) {
+		then_cold = percent < COLD_PERCENT && last_in_block(node->next) != NULL;
+		else_cold = else_start != NULL && percent > 100 - COLD_PERCENT &&
+			last_in_block(else_start) != NULL;
+	} else {
+		then_cold = is_early_exit(node->next);
+		else_cold = else_start != NULL && is_early_exit(else_start);
+	}
+	if (then_cold == else_cold)
+		return 0;
+	return (then_cold) ? 1 : 2;
+}
+
+// If the block that starts at 'start' is only a break or a continue, write the
+// label it jumps to in 'label' and return 1. The instrumented program counts
+// the block, so it keeps it.
+internal int only_jump(gen_t *gen, statement_node_t *start, char *label, size_t size) {
+	statement_node_t *jump = start->next;
+	if (gen->options->profile_generate != NULL || gen->curr_loop_label == 0 || jump == NULL ||
+		jump->next == NULL || jump->next->stat.type != end_block)
+		return 0;
+	if (jump->stat.type == break_stat)
+		snprintf(label, size, ".after_loop_%u", gen->curr_loop_label);
+	else if (jump->stat.type == cont_stat)
+		snprintf(label, size, ".loop_cond_%u", gen->curr_loop_label);
+	else
+		return 0;
+	return 1;
+}
+
+// Move the code generated after 'from' to the cold code (see assemble_function()).
+internal void move_to_cold(gen_t *gen, size_t from) {
+	size_t len = gen->out_len - from;
+	if (gen->cold_len + len > gen->cold_cap) {
+		gen->cold_cap = 2 * gen->cold_cap + len;
+		gen->cold = realloc(gen->cold, gen->cold_cap);
+	}
+	memcpy(gen->cold + gen->cold_len, gen->out + from, len);
+	gen->cold_len += len;
+	gen->out_len = from;
+}
+
+// The if at the current statement, with the branch 'cold' (see cold_branch())
+// out of the way. The other one, if there is one, is right after the condition.
+// A cold branch that is only a break or a continue isn't moved anywhere: the
+// condition jumps straight to where it goes.
+internal int assemble_cold_if(gen_t *gen, int cold, int line) {
+	exp_t *cond = peek_statement(gen)->ifStat.cond;
+	int branch = peek_statement(gen)->ifStat.branch;
+	unsigned int tmp_lbl = gen->label;
+	int join = 0;
+	char target[32];
+	snprintf(target, sizeof(target), ".LCOLD%u", tmp_lbl);
+	++(gen->label);
+
+	statement_node_t *cold_start = gen->curr_stat->next;
+	if (cold == 2)
+		cold_start = block_end(cold_start)->next->next;
+	int direct = only_jump(gen, cold_start, target, sizeof(target));
+
+	// Jump to the cold branch when the condition says so.
+	count_branch(gen, branch, 0);
+	select_tiles(gen, cond);
+	if(!assemble_condition(gen, cond, 0, cold == 1, target, line))
+		return 0;
+
+	for (int which = 1; which <= 2; ++which) {
+		if (which == 2) {
+			// No else block, we're done.
+			if (gen->curr_stat->next == NULL || gen->curr_stat->next->stat.type != else_stat)
+				break;
+			next_statement(gen);
+		}
+		next_statement(gen);
+		statement_node_t *start = gen->curr_stat;
+		if (which == cold && direct) {
+			gen->curr_stat = block_end(start);
+			continue;
+		}
+		size_t from = gen->out_len;
+		if (which == cold)
+			emit(gen, "%s:\n", target);
+		if (which == 1)
+			count_branch(gen, branch, 1);
+		if(!assemble_block(gen) || peek_statement(gen)->type != end_block)
+			return 0;
+		if (which == cold) {
+			if (!ends_with_jump(start)) {
+				emit(gen, "jmp .LJOIN%u\n", tmp_lbl);
+				join = 1;
+			}
+			move_to_cold(gen, from);
+		}
+	}
+	if (join)
+		emit(gen, ".LJOIN%u:\n", tmp_lbl);
+	return 1;
+}
+
 internal int assemble_block(gen_t *gen) {
 	statement_t *stat = peek_statement(gen);
 
@@ -316,108 +1919,114 @@ internal int assemble_statement(gen_t *gen) {
 	statement_t *stat = peek_statement(gen);
 	assert(stat != NULL);
 	
-	FILE *output = gen->output;
 	table_t *table = &(gen->table);
 	
 	int line = stat->line;   // line of statement
+	conversion_t conversion;
+	exp_t *value;
+	char *halved;
+	char buffer[32];
+	int cold;
 
 	if (stat->type == ret_stat) {
 		if(!assemble_expression(gen, stat->retStat.exp, line))
 			return 0;
 		// jump function epilogue label relative to the function in which
 		// this return statement is part of.
-		fprintf(output, "jmp .func_epilogue\n");
+		emit(gen, "jmp .func_epilogue\n");
 	} else if(stat->type == break_stat) {
 		if(gen->curr_loop_label == 0) {
-			report_error(line, "Invalid break statement - not inside loop\n");
+			report_error(gen->sink, line, "Invalid break statement - not inside loop\n");
 			return 0;
 		}
-		fprintf(output, "jmp .after_loop_%u\n", gen->curr_loop_label);
+		emit(gen, "jmp .after_loop_%u\n", gen->curr_loop_label);
 	} else if(stat->type == cont_stat) {
 		if(gen->curr_loop_label == 0) {
-			report_error(line, "Invalid continue statement - not inside loop\n");
+			report_error(gen->sink, line, "Invalid continue statement - not inside loop\n");
 			return 0;
 		}
-		fprintf(output, "jmp .loop_cond_%u\n", gen->curr_loop_label);
+		emit(gen, "jmp .loop_cond_%u\n", gen->curr_loop_label);
 	} else if (stat->type == print_stat) {
 		// result of the expression in rax.
 		if(!assemble_expression(gen, stat->printStat.exp, line))
 			return 0;
 		
-		// NOTE(stefanos):
-		/*
-			As we can see in the AMD64 ABI (Section 3.2.2 and end of Section 3.4.1),
-			before process entry (so before a call instruction), %rsp has to be aligned
-			to a 16-byte boundary (that is, it has to be a multiple on 16).
-			Currently, stack is used in two places:
-			1) Binary expressions.
-			2) Variable declarations.
-
-			In both of these cases, we count stack increase and decrease in the
-			symbol table. So, we can push ANY general purpose register to align it.
-
-			But why -8? CALL instruction pushes the RIP register onto the stack
-			so that it where jump after the function finishes. Now, our main
-			function is called by the c runtime library with... a CALL instruction.
-			That means that before that CALL, RIP was pushed into the stack and
-			so the stack is misaligned by 8.
-
-			I want to point out that you can use this method for ALL functions,
-			no matter how deep the call stack as they will have the same properties.
-			(Namely, at their start the stack will be misaligned by 8 using the same
-			logic).
-
-			Finally, another solution is to insert assembly code that checks whether
-			the stack is misaligned and pushes accordigly.
-		*/
-		int p = 0;
-		if(!is_stack_aligned(table, 16 - 8)) {
-			p = 1;
-			fprintf(output, "push rbx\n");
-			increment_stack_top(table);
-		}
-		fprintf(output, "lea rdi, fmt[rip]\n");
+		// NOTE: As we can see in the AMD64 ABI (Section 3.2.2 and end
+		// of Section 3.4.1), before a call instruction %rsp has to be aligned to
+		// a 16-byte boundary. The frame is laid out once in the prologue so that it
+		// is (see assemble_function()) and rsp doesn't move after that, so
+		// there's nothing to fix here, even for calls inside loops.
+		emit(gen, "lea rdi, fmt[rip]\n");
 		// for printf, esi gets the result of the expression
-		fprintf(output, "mov esi, eax\n");
+		emit(gen, "mov esi, eax\n");
 		// In variable argument functions, like printf, AL is used
 		// to indicate the number of vector arguments passed to a function
 		// requiring a variable number of arguments. We have none, so we zero
 		// EAX (and so AL which is its low byte).
-		fprintf(output, "xor eax, eax\n");
-		fprintf(output, "call printf\n");
-		if(p) {
-			fprintf(output, "pop rcx\n");
-			decrement_stack_top(table);
-		}
+		emit(gen, "xor eax, eax\n");
+		emit(gen, "call printf\n");
 	} else if (stat->type == decl_stat) {
 		char *id = stat->declStat.id;
 		exp_t *rvalue = stat->declStat.rvalue;
 		int index = search(table, id);
-		if (index == -1) {
-			insert(table, id, line);
-			// default initialization to 0
-			fprintf(output, "xor rax, rax\n");
-			if (rvalue != NULL) {
-				if(!assemble_expression(gen, rvalue, line))
+		const char *reg = allocated_register(&(gen->alloc), id);
+		int wide = stat->declStat.wide;
+		if (index == -1 && reg != NULL) {
+			// It lives in a register for its whole life.
+			insert_register(table, id, line, reg, wide);
+			if (stat->declStat.uninitialized) {
+				// nothing to store
+			} else if (rvalue != NULL) {
+				if(!assemble_value(gen, rvalue, wide, line))
 					return 0;
+				emit(gen, "mov %s, %s\n", register_name(reg, wide), scratch(0, wide));
+			} else {
+				// default initialization to 0 (the 32-bit
+				// xor clears all of the register)
+				emit(gen, "xor %s, %s\n", register_name(reg, 0), register_name(reg, 0));
+			}
+		} else if (index == -1) {
+			// NOTE: Its slot was reserved in the prologue (see
+			// regalloc.c). It used to be pushed here, but a declaration inside
+			// a loop or an if doesn't run exactly once, and the pushes didn't
+			// match the offsets any more.
+			int slot = spilled_slot(&(gen->alloc), id);
+			insert(table, id, line, slot, wide);
+			if (!stat->declStat.uninitialized) {
+				if (rvalue != NULL) {
+					if(!assemble_value(gen, rvalue, wide, line))
+						return 0;
+				} else {
+					// default initialization to 0
+					emit(gen, "xor eax, eax\n");
+				}
+				emit(gen, "mov %s, %s\n", slot_operand(gen, slot, (wide) ? 8 : 4, buffer, sizeof(buffer)),
+					scratch(0, wide));
 			}
-			// increment of stack_top in the symbol table is handled
-			// by insert().
-			fprintf(output, "push rax\n");
 		} else {
 			// variable already declared
 			int id_line = table->data[index].line;
-			report_error(line, "Variable %s is already declared in line %d\n", id, id_line);
+			report_error(gen->sink, line, "Variable %s is already declared in line %d\n", id, id_line);
 			return 0;
 		}
+	} else if (stat->type == simple_stat && (value = updated_by(gen, stat->simpleStat.exp)) != NULL) {
+		if(!assemble_update(gen, stat->simpleStat.exp, value, line))
+			return 0;
 	} else if (stat->type == simple_stat) {
 		if(!assemble_expression(gen, stat->simpleStat.exp, line))
 			return 0;
 	} else if (stat->type == else_stat) {
 		// All valid else statements will be parsed
 		// by the if statement parsing.
-		report_error(line, "Unexpected else statement\n");
+		report_error(gen->sink, line, "Unexpected else statement\n");
 		return 0;
+	} else if (stat->type == if_stat && (cold = cold_branch(gen, gen->curr_stat)) != 0) {
+		if(!assemble_cold_if(gen, cold, line))
+			return 0;
+	} else if (stat->type == if_stat && if_convertible(gen, gen->curr_stat, &conversion)) {
+		assemble_if_conversion(gen, &conversion, line);
+		// Continue after the if.
+		gen->curr_stat = conversion.last;
 	} else if (stat->type == if_stat) {
 		unsigned int tmp_lbl = gen->label;
 		++(gen->label);
@@ -428,17 +2037,19 @@ internal int assemble_statement(gen_t *gen) {
 		// we're generating the if statement, we don't
 		// know if there is an else statement.
 
-		// Assemble the condition
-		if(!assemble_expression(gen, stat->ifStat.cond, line))
+		// Assemble the condition. If it's false, jump to the
+		// after if code (that can be either the else code,
+		// if there is one, or the rest of the code).
+		char target[32];
+		snprintf(target, sizeof(target), ".LIF1%d", tmp_lbl);
+		int branch = stat->ifStat.branch;
+		count_branch(gen, branch, 0);
+		select_tiles(gen, stat->ifStat.cond);
+		if(!assemble_condition(gen, stat->ifStat.cond, 0, 0, target, line))
 			return 0;
-		// Now, we have the result of the condition in rax.
-		fprintf(output, "cmp rax, 0\n");
-		// False condition, jump to the after if code (that
-		// can be either the else code, if there is one, or
-		// the rest of the code)
-		fprintf(output, "je .LIF1%d\n", tmp_lbl);
 		// Assemble the if block
 		next_statement(gen);
+		count_branch(gen, branch, 1);
 		if(!assemble_block(gen))
 			return 0;
 		if(peek_statement(gen)->type != end_block)
@@ -455,9 +2066,9 @@ internal int assemble_statement(gen_t *gen) {
 
 				// Part of the if code, at the end jump
 				// to the rest of the code
-				fprintf(output, "jmp .LIF2%d\n", tmp_lbl);
+				emit(gen, "jmp .LIF2%d\n", tmp_lbl);
 				// else code label
-				fprintf(output, ".LIF1%d:\n", tmp_lbl);
+				emit(gen, ".LIF1%d:\n", tmp_lbl);
 				next_statement(gen);
 				if(!assemble_block(gen))
 					return 0;
@@ -465,44 +2076,94 @@ internal int assemble_statement(gen_t *gen) {
 				if(stat->type != end_block) {
 					// TODO(stefanos): Could we ever have that error (because
 					// of parenthesization check)?
-					report_error(stat->line, "Expected end of block\n");
+					report_error(gen->sink, stat->line, "Expected end of block\n");
 					return 0;
 				}
 				// rest of code label
-				fprintf(output, ".LIF2%d:\n", tmp_lbl);
+				emit(gen, ".LIF2%d:\n", tmp_lbl);
 			} else {
 				// We don't have else statement, so
 				// the after if code is just the rest of the code.
-				fprintf(output, ".LIF1%d:\n", tmp_lbl);
+				emit(gen, ".LIF1%d:\n", tmp_lbl);
 				prev_statement(gen);
 			}
 		}
+	} else if (stat->type == while_stat && (halved = halving_loop(gen, gen->curr_stat)) != NULL) {
+		// NOTE: An even n is exactly divided by 2 with a shift, so
+		// n >> (its trailing zeros) is what the loop leaves. 0 stays even
+		// and the loop never ends, which tzcnt tells with the carry.
+		int index = search(table, halved);
+		int wide = table->data[index].wide;
+		const char *n = variable_operand(gen, index, buffer, sizeof(buffer));
+		unsigned int tmp_lbl = (gen->label)++;
+
+		emit(gen, "mov %s, %s\n", scratch(0, wide), n);
+		emit(gen, "tzcnt %s, %s\n", scratch(1, wide), scratch(0, wide));
+		emit(gen, ".loop_body_%u:\n", tmp_lbl);
+		emit(gen, "jc .loop_body_%u\n", tmp_lbl);
+		emit(gen, "sar %s, cl\n", scratch(0, wide));
+		emit(gen, "mov %s, %s\n", n, scratch(0, wide));
+		gen->curr_stat = block_end(gen->curr_stat->next);
 	} else if (stat->type == while_stat) {
 		unsigned int tmp_lbl = gen->label;
 		unsigned int save_lbl = gen->curr_loop_label;
 		++(gen->label);
 
-		// Label condition
-		fprintf(output, ".loop_cond_%u:\n", tmp_lbl);
-		// Assemble the condition
-		if(!assemble_expression(gen, stat->whileStat.cond, line))
+		// NOTE: The loop is rotated: the condition is tested at
+		// the bottom, so every iteration takes only the conditional jump back.
+		// For the first iteration, it is also tested once before the loop:
+		//
+		//     if (!cond) goto after_loop;
+		//   loop_body:
+		//     body
+		//   loop_cond:             <- continue
+		//     if (cond) goto loop_body;
+		//   after_loop:
+		exp_t *cond = stat->whileStat.cond;
+		char after_loop[32], loop_body[32];
+		snprintf(after_loop, sizeof(after_loop), ".after_loop_%u", tmp_lbl);
+		snprintf(loop_body, sizeof(loop_body), ".loop_body_%u", tmp_lbl);
+
+		int branch = stat->whileStat.branch;
+		count_branch(gen, branch, 0);
+		select_tiles(gen, cond);
+		if(!assemble_condition(gen, cond, 0, 0, after_loop, line))
 			return 0;
-		// Result of the condition in rax.
-		fprintf(output, "cmp rax, 0\n");
-		
-		// False condition, jump to the .after_loop code code
-		fprintf(output, "je .after_loop_%u\n", tmp_lbl);
-		
+		if (gen->options->opt_level >= 1 && is_hot_loop(gen, branch))
+			emit(gen, ".p2align 4,,10\n");
+		emit(gen, "%s:\n", loop_body);
+		count_branch(gen, branch, 1);
+
 		// Assemble the while block
 		// Mark curent loop you're inside
 		gen->curr_loop_label = tmp_lbl;
+		statement_node_t *exit = bottom_exit(gen, gen->curr_stat);
 		next_statement(gen);
-		if(!assemble_block(gen) || peek_statement(gen)->type != end_block)
-			return 0;
+		if (exit != NULL) {
+			// Everything up to the if, which becomes the condition.
+			next_statement(gen);
+			while (gen->curr_stat != exit) {
+				if(!assemble_statement(gen))
+					return 0;
+			}
+			emit(gen, ".loop_cond_%u:\n", tmp_lbl);
+			exp_t *exit_cond = exit->stat.ifStat.cond;
+			select_tiles(gen, exit_cond);
+			if(!assemble_condition(gen, exit_cond, 0, 0, loop_body, exit->stat.line))
+				return 0;
+			// The end of the body.
+			gen->curr_stat = block_end(exit->next)->next;
+			emit(gen, "%s:\n", after_loop);
+		} else {
+			if(!assemble_block(gen) || peek_statement(gen)->type != end_block)
+				return 0;
 
-		// Jump again to the condition
-		fprintf(output, "jmp .loop_cond_%u\n", tmp_lbl);
-		fprintf(output, ".after_loop_%u: \n",  tmp_lbl);
+			// Test the condition again, and go back if it holds.
+			emit(gen, ".loop_cond_%u:\n", tmp_lbl);
+			if(!assemble_condition(gen, cond, 0, 1, loop_body, line))
+				return 0;
+			emit(gen, "%s:\n", after_loop);
+		}
 
 		// Done with this loop, fall back to previous (or none)
 		gen->curr_loop_label = save_lbl;
@@ -514,34 +2175,131 @@ internal int assemble_statement(gen_t *gen) {
 	return 1;
 }
 
-int assemble_function(gen_t *gen) {
-	int success = 1;
+// Whether any statement from 'node' on calls a function (print does).
+internal int makes_calls(statement_node_t *node) {
+	for (; node != NULL; node = node->next) {
+		if (node->stat.type == print_stat)
+			return 1;
+	}
+	return 0;
+}
 
-	FILE *output = gen->output;
+// The bytes under rsp that a function that calls nothing can use.
+#define RED_ZONE_SIZE 128
+
+int assemble_function(gen_t *gen) {
 	statement_t *stat = peek_statement(gen);
-	table_t *table = &(gen->table);
 
 	if (stat->type == func_stat) {
 		// Make the name of the function a global label.
-		char *func_name = stat->funcStat.name;
-		fprintf(output, ".globl %s\n", func_name);
-		fprintf(output, "%s: \n", func_name);
+		const char *func_name = stat->funcStat.name;
+		if (gen->options->symbol != NULL)
+			func_name = gen->options->symbol;
+		emit(gen, ".globl %s\n", func_name);
+		emit(gen, "%s: \n", func_name);
 
-		// function prologue (for every function)
-		fprintf(output, "push rbp\n");
-		fprintf(output, "mov rbp, rsp\n");
+		// NOTE: The frame is laid out statically:
+		//
+		//     return address       <- rsp + 8 is 16-byte aligned here
+		//     saved rbp            <- rbp (unless -fomit-frame-pointer)
+		//     callee-saved registers that hold variables
+		//     padding
+		//     temporaries of expressions (see evaluate_operands())
+		//     variables that live on the stack (see regalloc.c)
+		//                          <- rsp, 16-byte aligned
+		//
+		// All of it is allocated with one sub in the prologue, and rsp doesn't
+		// move until the epilogue, so it is aligned at every call. Everything
+		// is addressed off rbp, or off rsp if we omit the frame pointer, which
+		// saves the push, the mov and the pop of rbp and gives one more register
+		// for the variables. The offsets of the slots (8 bytes for a long or a
+		// temporary, 4 for an int) are counted from rsp up, so their address
+		// never depends on how many temporaries we need, which we know
+		// only after we have generated the code (the sub is put in the
+		// prologue at the end).
+		//
+		// A function that calls nothing doesn't need rsp to point below its
+		// frame at all: the ABI guarantees that the 128 bytes under rsp (the red
+		// zone) aren't touched by signal handlers, so if the slots fit there,
+		// they stay under rsp and nothing is allocated.
+		gen->frame_pointer = !gen->options->omit_frame_pointer;
+		gen->red_zone = gen->options->red_zone && !makes_calls(gen->curr_stat);
+		if (gen->frame_pointer) {
+			emit(gen, "push rbp\n");
+			emit(gen, "mov rbp, rsp\n");
+		}
+		const char *saved[MAX_SAVED_REGISTERS];
+		int num_saved = saved_registers(&(gen->alloc), saved);
+		for (int i = 0; i < num_saved; ++i)
+			emit(gen, "push %s\n", saved[i]);
+		size_t frame_at = gen->out_len;
 
-		while (peek_statement(gen) != NULL) {
-			if(!assemble_statement(gen)) {
-				return 0;
+		int spilled = spill_size(&(gen->alloc));
+		gen->num_saved = num_saved;
+		gen->temp_base = spilled;
+		if (spilled > RED_ZONE_SIZE)
+			gen->red_zone = 0;
+
+		statement_node_t *body = gen->curr_stat;
+		unsigned int label = gen->label;
+		int declared = gen->table.used;
+		for (;;) {
+			gen->temps = 0;
+			gen->max_temps = 0;
+			while (peek_statement(gen) != NULL) {
+				if(!assemble_statement(gen)) {
+					return 0;
+				}
 			}
+			if (!gen->red_zone || spilled + 8 * gen->max_temps <= RED_ZONE_SIZE)
+				break;
+			// Too many temporaries for the red zone, do it again with a frame.
+			gen->red_zone = 0;
+			gen->out_len = frame_at;
+			gen->curr_stat = body;
+			gen->label = label;
+			gen->table.used = declared;
+			gen->cold_len = 0;
+		}
+
+		int frame = 0;
+		if (!gen->red_zone) {
+			frame = spilled + 8 * gen->max_temps;
+			// rsp is 8 bytes off at the entry (the call pushed the return address),
+			// and the push of rbp fixes that.
+			int pushed = 8 * num_saved + ((gen->frame_pointer) ? 0 : 8);
+			if ((pushed + frame) % 16)
+				frame += 8;
 		}
+		if (frame)
+			emit_at(gen, frame_at, "sub rsp, %d\n", frame);
 
 		// default return value 0
-		fprintf(output, "xor eax, eax\n");
-		fprintf(output, "jmp .func_epilogue\n");
+		emit(gen, "xor eax, eax\n");
+		emit(gen, "jmp .func_epilogue\n");
+
+		// function epilogue
+		emit(gen, ".func_epilogue:\n");
+		if (frame && !gen->frame_pointer)
+			emit(gen, "add rsp, %d\n", frame);
+		else if (frame && num_saved)
+			emit(gen, "lea rsp, [rbp - %d]\n", 8 * num_saved);
+		else if (frame)
+			emit(gen, "mov rsp, rbp\n");
+		for (int i = num_saved - 1; i >= 0; --i)
+			emit(gen, "pop %s\n", saved[i]);
+		if (gen->frame_pointer)
+			emit(gen, "pop rbp\n");
+		emit(gen, "ret\n");
+
+		// The cold code (see BLOCK LAYOUT) goes out of the way.
+		if (gen->cold_len) {
+			emit(gen, ".section .text.unlikely,\"ax\",@progbits\n");
+			emit(gen, "%.*s", (int) gen->cold_len, gen->cold);
+			emit(gen, ".text\n");
+		}
 	} else {
-		report_error(-1, "Could not assemble function main\n");
+		report_error(gen->sink, -1, "Could not assemble function main\n");
 		return 0;
 	}
 
@@ -549,18 +2307,37 @@ int assemble_function(gen_t *gen) {
 	return 1;
 }
 
-int generate(ast_t *input, FILE *output) {
+int generate(ast_t *input, const dicc_options *options, profile_t *profile, dicc_sink *sink) {
 
 	int ret;
 
-	initialize_assembly(output);
-
 	gen_t gen;
-	initialize_generator(&gen, input, output);
+	initialize_generator(&gen, input, options, profile, sink);
+
+	initialize_assembly(&gen);
+
+	assign_widths(input);
+	allocate_registers(input, &(gen.alloc), options->omit_frame_pointer);
 
 	ret = assemble_function(&gen);
 
+	if (ret && options->opt_level >= 1) {
+		peephole(&gen);
+		schedule(&gen);
+	}
+
+	// It isn't part of the function, the peephole optimizer has nothing to do there.
+	if (ret && options->profile_generate != NULL)
+		assemble_profile_dump(&gen, input->branches, input->shape);
+
+	// Only hand out complete programs.
+	if (ret && sink != NULL && sink->write != NULL)
+		sink->write(sink->ctx, gen.out, gen.out_len);
+
 	clean_table(&(gen.table));
+	clean_allocation(&(gen.alloc));
+	free(gen.out);
+	free(gen.cold);
 
 	return ret;
 }
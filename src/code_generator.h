@@ -3,5 +3,6 @@
 
 #include "types.h"
 
-void generate(ast_t *, FILE *);
+// 'profile' is the one of -fprofile-use (see load_profile()).
+int generate(ast_t *, const dicc_options *, profile_t *, dicc_sink *);
 #endif
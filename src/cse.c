@@ -0,0 +1,298 @@
+/*******
+Common subexpression elimination.
+
+HOW IT WORKS:
+It is value numbering over the dominator tree. Since the language only
+has structured control flow, the dominator tree is the nesting of the
+blocks: a statement dominates the ones after it in the same block and
+everything nested in them. So we walk the statements in order, keeping
+the expressions that have been computed (available) so far:
+
+- When an expression is computed again, and nothing it reads has been
+  assigned since, the first one is saved in a new variable and both of
+  them read it:
+
+	if (n % (i + 2) == 0) {        .t0 = i + 2;
+		max = i + 2;         ->    if (n % .t0 == 0) {
+	}                                  max = .t0;
+	                               }
+
+- Leaving a block, we forget what was computed in it, as it doesn't
+  dominate what follows.
+- Assigning a variable forgets every expression that reads it. For an if,
+  that happens after it for whatever is assigned in any of its branches.
+  For a while, it happens before it for whatever is assigned in the loop,
+  since the loop comes back to its start.
+
+The operands are numbered first, so in (i + 2) * (i + 2) the second i + 2
+becomes .t0 and then .t0 * .t0 can match another .t0 * .t0.
+
+NOTE: The new variable is computed right before the statement
+of the first occurrence. So the expression has to be computed every time
+the statement runs: an operand of && or || that may not be evaluated (e.g.
+b != 0 && a / b > 2) can reuse a value, but never provides one. The same
+goes for the condition of a while, which is computed on every iteration.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "ast.h"
+#include "cse.h"
+
+typedef struct {
+	exp_t *exp;               // the first occurrence
+	exp_t **slot;             // where it is (in its parent, or its statement)
+	statement_node_t *stat;   // the statement that computes it
+	char *temp;               // the variable that holds it, NULL if not reused yet
+	int killed;               // one of its variables has been assigned since
+} available_t;
+
+typedef struct {
+	ast_t *ast;
+	int used;
+	int cap;
+	available_t *data;        // innermost block last
+} cse_t;
+
+internal void process_statements(cse_t *, statement_node_t *, statement_node_t *);
+
+internal int mentions_variable(exp_t *exp, char *id) {
+	if (exp->type == id_exp)
+		return !strcmp(exp->id, id);
+	if (exp->type == unary_exp)
+		return mentions_variable(exp->unaryExp.operand, id);
+	if (exp->type == bin_exp)
+		return mentions_variable(exp->binExp.leftOperand, id) ||
+			mentions_variable(exp->binExp.rightOperand, id);
+	return 0;
+}
+
+internal int contains(exp_t *tree, exp_t *exp) {
+	if (tree == exp)
+		return 1;
+	if (tree->type == unary_exp)
+		return contains(tree->unaryExp.operand, exp);
+	if (tree->type == bin_exp)
+		return contains(tree->binExp.leftOperand, exp) ||
+			contains(tree->binExp.rightOperand, exp);
+	return 0;
+}
+
+internal void kill_variable(cse_t *cse, char *id) {
+	for (int i = 0; i < cse->used; ++i) {
+		if (mentions_variable(cse->data[i].exp, id))
+			cse->data[i].killed = 1;
+	}
+}
+
+internal void kill_assigned(cse_t *cse, exp_t *exp) {
+	if (exp->type == assign_exp) {
+		kill_assigned(cse, exp->assignExp.rvalue);
+		kill_variable(cse, exp->assignExp.id);
+	} else if (exp->type == unary_exp) {
+		kill_assigned(cse, exp->unaryExp.operand);
+	} else if (exp->type == bin_exp) {
+		kill_assigned(cse, exp->binExp.leftOperand);
+		kill_assigned(cse, exp->binExp.rightOperand);
+	}
+}
+
+// Forget everything that reads a variable assigned
+// from 'first' up to and including 'last'.
+internal void kill_statements(cse_t *cse, statement_node_t *first, statement_node_t *last) {
+	for (statement_node_t *node = first; ; node = node->next) {
+		if (node->stat.type == decl_stat)
+			kill_variable(cse, node->stat.declStat.id);
+		exp_t **exp = statement_expression(&(node->stat));
+		if (exp != NULL)
+			kill_assigned(cse, *exp);
+		if (node == last)
+			break;
+	}
+}
+
+internal exp_t *new_variable(char *id) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = id_exp;
+	exp->id = id;
+	return exp;
+}
+
+// '*slot' computes the same value as 'avail'.
+internal void reuse(cse_t *cse, available_t *avail, exp_t **slot) {
+	if (avail->temp == NULL) {
+		// Move the first occurrence into a new variable.
+		avail->temp = new_temporary(cse->ast);
+
+		statement_t decl;
+		decl.type = decl_stat;
+		decl.line = avail->stat->stat.line;
+		decl.declStat.id = avail->temp;
+		decl.declStat.rvalue = avail->exp;
+		decl.declStat.uninitialized = 0;
+		decl.declStat.wide = 0;   // see typing.c
+		statement_node_t *stat = avail->stat;
+		statement_node_t *decl_node = insert_statement_before(cse->ast, stat, decl);
+		*(avail->slot) = new_variable(avail->temp);
+
+		// The parts of it that are available are now computed
+		// by the new statement (and their variables have to come
+		// before it).
+		for (int i = 0; i < cse->used; ++i) {
+			available_t *other = &(cse->data[i]);
+			if (other->stat == stat && other != avail && contains(avail->exp, other->exp))
+				other->stat = decl_node;
+		}
+		avail->slot = &(decl_node->stat.declStat.rvalue);
+		avail->stat = decl_node;
+	}
+
+	clean_expression(*slot);
+	free(*slot);
+	*slot = new_variable(avail->temp);
+}
+
+internal available_t *find_available(cse_t *cse, exp_t *exp) {
+	for (int i = cse->used - 1; i >= 0; --i) {
+		if (!cse->data[i].killed && same_expression(cse->data[i].exp, exp))
+			return &(cse->data[i]);
+	}
+	return NULL;
+}
+
+internal void add_available(cse_t *cse, exp_t **slot, statement_node_t *stat) {
+	if (cse->used >= cse->cap) {
+		cse->cap = (cse->cap) ? 2 * cse->cap : 32;
+		cse->data = realloc(cse->data, cse->cap * sizeof(available_t));
+	}
+	available_t *avail = &(cse->data[(cse->used)++]);
+	avail->exp = *slot;
+	avail->slot = slot;
+	avail->stat = stat;
+	avail->temp = NULL;
+	avail->killed = 0;
+}
+
+// 'provides' is set if this evaluation of the expression
+// happens whenever the statement runs.
+internal void number_expression(cse_t *cse, exp_t **slot, statement_node_t *stat, int provides) {
+	exp_t *exp = *slot;
+	if (exp->type != unary_exp && exp->type != bin_exp)
+		return;
+
+	int mark = cse->used;
+	if (exp->type == unary_exp) {
+		number_expression(cse, &(exp->unaryExp.operand), stat, provides);
+	} else {
+		char *op = exp->binExp.operator;
+		int logical = (!strcmp(op, "&&") || !strcmp(op, "||"));
+		number_expression(cse, &(exp->binExp.leftOperand), stat, provides);
+		number_expression(cse, &(exp->binExp.rightOperand), stat, provides && !logical);
+	}
+
+	available_t *avail = find_available(cse, exp);
+	if (avail != NULL) {
+		// Its operands are gone with it.
+		cse->used = mark;
+		reuse(cse, avail, slot);
+	} else if (provides) {
+		add_available(cse, slot, stat);
+	}
+}
+
+internal void process_if(cse_t *cse, statement_node_t *node, statement_node_t **after) {
+	statement_node_t *then_start = node->next;
+	statement_node_t *then_end = block_end(then_start);
+	statement_node_t *else_start = NULL;
+	statement_node_t *else_end = NULL;
+	if (then_end->next != NULL && then_end->next->stat.type == else_stat) {
+		else_start = then_end->next->next;
+		else_end = block_end(else_start);
+	}
+	*after = (else_start != NULL) ? else_end->next : then_end->next;
+
+	exp_t **cond = &(node->stat.ifStat.cond);
+	if (!has_side_effects(*cond))
+		number_expression(cse, cond, node, 1);
+	kill_assigned(cse, *cond);
+
+	// The branches start from the same available expressions.
+	int mark = cse->used;
+	int *killed = malloc((mark + 1) * sizeof(int));
+	for (int i = 0; i < mark; ++i)
+		killed[i] = cse->data[i].killed;
+
+	process_statements(cse, then_start->next, then_end);
+	cse->used = mark;
+	for (int i = 0; i < mark; ++i)
+		cse->data[i].killed = killed[i];
+
+	if (else_start != NULL) {
+		process_statements(cse, else_start->next, else_end);
+		cse->used = mark;
+		for (int i = 0; i < mark; ++i)
+			cse->data[i].killed = killed[i];
+	}
+	free(killed);
+
+	// After the if, either of them may have run.
+	kill_statements(cse, then_start, then_end);
+	if (else_start != NULL)
+		kill_statements(cse, else_start, else_end);
+}
+
+internal void process_while(cse_t *cse, statement_node_t *node, statement_node_t **after) {
+	statement_node_t *body_end = block_end(node->next);
+	*after = body_end->next;
+
+	// The start of the loop is also reached from its end.
+	kill_statements(cse, node, body_end);
+
+	int mark = cse->used;
+	if (!has_side_effects(node->stat.whileStat.cond))
+		number_expression(cse, &(node->stat.whileStat.cond), node, 0);
+	process_statements(cse, node->next->next, body_end);
+	cse->used = mark;
+}
+
+// Process the statements from 'node' up to (not including) 'end'.
+internal void process_statements(cse_t *cse, statement_node_t *node, statement_node_t *end) {
+	while (node != end) {
+		statement_t *stat = &(node->stat);
+		statement_node_t *next = node->next;
+
+		if (stat->type == if_stat) {
+			process_if(cse, node, &next);
+		} else if (stat->type == while_stat) {
+			process_while(cse, node, &next);
+		} else {
+			exp_t **exp = statement_expression(stat);
+			if (exp != NULL) {
+				if ((*exp)->type == assign_exp && !has_side_effects((*exp)->assignExp.rvalue))
+					// The usual 'x = e'.
+					number_expression(cse, &((*exp)->assignExp.rvalue), node, 1);
+				else if (!has_side_effects(*exp))
+					number_expression(cse, exp, node, 1);
+				kill_assigned(cse, *exp);
+			}
+			if (stat->type == decl_stat)
+				kill_variable(cse, stat->declStat.id);
+		}
+		node = next;
+	}
+}
+
+void eliminate_common_subexpressions(ast_t *ast) {
+	cse_t cse = {
+		.ast = ast,
+		.used = 0,
+		.cap = 0,
+		.data = NULL
+	};
+
+	process_statements(&cse, ast->root, NULL);
+
+	free(cse.data);
+}
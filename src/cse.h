@@ -0,0 +1,8 @@
+#ifndef CSE_H
+#define CSE_H
+
+#include "types.h"
+
+void eliminate_common_subexpressions(ast_t *);
+
+#endif
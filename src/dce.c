@@ -0,0 +1,428 @@
+/*******
+Dead code elimination.
+
+HOW IT WORKS:
+Three kinds of code are removed:
+
+- Unreachable statements, i.e. the rest of a block after a return, a break
+  or a continue. Their declarations stay (with no value, as they never run),
+  since a variable can be used anywhere after its declaration.
+- Dead stores: 'x = e;' or 'int x = e;' where x is not live afterwards,
+  i.e. no path from there reads x before it is written again. If e has
+  side effects, it stays as a statement of its own. 'int x;' stores a 0,
+  which is dead the same way, and then the declaration emits no code.
+- Unused variables: the declaration of a variable that is not mentioned
+  anywhere, and the assignments to a variable that is never read.
+
+The liveness is computed backwards over the structured statements. What is
+live before an if is what its condition reads, plus what is live at the start
+of either branch. A break continues with what is live after the loop, and
+a continue with what is live at its condition. A while is rotated by the
+code generator (its condition is checked before the first iteration and
+after each one), so what is live at the condition is what the condition
+reads, plus what is live after the loop or at the start of the body. That
+depends on itself, so it starts with the first two and grows with the body
+until it doesn't change.
+
+A removed store may have been the only read of another variable, so all
+of it is repeated until nothing changes.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "ast.h"
+#include "dce.h"
+
+typedef struct {
+	ast_t *ast;
+	int num_vars;
+	int vars_cap;
+	char **vars;    // the variables of the function, a set is a flag for each
+	int changed;
+} dce_t;
+
+typedef struct {
+	unsigned char *after;   // live after the loop, for a break
+	unsigned char *head;    // live at its condition, for a continue
+} loop_t;
+
+internal void live_block(dce_t *, statement_node_t *, statement_node_t *,
+						 unsigned char *, loop_t *, int);
+
+internal int variable_index(dce_t *dce, char *id) {
+	for (int i = 0; i < dce->num_vars; ++i) {
+		if (!strcmp(dce->vars[i], id))
+			return i;
+	}
+	return -1;
+}
+
+internal void collect_variables(dce_t *dce) {
+	for (statement_node_t *node = dce->ast->root; node != NULL; node = node->next) {
+		if (node->stat.type != decl_stat || variable_index(dce, node->stat.declStat.id) != -1)
+			continue;
+		if (dce->num_vars >= dce->vars_cap) {
+			dce->vars_cap = (dce->vars_cap) ? 2 * dce->vars_cap : 16;
+			dce->vars = realloc(dce->vars, dce->vars_cap * sizeof(char *));
+		}
+		dce->vars[(dce->num_vars)++] = node->stat.declStat.id;
+	}
+}
+
+internal unsigned char *new_set(dce_t *dce) {
+	// + 1 so that there's something to allocate
+	return calloc(dce->num_vars + 1, sizeof(unsigned char));
+}
+
+internal unsigned char *copy_set(dce_t *dce, unsigned char *set) {
+	unsigned char *copy = new_set(dce);
+	memcpy(copy, set, dce->num_vars);
+	return copy;
+}
+
+// Add 'src' to 'dst'. Returns whether 'dst' changed.
+internal int union_set(dce_t *dce, unsigned char *dst, unsigned char *src) {
+	int changed = 0;
+	for (int i = 0; i < dce->num_vars; ++i) {
+		if (src[i] && !dst[i]) {
+			dst[i] = 1;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+// Add the variables that 'exp' reads.
+internal void add_uses(dce_t *dce, unsigned char *live, exp_t *exp) {
+	if (exp->type == id_exp) {
+		int index = variable_index(dce, exp->id);
+		if (index != -1)
+			live[index] = 1;
+	} else if (exp->type == unary_exp) {
+		add_uses(dce, live, exp->unaryExp.operand);
+	} else if (exp->type == bin_exp) {
+		add_uses(dce, live, exp->binExp.leftOperand);
+		add_uses(dce, live, exp->binExp.rightOperand);
+	} else if (exp->type == assign_exp) {
+		// NOTE: An assignment inside an expression doesn't
+		// kill its variable. The order of evaluation of the operands
+		// is up to the code generator, so this is the safe side.
+		add_uses(dce, live, exp->assignExp.rvalue);
+	}
+}
+
+internal void live_simple(dce_t *dce, statement_node_t *node, unsigned char *live, int remove) {
+	exp_t *exp = node->stat.simpleStat.exp;
+
+	if (exp->type != assign_exp) {
+		if (!has_side_effects(exp)) {
+			// e.g. 'x + 1;' that was left from a removed store
+			if (remove) {
+				remove_statement(dce->ast, node);
+				dce->changed = 1;
+			}
+			return;
+		}
+		add_uses(dce, live, exp);
+		return;
+	}
+
+	int index = variable_index(dce, exp->assignExp.id);
+	exp_t *rvalue = exp->assignExp.rvalue;
+	if (index == -1 || live[index]) {
+		if (index != -1)
+			live[index] = 0;
+		add_uses(dce, live, rvalue);
+		return;
+	}
+
+	// A dead store
+	if (has_side_effects(rvalue)) {
+		add_uses(dce, live, rvalue);
+		if (remove) {
+			node->stat.simpleStat.exp = rvalue;
+			free(exp);
+			dce->changed = 1;
+		}
+	} else if (remove) {
+		remove_statement(dce->ast, node);
+		dce->changed = 1;
+	}
+}
+
+internal void live_declaration(dce_t *dce, statement_node_t *node, unsigned char *live, int remove) {
+	statement_t *stat = &(node->stat);
+	int index = variable_index(dce, stat->declStat.id);
+	exp_t *rvalue = stat->declStat.rvalue;
+	if (index == -1)
+		return;
+
+	if (live[index]) {
+		live[index] = 0;
+		if (rvalue != NULL)
+			add_uses(dce, live, rvalue);
+		return;
+	}
+
+	// The initial value is never read.
+	if (rvalue != NULL && has_side_effects(rvalue))
+		add_uses(dce, live, rvalue);
+	if (!remove)
+		return;
+	if (rvalue != NULL) {
+		if (has_side_effects(rvalue)) {
+			statement_t simple;
+			simple.type = simple_stat;
+			simple.line = stat->line;
+			simple.simpleStat.exp = rvalue;
+			insert_statement_before(dce->ast, node, simple);
+		} else {
+			clean_expression(rvalue);
+			free(rvalue);
+		}
+		stat->declStat.rvalue = NULL;
+		dce->changed = 1;
+	}
+	if (!stat->declStat.uninitialized) {
+		stat->declStat.uninitialized = 1;
+		dce->changed = 1;
+	}
+}
+
+internal void live_if(dce_t *dce, statement_node_t *node, unsigned char *live, loop_t *loop, int remove) {
+	statement_node_t *then_start = node->next;
+	statement_node_t *then_end = block_end(then_start);
+	exp_t *cond = node->stat.ifStat.cond;
+
+	unsigned char *live_then = copy_set(dce, live);
+	if (then_end->next != NULL && then_end->next->stat.type == else_stat) {
+		statement_node_t *else_start = then_end->next->next;
+		live_block(dce, else_start->next, block_end(else_start), live, loop, remove);
+	}
+	live_block(dce, then_start->next, then_end, live_then, loop, remove);
+	union_set(dce, live, live_then);
+	free(live_then);
+
+	add_uses(dce, live, cond);
+}
+
+internal void live_while(dce_t *dce, statement_node_t *node, unsigned char *live, int remove) {
+	statement_node_t *body_start = node->next;
+	statement_node_t *body_end = block_end(body_start);
+
+	unsigned char *head = copy_set(dce, live);
+	add_uses(dce, head, node->stat.whileStat.cond);
+	loop_t loop = {
+		.after = live,
+		.head = head
+	};
+
+	int changed;
+	do {
+		unsigned char *body = copy_set(dce, head);
+		live_block(dce, body_start->next, body_end, body, &loop, 0);
+		changed = union_set(dce, head, body);
+		free(body);
+	} while (changed);
+
+	if (remove) {
+		unsigned char *body = copy_set(dce, head);
+		live_block(dce, body_start->next, body_end, body, &loop, 1);
+		free(body);
+	}
+
+	memcpy(live, head, dce->num_vars);
+	free(head);
+}
+
+internal void live_statement(dce_t *dce, statement_node_t *node, unsigned char *live,
+							 loop_t *loop, int remove) {
+	statement_t *stat = &(node->stat);
+
+	if (stat->type == ret_stat) {
+		memset(live, 0, dce->num_vars);
+		add_uses(dce, live, stat->retStat.exp);
+	} else if (stat->type == break_stat) {
+		// Invalid ones are reported by the code generator.
+		if (loop != NULL)
+			memcpy(live, loop->after, dce->num_vars);
+	} else if (stat->type == cont_stat) {
+		if (loop != NULL)
+			memcpy(live, loop->head, dce->num_vars);
+	} else if (stat->type == print_stat) {
+		add_uses(dce, live, stat->printStat.exp);
+	} else if (stat->type == simple_stat) {
+		live_simple(dce, node, live, remove);
+	} else if (stat->type == decl_stat) {
+		live_declaration(dce, node, live, remove);
+	} else if (stat->type == if_stat) {
+		live_if(dce, node, live, loop, remove);
+	} else if (stat->type == while_stat) {
+		live_while(dce, node, live, remove);
+	}
+}
+
+// The statement after 'node' in its block (skipping the ones inside it).
+internal statement_node_t *next_in_block(statement_node_t *node) {
+	if (node->stat.type == if_stat) {
+		statement_node_t *then_end = block_end(node->next);
+		if (then_end->next != NULL && then_end->next->stat.type == else_stat)
+			return block_end(then_end->next->next)->next;
+		return then_end->next;
+	}
+	if (node->stat.type == while_stat)
+		return block_end(node->next)->next;
+	return node->next;
+}
+
+// Given what is live after the statements from 'first' up to (not
+// including) 'end', compute in 'live' what is live before them.
+internal void live_block(dce_t *dce, statement_node_t *first, statement_node_t *end,
+						 unsigned char *live, loop_t *loop, int remove) {
+	int num = 0;
+	int cap = 16;
+	statement_node_t **stats = malloc(cap * sizeof(statement_node_t *));
+	for (statement_node_t *node = first; node != end; node = next_in_block(node)) {
+		if (num >= cap) {
+			cap *= 2;
+			stats = realloc(stats, cap * sizeof(statement_node_t *));
+		}
+		stats[num++] = node;
+	}
+
+	for (int i = num - 1; i >= 0; --i)
+		live_statement(dce, stats[i], live, loop, remove);
+
+	free(stats);
+}
+
+// Remove the unreachable statements from 'first' up to (not including) 'end'.
+internal void remove_unreachable(dce_t *dce, statement_node_t *first, statement_node_t *end) {
+	statement_node_t *node = first;
+	while (node != end) {
+		statement_t *stat = &(node->stat);
+		statement_node_t *next = next_in_block(node);
+
+		if (stat->type == if_stat) {
+			statement_node_t *then_end = block_end(node->next);
+			remove_unreachable(dce, node->next->next, then_end);
+			if (then_end->next != NULL && then_end->next->stat.type == else_stat) {
+				statement_node_t *else_start = then_end->next->next;
+				remove_unreachable(dce, else_start->next, block_end(else_start));
+			}
+		} else if (stat->type == while_stat) {
+			remove_unreachable(dce, node->next->next, block_end(node->next));
+		} else if (stat->type == ret_stat || stat->type == break_stat || stat->type == cont_stat) {
+			for (statement_node_t *dead = node->next; dead != end; dead = next) {
+				next = dead->next;
+				if (dead->stat.type == decl_stat) {
+					if (dead->stat.declStat.rvalue != NULL) {
+						clean_expression(dead->stat.declStat.rvalue);
+						free(dead->stat.declStat.rvalue);
+						dead->stat.declStat.rvalue = NULL;
+					}
+					dead->stat.declStat.uninitialized = 1;
+				} else {
+					remove_statement(dce->ast, dead);
+				}
+			}
+			return;
+		}
+		node = next;
+	}
+}
+
+internal void count_mentions(dce_t *dce, exp_t *exp, int *reads, int *mentions) {
+	if (exp->type == id_exp) {
+		int index = variable_index(dce, exp->id);
+		if (index != -1) {
+			reads[index] += 1;
+			mentions[index] += 1;
+		}
+	} else if (exp->type == unary_exp) {
+		count_mentions(dce, exp->unaryExp.operand, reads, mentions);
+	} else if (exp->type == bin_exp) {
+		count_mentions(dce, exp->binExp.leftOperand, reads, mentions);
+		count_mentions(dce, exp->binExp.rightOperand, reads, mentions);
+	} else if (exp->type == assign_exp) {
+		int index = variable_index(dce, exp->assignExp.id);
+		if (index != -1)
+			mentions[index] += 1;
+		count_mentions(dce, exp->assignExp.rvalue, reads, mentions);
+	}
+}
+
+// Replace the assignments to variables that are never read by their values.
+internal void remove_unread_assignments(dce_t *dce, exp_t **slot, int *reads) {
+	exp_t *exp = *slot;
+	if (exp->type == unary_exp) {
+		remove_unread_assignments(dce, &(exp->unaryExp.operand), reads);
+	} else if (exp->type == bin_exp) {
+		remove_unread_assignments(dce, &(exp->binExp.leftOperand), reads);
+		remove_unread_assignments(dce, &(exp->binExp.rightOperand), reads);
+	} else if (exp->type == assign_exp) {
+		remove_unread_assignments(dce, &(exp->assignExp.rvalue), reads);
+		int index = variable_index(dce, exp->assignExp.id);
+		if (index != -1 && reads[index] == 0) {
+			*slot = exp->assignExp.rvalue;
+			free(exp);
+			dce->changed = 1;
+		}
+	}
+}
+
+internal void remove_unused_variables(dce_t *dce) {
+	int *reads = calloc(dce->num_vars + 1, sizeof(int));
+	int *mentions = calloc(dce->num_vars + 1, sizeof(int));
+
+	for (statement_node_t *node = dce->ast->root; node != NULL; node = node->next) {
+		exp_t **exp = statement_expression(&(node->stat));
+		if (exp != NULL)
+			count_mentions(dce, *exp, reads, mentions);
+	}
+
+	statement_node_t *next;
+	for (statement_node_t *node = dce->ast->root; node != NULL; node = next) {
+		statement_t *stat = &(node->stat);
+		next = node->next;
+		exp_t **exp = statement_expression(stat);
+		if (exp != NULL)
+			remove_unread_assignments(dce, exp, reads);
+		if (stat->type == decl_stat && stat->declStat.rvalue == NULL) {
+			int index = variable_index(dce, stat->declStat.id);
+			if (index != -1 && mentions[index] == 0) {
+				remove_statement(dce->ast, node);
+				dce->changed = 1;
+			}
+		}
+	}
+
+	free(reads);
+	free(mentions);
+}
+
+void eliminate_dead_code(ast_t *ast) {
+	dce_t dce = {
+		.ast = ast,
+		.num_vars = 0,
+		.vars_cap = 0,
+		.vars = NULL,
+		.changed = 0
+	};
+
+	remove_unreachable(&dce, ast->root, NULL);
+	collect_variables(&dce);
+
+	do {
+		dce.changed = 0;
+		// Nothing is live at the end of the function.
+		unsigned char *live = new_set(&dce);
+		live_block(&dce, ast->root, NULL, live, NULL, 1);
+		free(live);
+		remove_unused_variables(&dce);
+	} while (dce.changed);
+
+	free(dce.vars);
+}
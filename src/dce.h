@@ -0,0 +1,8 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "types.h"
+
+void eliminate_dead_code(ast_t *);
+
+#endif
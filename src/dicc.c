@@ -1,53 +1,56 @@
-#include <stdio.h>
-#include <string.h>
-
-#include "types.h"
-#include "utils.h"
-#include "lex.h"
-#include "parser.h"
-#include "ast.h"
-#include "code_generator.h"
-
-int main(int argc, char **argv) {
-
-	FILE *dest;
-
-	printf("-----------\n");
-	printf("DICC: 0.0.1\n");
-	printf("-----------\n\n");
-
-	printf("-----------------[LEXER]----------------\n\n");
-	lex_t *lex_output = lex(argv[1]); 
-
-	if(!lex_output) {
-		clean_lexer(lex_output);
-		return 0;
-	}
-
-	ast_t *ast = parser(lex_output);
-	if(!ast) {
-		report_error(-1, "Could not generate AST\n");
-		clean_lexer(lex_output);
-		return 0;
-	}
-	printf("\n\n-----------------[PARSER]----------------\n\n");
-	print_ast(ast);
-
-	argv[1][strlen(argv[1]) - 1] = 's';
-	dest = fopen(argv[1], "wb");
-
-	if(!dest) {
-		report_error(-1, "Destination file could not be opened for writing.\n");
-		return 0;
-	}
-
-	printf("\n\n-----------------[CODE GENERATOR]----------------\n\n");
-	generate(ast, stdout);
-	generate(ast, dest);
-
-	fclose(dest);
-	clean_parser(ast);
-	clean_lexer(lex_output);
-	
-	return 0;
-}
+#include <stdlib.h>
+
+#include "dicc.h"
+#include "types.h"
+#include "lex.h"
+#include "parser.h"
+#include "profile.h"
+#include "optimizer.h"
+#include "code_generator.h"
+
+void dicc_default_options(dicc_options *options) {
+	options->symbol = NULL;
+	options->opt_level = 1;
+	options->omit_frame_pointer = 0;
+	options->red_zone = 1;
+	options->profile_generate = NULL;
+	options->profile_use = NULL;
+	options->profile_use_len = 0;
+	options->precompute_steps = 100000;
+	options->features = DICC_CMOV;
+}
+
+// NOTE: This is the same pipeline as the one in main(),
+// minus the printing of the intermediate results and the files.
+int dicc_compile(const char *src, size_t len, const dicc_options *options, dicc_sink *sink) {
+	dicc_options defaults;
+	int ret;
+
+	if (options == NULL) {
+		dicc_default_options(&defaults);
+		options = &defaults;
+	}
+
+	lex_t *lex_output = lex(src, len, sink);
+	if (!lex_output)
+		return 0;
+
+	ast_t *ast = parser(lex_output);
+	if (!ast) {
+		clean_lexer(lex_output);
+		return 0;
+	}
+
+	profile_t profile;
+	ret = load_profile(ast, options, &profile, sink);
+	if (ret) {
+		optimize(ast, options, &profile);
+		ret = generate(ast, options, &profile, sink);
+	}
+
+	clean_profile(&profile);
+	clean_parser(ast);
+	clean_lexer(lex_output);
+
+	return ret;
+}
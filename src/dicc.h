@@ -0,0 +1,91 @@
+#ifndef DICC_H
+#define DICC_H
+
+#include <stddef.h>
+
+/*******
+Embeddable interface of the compiler.
+The library does no file I/O and prints nothing. The source comes in as a
+buffer, and everything that comes out (the assembly and the error messages)
+goes through the callbacks of a sink. There is no global state, so separate
+compilations can run in parallel on different threads.
+*******/
+
+typedef struct dicc_sink {
+	void *ctx;   // passed untouched to the callbacks
+
+	// Receives the generated assembly. It may be called more than once,
+	// and the chunks have to be concatenated. NULL discards the output.
+	void (*write)(void *ctx, const char *data, size_t len);
+
+	// Receives one formatted message per error. 'line' is the source
+	// line or -1 if the error is not tied to a line. NULL discards errors.
+	void (*error)(void *ctx, int line, const char *msg);
+
+	// Receives informational messages, like what the optimizations
+	// did. NULL discards them.
+	void (*note)(void *ctx, const char *msg);
+} dicc_sink;
+
+// Instruction set extensions that the generated code may use (see target.c).
+enum {
+	DICC_CMOV = 1 << 0,
+	DICC_BMI1 = 1 << 1,
+	DICC_BMI2 = 1 << 2
+};
+
+typedef struct dicc_options {
+	// Name of the global symbol of the compiled function. NULL keeps
+	// the name written in the source. Useful when many snippets are linked
+	// into the same program, as all of them are called 'main'.
+	const char *symbol;
+
+	// 0 generates code straight from the AST, 1 (the default)
+	// runs the optimization passes on the AST and on the assembly.
+	int opt_level;
+
+	// Address the frame off rsp and use rbp for variables, like
+	// -fomit-frame-pointer. Off by default.
+	int omit_frame_pointer;
+
+	// Functions that call nothing keep their frame in the 128 bytes under
+	// rsp (the red zone of the System V ABI) without allocating it.
+	// On by default, -mno-red-zone turns it off.
+	int red_zone;
+
+	// -fprofile-generate: the program counts how many times every if and
+	// while runs and which way it goes, and writes the counts to this file
+	// when it exits. NULL (the default) doesn't instrument it.
+	const char *profile_generate;
+
+	// -fprofile-use: what such a program wrote (the contents of the file, the
+	// library reads no files), to lay out the code for the paths that run.
+	// NULL (the default) if there is no profile.
+	const char *profile_use;
+	size_t profile_use_len;
+
+	// How many expressions the optimizer may evaluate to run the loops
+	// in the compiler (see precompute.c) before it gives up on them, like
+	// -fprecompute-steps=N. 0 doesn't run them. The default is 100000,
+	// which takes a few milliseconds.
+	long long precompute_steps;
+
+	// The DICC_ extensions that the code can use. The default is
+	// what every x86_64 has (DICC_CMOV), -march picks them with
+	// dicc_target_features().
+	unsigned int features;
+} dicc_options;
+
+void dicc_default_options(dicc_options *);
+
+// The extensions of the -march name 'arch' (like "haswell" or "x86-64-v3"),
+// or of the processor that we run on for "native".
+// Returns 0 if the name is unknown or the processor can't tell.
+int dicc_target_features(const char *arch, unsigned int *features);
+
+// Compiles 'len' bytes of 'src' (they don't need to be NUL-terminated).
+// 'options' can be NULL for the defaults.
+// Returns 1 on success and 0 on failure.
+int dicc_compile(const char *src, size_t len, const dicc_options *, dicc_sink *);
+
+#endif
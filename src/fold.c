@@ -0,0 +1,371 @@
+/*******
+Constant folding and constant propagation.
+
+HOW IT WORKS:
+We walk the statements in order, keeping a state: for every variable,
+whether its value at that point is a known constant. A declaration or an
+assignment of a constant expression makes the variable known, anything
+else makes it unknown. Every (sub)expression whose value is known and that
+doesn't assign anything is replaced with an integer expression.
+
+Where control flow joins, the states of the incoming paths are met: a
+variable stays known only if it has the same value in all of them.
+- For an if, that's the end of the two branches.
+- For a while, the state at the start of an iteration is the meet of the
+  state before the loop, the one at the end of the body and the ones at
+  the continue statements. We don't know it beforehand, so we go over the
+  loop (without changing anything) until it stops changing. The state
+  after the loop is the meet of the one where the condition is false and
+  the ones at the break statements.
+After a return, break or continue, the rest of the block is unreachable and
+doesn't take part in any meet.
+
+If the condition of an if is known, the branch that can't run is removed
+and the other one takes the place of the whole statement. A while whose
+condition is known to be false is removed.
+
+The values are computed as 64-bit integers, like the generated code does,
+and a value is only considered known if it fits in an integer expression.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "types.h"
+#include "ast.h"
+#include "state.h"
+#include "fold.h"
+
+typedef struct {
+	int known;        // whether it is a compile-time constant
+	long long value;
+} value_t;
+
+typedef struct {
+	ast_t *ast;
+	int transform;        // change the AST, or just compute the states
+	state_t *breaks;      // meet of the states at the breaks of the current loop
+	state_t *continues;   // same for the continues
+} fold_t;
+
+// The variables that are not in a state (see state.c) are unknown.
+global_var const value_t unknown = { 0, 0 };
+
+internal value_t lookup(state_t *state, char *id) {
+	value_t *val = find_binding(state, id);
+	return (val != NULL) ? *val : unknown;
+}
+
+internal int same_value(const void *a, const void *b) {
+	const value_t *x = a, *y = b;
+	return x->known == y->known && (!x->known || x->value == y->value);
+}
+
+// dst = dst meet src
+internal void meet_state(state_t *dst, state_t *src) {
+	if (!src->reachable)
+		return;
+	if (!dst->reachable) {
+		clean_state(dst);
+		copy_state(dst, src);
+		return;
+	}
+	for (int i = 0; i < dst->used; ++i) {
+		value_t val = lookup(src, dst->ids[i]);
+		if (!same_value(state_value(dst, i), &val))
+			*(value_t *) state_value(dst, i) = unknown;
+	}
+}
+
+internal value_t make_known(long long value) {
+	value_t val = { 1, value };
+	// It has to fit in an integer expression.
+	if (value < INT_MIN || value > INT_MAX)
+		return unknown;
+	return val;
+}
+
+internal value_t compute_unary(char *operator, value_t operand) {
+	if (!operand.known)
+		return unknown;
+	if (operator[0] == '-')
+		return make_known(-operand.value);
+	if (operator[0] == '~')
+		return make_known(~operand.value);
+	if (operator[0] == '!')
+		return make_known(!operand.value);
+	return unknown;
+}
+
+internal value_t compute_binary(char *operator, value_t left, value_t right) {
+	// These two are decided by their left operand alone.
+	if (operator[0] == '&' && left.known && !left.value)
+		return make_known(0);
+	if (operator[0] == '|' && left.known && left.value)
+		return make_known(1);
+
+	if (!left.known || !right.known)
+		return unknown;
+
+	long long l = left.value;
+	long long r = right.value;
+	switch (operator[0]) {
+		case '+': return make_known(l + r);
+		case '-': return make_known(l - r);
+		case '*': return make_known(l * r);
+		// Leave the division by zero to the runtime.
+		case '/': return (r != 0) ? make_known(l / r) : unknown;
+		case '%': return (r != 0) ? make_known(l % r) : unknown;
+		case '&': return make_known(l && r);
+		case '|': return make_known(l || r);
+		case '=': return make_known(l == r);
+		case '!': return make_known(l != r);
+		case '<': return make_known((operator[1] == '=') ? l <= r : l < r);
+		case '>': return make_known((operator[1] == '=') ? l >= r : l > r);
+	}
+	return unknown;
+}
+
+// Compute the value of 'exp' and, if we're transforming, replace
+// the parts of it that are constant. Assignments inside the expression
+// are not applied to the state, the caller takes care of them.
+internal value_t fold_expression(fold_t *fold, state_t *state, exp_t *exp) {
+	value_t val = unknown;
+
+	if (exp->type == int_exp) {
+		return make_known(exp->intExp);
+	} else if (exp->type == id_exp) {
+		val = lookup(state, exp->id);
+	} else if (exp->type == unary_exp) {
+		value_t operand = fold_expression(fold, state, exp->unaryExp.operand);
+		val = compute_unary(exp->unaryExp.operator, operand);
+	} else if (exp->type == bin_exp) {
+		value_t left = fold_expression(fold, state, exp->binExp.leftOperand);
+		value_t right = fold_expression(fold, state, exp->binExp.rightOperand);
+		val = compute_binary(exp->binExp.operator, left, right);
+	} else if (exp->type == assign_exp) {
+		val = fold_expression(fold, state, exp->assignExp.rvalue);
+	}
+
+	if (fold->transform && val.known && !has_side_effects(exp)) {
+		clean_expression(exp);
+		exp->type = int_exp;
+		exp->intExp = (int) val.value;
+	}
+	return val;
+}
+
+// Fold the expression of a statement and apply its assignments.
+internal value_t fold_full_expression(fold_t *fold, state_t *state, exp_t *exp) {
+	// The usual 'x = e', where 'e' doesn't assign anything.
+	if (exp->type == assign_exp && !has_side_effects(exp->assignExp.rvalue)) {
+		value_t val = fold_expression(fold, state, exp->assignExp.rvalue);
+		bind(state, exp->assignExp.id, &val);
+		return val;
+	}
+	// NOTE: Otherwise, the order in which the assignments
+	// happen is up to the code generator, so forget everything they
+	// touch, before and after.
+	kill_assigned(state, exp, &unknown);
+	return fold_expression(fold, state, exp);
+}
+
+internal void fold_statements(fold_t *, state_t *, statement_node_t *, statement_node_t *);
+
+// NOTE: Variables have function scope, so a declaration
+// in code that never runs can still be used after it. Code that declares
+// something is never removed.
+internal int declares_variables(statement_node_t *first, statement_node_t *last) {
+	for (statement_node_t *node = first; ; node = node->next) {
+		if (node->stat.type == decl_stat)
+			return 1;
+		if (node == last)
+			return 0;
+	}
+}
+
+internal statement_node_t *fold_if(fold_t *fold, state_t *state, statement_node_t *node) {
+	statement_node_t *then_start = node->next;
+	statement_node_t *then_end = block_end(then_start);
+	statement_node_t *else_node = NULL;
+	statement_node_t *else_start = NULL;
+	statement_node_t *else_end = NULL;
+
+	if (then_end->next != NULL && then_end->next->stat.type == else_stat) {
+		else_node = then_end->next;
+		else_start = else_node->next;
+		else_end = block_end(else_start);
+	}
+	statement_node_t *after = (else_node != NULL) ? else_end->next : then_end->next;
+
+	exp_t *cond = node->stat.ifStat.cond;
+	value_t val = fold_full_expression(fold, state, cond);
+
+	int dead_declares = (val.known && val.value) ?
+		(else_node != NULL && declares_variables(else_node, else_end)) :
+		declares_variables(node, then_end);
+
+	if (val.known && !has_side_effects(cond) && !dead_declares) {
+		// Only one of the branches can run, and it
+		// takes the place of the whole if.
+		if (val.value) {
+			fold_statements(fold, state, then_start->next, then_end);
+			if (fold->transform) {
+				if (else_node != NULL)
+					remove_statements(fold->ast, else_node, else_end);
+				remove_statement(fold->ast, then_end);
+				remove_statement(fold->ast, then_start);
+				remove_statement(fold->ast, node);
+			}
+		} else {
+			if (else_node != NULL)
+				fold_statements(fold, state, else_start->next, else_end);
+			if (fold->transform) {
+				if (else_node != NULL) {
+					remove_statement(fold->ast, else_end);
+					remove_statement(fold->ast, else_start);
+					remove_statement(fold->ast, else_node);
+				}
+				remove_statements(fold->ast, node, then_end);
+			}
+		}
+		return after;
+	}
+
+	state_t else_state;
+	copy_state(&else_state, state);
+	fold_statements(fold, state, then_start->next, then_end);
+	if (else_node != NULL)
+		fold_statements(fold, &else_state, else_start->next, else_end);
+	meet_state(state, &else_state);
+	clean_state(&else_state);
+
+	return after;
+}
+
+// One pass over the loop, starting from 'header' (the state before the
+// condition). Leaves in 'body' the state at the end of the body and in
+// 'exit' the state after the loop.
+internal void fold_loop_pass(fold_t *fold, statement_node_t *node, state_t *header,
+							 state_t *body, state_t *exit) {
+	statement_node_t *body_start = node->next;
+	statement_node_t *body_end = block_end(body_start);
+	exp_t *cond = node->stat.whileStat.cond;
+
+	state_t *saved_breaks = fold->breaks;
+	state_t *saved_continues = fold->continues;
+	state_t breaks, continues;
+	initialize_state(&breaks, 0, sizeof(value_t));
+	initialize_state(&continues, 0, sizeof(value_t));
+	fold->breaks = &breaks;
+	fold->continues = &continues;
+
+	copy_state(body, header);
+	value_t val = fold_full_expression(fold, body, cond);
+	copy_state(exit, body);
+	if (val.known) {
+		if (val.value)
+			exit->reachable = 0;   // leaves only with a break
+		else
+			body->reachable = 0;   // never runs
+	}
+
+	fold_statements(fold, body, body_start->next, body_end);
+
+	meet_state(body, &continues);
+	meet_state(exit, &breaks);
+
+	clean_state(&breaks);
+	clean_state(&continues);
+	fold->breaks = saved_breaks;
+	fold->continues = saved_continues;
+}
+
+internal statement_node_t *fold_while(fold_t *fold, state_t *state, statement_node_t *node) {
+	statement_node_t *body_end = block_end(node->next);
+	statement_node_t *after = body_end->next;
+	state_t header, body, exit;
+
+	// Find the state at the start of an iteration.
+	int transform = fold->transform;
+	fold->transform = 0;
+	copy_state(&header, state);
+	for (;;) {
+		fold_loop_pass(fold, node, &header, &body, &exit);
+		meet_state(&body, state);
+		meet_state(&body, &header);
+		clean_state(&exit);
+		int done = same_state(&body, &header, same_value, &unknown);
+		move_state(&header, &body);
+		if (done)
+			break;
+	}
+	fold->transform = transform;
+
+	// And now the real pass.
+	fold_loop_pass(fold, node, &header, &body, &exit);
+	exp_t *cond = node->stat.whileStat.cond;
+	if (fold->transform && cond->type == int_exp && cond->intExp == 0 &&
+		!declares_variables(node, body_end))
+		remove_statements(fold->ast, node, body_end);
+
+	move_state(state, &exit);
+	clean_state(&header);
+	clean_state(&body);
+
+	return after;
+}
+
+// Fold the statements from 'node' up to (not including) 'end'.
+internal void fold_statements(fold_t *fold, state_t *state, statement_node_t *node, statement_node_t *end) {
+	while (node != end) {
+		statement_t *stat = &(node->stat);
+
+		if (!state->reachable) {
+			node = node->next;
+			continue;
+		}
+
+		if (stat->type == decl_stat) {
+			value_t val = make_known(0);   // default initialization
+			if (stat->declStat.rvalue != NULL)
+				val = fold_full_expression(fold, state, stat->declStat.rvalue);
+			bind(state, stat->declStat.id, &val);
+		} else if (stat->type == simple_stat || stat->type == print_stat) {
+			fold_full_expression(fold, state, stat->unaryStat.exp);
+		} else if (stat->type == ret_stat) {
+			fold_full_expression(fold, state, stat->retStat.exp);
+			state->reachable = 0;
+		} else if (stat->type == break_stat || stat->type == cont_stat) {
+			// Invalid ones are reported by the code generator.
+			state_t *target = (stat->type == break_stat) ? fold->breaks : fold->continues;
+			if (target != NULL)
+				meet_state(target, state);
+			state->reachable = 0;
+		} else if (stat->type == if_stat) {
+			node = fold_if(fold, state, node);
+			continue;
+		} else if (stat->type == while_stat) {
+			node = fold_while(fold, state, node);
+			continue;
+		}
+		node = node->next;
+	}
+}
+
+void fold_constants(ast_t *ast) {
+	fold_t fold = {
+		.ast = ast,
+		.transform = 1,
+		.breaks = NULL,
+		.continues = NULL
+	};
+	state_t state;
+	initialize_state(&state, 1, sizeof(value_t));
+
+	// Skip the function statement.
+	fold_statements(&fold, &state, ast->root->next, NULL);
+
+	clean_state(&state);
+}
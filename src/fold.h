@@ -0,0 +1,8 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "types.h"
+
+void fold_constants(ast_t *);
+
+#endif
@@ -0,0 +1,391 @@
+/*******
+Strength reduction of induction variables.
+
+HOW IT WORKS:
+A (basic) induction variable of a loop is one that is only assigned in it by
+statements 'i = i + c', with c a constant. A product of it with a constant,
+with a variable that the loop doesn't assign, or with itself, changes by an
+amount that we know (or can compute before the loop) every time i does. So
+instead of multiplying in every iteration, we keep the product in a new
+variable, that is computed once before the loop and updated with additions
+right after each update of i:
+
+	while (i * i <= n) {        .t0 = i * i;
+		s = s + i * k;          .t1 = i * 12;
+		i = i + 6;              .t2 = i * k;
+	}                     ->    .t3 = k * 6;
+	                            while (.t0 <= n) {
+	                                s = s + .t2;
+	                                i = i + 6;
+	                                .t0 = .t0 + .t1 + 36;   // (i + 6)^2 = i^2 + 12*i + 36
+	                                .t1 = .t1 + 72;
+	                                .t2 = .t2 + .t3;
+	                            }
+
+Since the new variables change at the same places as i, they always hold
+their product, whichever way (break, continue, branches) the loop goes. If,
+after that, i is only read to update itself (like in the condition above),
+the dead code elimination removes it too, and the exit test is done with
+the product alone.
+
+i * i is only reduced if all the updates of i add the same constant. A
+product with a power of 2 is a shift, as cheap as the addition, so it stays.
+Inner loops are handled first, so the products that are computed before an
+inner loop can be reduced in the outer one.
+*******/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "ast.h"
+#include "iv.h"
+
+typedef struct {
+	char *id;
+	int assignments;   // all the assignments (and declarations) of it in the loop
+	int updates;       // the ones that are 'id = id + step'
+	long long step;    // of the first update
+	int same_step;     // all the updates have the same step
+} variable_t;
+
+typedef enum { by_constant, by_variable, squared } product_kind_t;
+
+typedef struct {
+	exp_t *exp;             // the first occurrence (its value before the loop)
+	variable_t *iv;
+	product_kind_t kind;
+	exp_t *factor;          // the other operand, unless squared
+	char *temp;
+	char *step_temp;        // what is added to 'temp' in every update, if not constant
+} product_t;
+
+typedef struct {
+	ast_t *ast;
+	statement_node_t *loop;   // the while statement
+	int vars_used;
+	int vars_cap;
+	variable_t *vars;
+	int products_used;
+	int products_cap;
+	product_t *products;
+} iv_t;
+
+internal exp_t *new_integer(long long value) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = int_exp;
+	exp->intExp = (int) value;
+	return exp;
+}
+
+internal exp_t *new_variable(char *id) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = id_exp;
+	exp->id = id;
+	return exp;
+}
+
+internal exp_t *new_binary(char *operator, exp_t *left, exp_t *right) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = bin_exp;
+	exp->binExp.operator = operator;
+	exp->binExp.leftOperand = left;
+	exp->binExp.rightOperand = right;
+	return exp;
+}
+
+internal int fits_integer(long long value) {
+	return value >= INT_MIN && value <= INT_MAX;
+}
+
+internal variable_t *find_variable(iv_t *iv, char *id) {
+	for (int i = 0; i < iv->vars_used; ++i) {
+		if (!strcmp(iv->vars[i].id, id))
+			return &(iv->vars[i]);
+	}
+	return NULL;
+}
+
+internal variable_t *add_assignment(iv_t *iv, char *id) {
+	variable_t *var = find_variable(iv, id);
+	if (var == NULL) {
+		if (iv->vars_used >= iv->vars_cap) {
+			iv->vars_cap = (iv->vars_cap) ? 2 * iv->vars_cap : 16;
+			iv->vars = realloc(iv->vars, iv->vars_cap * sizeof(variable_t));
+		}
+		var = &(iv->vars[(iv->vars_used)++]);
+		var->id = id;
+		var->assignments = 0;
+		var->updates = 0;
+		var->step = 0;
+		var->same_step = 1;
+	}
+	var->assignments += 1;
+	return var;
+}
+
+internal void find_assignments(iv_t *iv, exp_t *exp) {
+	if (exp->type == assign_exp) {
+		add_assignment(iv, exp->assignExp.id);
+		find_assignments(iv, exp->assignExp.rvalue);
+	} else if (exp->type == unary_exp) {
+		find_assignments(iv, exp->unaryExp.operand);
+	} else if (exp->type == bin_exp) {
+		find_assignments(iv, exp->binExp.leftOperand);
+		find_assignments(iv, exp->binExp.rightOperand);
+	}
+}
+
+// If 'stat' is 'id = id + c' (or 'id = id - c'), set the step.
+internal int is_update(statement_t *stat, long long *step) {
+	if (stat->type != simple_stat || stat->simpleStat.exp->type != assign_exp)
+		return 0;
+	char *id = stat->simpleStat.exp->assignExp.id;
+	exp_t *rvalue = stat->simpleStat.exp->assignExp.rvalue;
+	if (rvalue->type != bin_exp)
+		return 0;
+	char op = rvalue->binExp.operator[0];
+	exp_t *left = rvalue->binExp.leftOperand;
+	exp_t *right = rvalue->binExp.rightOperand;
+	if (op == '+' && left->type == int_exp) {
+		exp_t *temp = left;
+		left = right;
+		right = temp;
+	}
+	if ((op != '+' && op != '-') || left->type != id_exp || strcmp(left->id, id) ||
+		right->type != int_exp || right->intExp == 0)
+		return 0;
+	*step = (op == '+') ? right->intExp : -(long long) right->intExp;
+	return 1;
+}
+
+internal variable_t *induction_variable(iv_t *iv, exp_t *exp) {
+	if (exp->type != id_exp)
+		return NULL;
+	variable_t *var = find_variable(iv, exp->id);
+	if (var == NULL || var->updates == 0 || var->updates != var->assignments)
+		return NULL;
+	return var;
+}
+
+internal int is_invariant(iv_t *iv, exp_t *exp) {
+	return exp->type == id_exp && find_variable(iv, exp->id) == NULL;
+}
+
+internal int is_power_of_2(long long value) {
+	if (value < 0)
+		value = -value;
+	return (value & (value - 1)) == 0;
+}
+
+// Whether 'exp' is a product that can be reduced, and of what kind.
+internal int is_product(iv_t *iv, exp_t *exp, variable_t **var, product_kind_t *kind, exp_t **factor) {
+	if (exp->type != bin_exp || strcmp(exp->binExp.operator, "*"))
+		return 0;
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	if (induction_variable(iv, left) == NULL) {
+		exp_t *temp = left;
+		left = right;
+		right = temp;
+	}
+	*var = induction_variable(iv, left);
+	if (*var == NULL)
+		return 0;
+	*factor = right;
+
+	if (right->type == id_exp && !strcmp(right->id, left->id)) {
+		*kind = squared;
+		// The difference of the squares depends on the step.
+		return (*var)->same_step && fits_integer((*var)->step * (*var)->step) &&
+			fits_integer(2 * (*var)->step * (*var)->step);
+	}
+	if (right->type == int_exp) {
+		*kind = by_constant;
+		return !is_power_of_2(right->intExp) && (*var)->same_step &&
+			fits_integer((*var)->step * right->intExp);
+	}
+	*kind = by_variable;
+	return is_invariant(iv, right) && (*var)->same_step;
+}
+
+internal char *declare_before_loop(iv_t *iv, exp_t *value) {
+	char *temp = new_temporary(iv->ast);
+	statement_t decl;
+	decl.type = decl_stat;
+	decl.line = iv->loop->stat.line;
+	decl.declStat.id = temp;
+	decl.declStat.rvalue = value;
+	decl.declStat.uninitialized = 0;
+	decl.declStat.wide = 0;   // see typing.c
+	insert_statement_before(iv->ast, iv->loop, decl);
+	return temp;
+}
+
+// Replace the products in '*exp' with their variables.
+internal void reduce_expression(iv_t *iv, exp_t **exp) {
+	exp_t *e = *exp;
+	variable_t *var;
+	product_kind_t kind;
+	exp_t *factor;
+
+	if (is_product(iv, e, &var, &kind, &factor)) {
+		product_t *product = NULL;
+		for (int i = 0; i < iv->products_used; ++i) {
+			if (same_expression(iv->products[i].exp, e)) {
+				product = &(iv->products[i]);
+				break;
+			}
+		}
+
+		if (product != NULL) {
+			clean_expression(e);
+			free(e);
+		} else {
+			if (iv->products_used >= iv->products_cap) {
+				iv->products_cap = (iv->products_cap) ? 2 * iv->products_cap : 8;
+				iv->products = realloc(iv->products, iv->products_cap * sizeof(product_t));
+			}
+			product = &(iv->products[(iv->products_used)++]);
+			product->exp = e;
+			product->iv = var;
+			product->kind = kind;
+			product->factor = factor;
+			product->temp = declare_before_loop(iv, e);
+			product->step_temp = NULL;
+		}
+		*exp = new_variable(product->temp);
+	} else if (e->type == unary_exp) {
+		reduce_expression(iv, &(e->unaryExp.operand));
+	} else if (e->type == bin_exp) {
+		reduce_expression(iv, &(e->binExp.leftOperand));
+		reduce_expression(iv, &(e->binExp.rightOperand));
+	} else if (e->type == assign_exp) {
+		reduce_expression(iv, &(e->assignExp.rvalue));
+	}
+}
+
+internal void insert_after(iv_t *iv, statement_node_t *node, char *id, exp_t *value) {
+	statement_t stat;
+	stat.type = simple_stat;
+	stat.line = node->stat.line;
+	stat.simpleStat.exp = calloc(1, sizeof(exp_t));
+	stat.simpleStat.exp->type = assign_exp;
+	stat.simpleStat.exp->assignExp.id = id;
+	stat.simpleStat.exp->assignExp.rvalue = value;
+	// There's always at least the end of the body after it.
+	insert_statement_before(iv->ast, node->next, stat);
+}
+
+// Add the statements that keep the products up to date, after 'update'.
+internal void update_products(iv_t *iv, statement_node_t *update, variable_t *var) {
+	// In reverse, as each one goes right after the update.
+	for (int i = iv->products_used - 1; i >= 0; --i) {
+		product_t *product = &(iv->products[i]);
+		if (product->iv != var)
+			continue;
+		long long step = var->step;
+		exp_t *value;
+
+		if (product->kind == by_constant) {
+			long long c = product->factor->intExp;
+			value = new_binary("+", new_variable(product->temp), new_integer(step * c));
+		} else if (product->kind == by_variable) {
+			value = new_binary("+", new_variable(product->temp), new_variable(product->step_temp));
+		} else {
+			// (i + c)^2 = i^2 + 2*c*i + c^2, and 2*c*i is an
+			// induction variable itself, increased by 2*c*c.
+			insert_after(iv, update, product->step_temp,
+						 new_binary("+", new_variable(product->step_temp), new_integer(2 * step * step)));
+			value = new_binary("+", new_binary("+", new_variable(product->temp),
+											   new_variable(product->step_temp)),
+							   new_integer(step * step));
+		}
+		insert_after(iv, update, product->temp, value);
+	}
+}
+
+internal void reduce_loop(ast_t *ast, statement_node_t *loop, statement_node_t *end) {
+	iv_t iv = {
+		.ast = ast,
+		.loop = loop,
+	};
+
+	for (statement_node_t *node = loop; node != end; node = node->next) {
+		statement_t *stat = &(node->stat);
+		long long step;
+		if (stat->type == decl_stat) {
+			add_assignment(&iv, stat->declStat.id);
+		} else if (is_update(stat, &step)) {
+			variable_t *var = add_assignment(&iv, stat->simpleStat.exp->assignExp.id);
+			if (var->updates == 0)
+				var->step = step;
+			else if (var->step != step)
+				var->same_step = 0;
+			var->updates += 1;
+			find_assignments(&iv, stat->simpleStat.exp->assignExp.rvalue);
+			continue;
+		}
+		exp_t **exp = statement_expression(stat);
+		if (exp != NULL)
+			find_assignments(&iv, *exp);
+	}
+
+	for (statement_node_t *node = loop; node != end; node = node->next) {
+		exp_t **exp = statement_expression(&(node->stat));
+		if (exp != NULL)
+			reduce_expression(&iv, exp);
+	}
+
+	if (iv.products_used != 0) {
+		// What is added to the products in every update,
+		// if it isn't a constant.
+		for (int i = 0; i < iv.products_used; ++i) {
+			product_t *product = &(iv.products[i]);
+			exp_t *value = NULL;
+			if (product->kind == by_variable && product->iv->step == 1) {
+				product->step_temp = product->factor->id;
+			} else if (product->kind == by_variable) {
+				value = new_binary("*", new_variable(product->factor->id), new_integer(product->iv->step));
+			} else if (product->kind == squared) {
+				value = new_binary("*", new_variable(product->iv->id), new_integer(2 * product->iv->step));
+			}
+			if (value != NULL)
+				product->step_temp = declare_before_loop(&iv, value);
+		}
+
+		long long step;
+		for (statement_node_t *node = loop->next; node != end; node = node->next) {
+			if (!is_update(&(node->stat), &step))
+				continue;
+			// (The new updates of the products are skipped, as
+			// they're not induction variables of the loop.)
+			variable_t *var = find_variable(&iv, node->stat.simpleStat.exp->assignExp.id);
+			if (var != NULL)
+				update_products(&iv, node, var);
+		}
+	}
+
+	free(iv.vars);
+	free(iv.products);
+}
+
+// Handle the loops from 'first' up to (not including) 'end'.
+internal void reduce_loops(ast_t *ast, statement_node_t *first, statement_node_t *end) {
+	statement_node_t *node = first;
+	while (node != end) {
+		if (node->stat.type == while_stat) {
+			statement_node_t *body_end = block_end(node->next);
+			// The inner ones first.
+			reduce_loops(ast, node->next->next, body_end);
+			reduce_loop(ast, node, body_end);
+			node = body_end;
+		}
+		node = node->next;
+	}
+}
+
+void reduce_induction_variables(ast_t *ast) {
+	reduce_loops(ast, ast->root, NULL);
+}
@@ -0,0 +1,8 @@
+#ifndef IV_H
+#define IV_H
+
+#include "types.h"
+
+void reduce_induction_variables(ast_t *);
+
+#endif
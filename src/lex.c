@@ -23,45 +23,9 @@ typedef struct reader {
 	int lines;
 	char *cp;
 	stack_t *stack;
+	dicc_sink *sink;
 } reader_t;
 
-// Read an entire file. Assume that if it fails, any
-// footprint created, will be freed inside the function.
-// TODO(George): I think that it might be a good idea to 
-// enums for these kind of return values
-internal int read_entire_file(const char *filename, read_file_t *file) {
-	int success = 1;
-	FILE *f = fopen(filename, "rb");
-	
-	if (f != NULL) {
-		size_t filesize;
-
-		// NOTE(stefanos): Possibly do a check both on the filename
-		// and the filesize.
-		fseek(f, 0, SEEK_END);   // Move to the end of the file
-		filesize = ftell(f);     // Position of the file pointer relative
-		// to the start of the file (in bytes).
-		fseek(f, 0, SEEK_SET);   // Set file pointer to the start of the file.
-		char *file_data = malloc((filesize + 1) * sizeof(char));
-		
-		if (!file_data) {
-			report_error(-1, "Couldn't allocate memory for file data\n");
-			success = 0;
-		} else {
-			fread(file_data, filesize, 1, f);
-			file_data[filesize] = 0;
-			file->filesize = filesize;
-			file->file_data = file_data;
-		}
-		fclose(f);
-	} else {
-		success = 0;
-		report_error(-1, "Failed to open the input file\n");
-	}
-
-	return success;
-}
-
 void clean_lexer(lex_t *output) {
 	if (output) {
 		if (output->token_num) {
@@ -69,15 +33,19 @@ void clean_lexer(lex_t *output) {
 				free(output->token[i].tok);
 			free(output->token);
 		}
-		free(output);
-		
 		if (output->file_data) {
 			// Assume that it's not corrupted memory.
 			free(output->file_data);
 		}
+		free(output);
 	}
 }
 
+void print_tokens(lex_t *output) {
+	for (int i = 0; i != output->token_num; ++i)
+		printf("%s\n", output->token[i].tok);
+}
+
 
 // Checks if a string an integer constant.
 internal int is_constant(char *buffer) {
@@ -188,30 +156,31 @@ internal int what_type(char *buffer) {
 internal int save_token(lex_t *result, reader_t *reader) {
 	int type;
 
-	result->token = realloc(result->token, (result->token_num + 1) * sizeof(token_t));
-	
 	reader->buffer[reader->buffer_index] = '\0';
-	// TODO - IMPORTANT (stefanos): That should AT LEAST follow the rule "when
-	// run out of space, allocate double the current size"
-	result->token[result->token_num].tok = malloc(reader->buffer_index * sizeof(char));
-	result->token[result->token_num].line = reader->lines;
 	type = what_type(reader->buffer);
 	if(type == UNKNOWN) {
-		report_error(reader->lines, "Unknown token\n");
-		return 0;
+		report_error(reader->sink, reader->lines, "Unknown token\n");
+		return UNKNOWN;
 	} else if(type == IDENTIFIER) {
 		if(!is_valid_id(reader->buffer)) {
-			report_error(reader->lines, "Invalid identifier: %d %s\n", strlen(reader->buffer), reader->buffer);
-			return 0;
+			report_error(reader->sink, reader->lines, "Invalid identifier: %zu %s\n",
+				strlen(reader->buffer), reader->buffer);
+			return UNKNOWN;
 		}
 	}
+
+	// TODO - IMPORTANT (stefanos): That should AT LEAST follow the rule "when
+	// run out of space, allocate double the current size"
+	result->token = realloc(result->token, (result->token_num + 1) * sizeof(token_t));
+	result->token[result->token_num].tok = malloc((reader->buffer_index + 1) * sizeof(char));
+	result->token[result->token_num].line = reader->lines;
 	result->token[result->token_num].type = type;
 	strcpy(result->token[result->token_num].tok, reader->buffer);
 	
-	printf("%s\n", reader->buffer);
-	
 	++(result->token_num);
 	reader->buffer_index = 0;
+
+	return type;
 }
 
 // 1: Not in comment
@@ -226,7 +195,7 @@ internal int check_comment(reader_t *reader) {
 				reader->cp += 2;
 				reader->in_comment = 1;
 			} else {
-				report_error(reader->lines, "Nested comments are not allowed\n");
+				report_error(reader->sink, reader->lines, "Nested comments are not allowed\n");
 				success = 0;
 			}
 		}
@@ -239,7 +208,7 @@ internal int check_comment(reader_t *reader) {
 				reader->cp += 2;
 				reader->in_comment = 0;
 			} else {
-				report_error(reader->lines, "Invalid use of end comment '*/' token\n");
+				report_error(reader->sink, reader->lines, "Invalid use of end comment '*/' token\n");
 				success = 0;
 			}
 		}
@@ -275,24 +244,35 @@ and do things like save the value of constants,
 size of strings etc.
 ******************************/
 
-lex_t *lex(char *filename) {
+lex_t *lex(const char *src, size_t len, dicc_sink *sink) {
 	lex_t *result = malloc(sizeof(lex_t));
 	if (result == NULL) {
-		report_error(-1, "Out of memory");
+		report_error(sink, -1, "Out of memory\n");
 		return NULL;
 	}
 
 	result->token_num = 0;
 	result->token = NULL;
-
-	if (!read_entire_file(filename, &result->file_contents))
+	result->sink = sink;
+
+	// Keep our own NUL-terminated copy, the caller's buffer
+	// doesn't have to be.
+	result->file_data = malloc((len + 1) * sizeof(char));
+	if (result->file_data == NULL) {
+		report_error(sink, -1, "Couldn't allocate memory for file data\n");
+		free(result);
 		return NULL;
+	}
+	memcpy(result->file_data, src, len);
+	result->file_data[len] = '\0';
+	result->filesize = len;
 
 	reader_t reader = {
 		.buffer_index = 0,
 		.in_comment = 0,
 		.stack = create_stack(),
-		.lines = 1
+		.lines = 1,
+		.sink = sink
 	};
 	reader.buffer[0] = '\0';
 
@@ -319,7 +299,7 @@ lex_t *lex(char *filename) {
 			if (check_stack_empty(reader.stack) ||
 				!are_pair(peek_top_of_stack(reader.stack), c)) {
 				success = 0;
-				report_error(-1, "Incorrect parenthesization\n");
+				report_error(reader.sink, -1, "Incorrect parenthesization\n");
 				break;
 			} else {
 				pop_from_stack(reader.stack);
@@ -330,6 +310,13 @@ lex_t *lex(char *filename) {
 			// part of a word
 			if (!in_word)
 				in_word = 1;
+			// Leave room for the operator that may follow
+			// and the terminating NUL.
+			if (reader.buffer_index >= (int) sizeof(reader.buffer) - 3) {
+				report_error(reader.sink, reader.lines, "Token too long\n");
+				success = 0;
+				break;
+			}
 			reader.buffer[(reader.buffer_index)++] = c;
 		} else if (!isspace(c)) {
 			if (in_word) {
@@ -374,9 +361,13 @@ lex_t *lex(char *filename) {
 		}
 	}
 	
+	// A word that ends right at the end of the input.
+	if (success && !reader.in_comment && reader.buffer_index)
+		success = (save_token(result, &reader) != UNKNOWN) ? success : 0;
+
 	if (success && !check_stack_empty(reader.stack)) {
-		report_error(-1, "Unexpected end of input - Incorrect parenthesization\n",
-			reader.lines);
+		report_error(reader.sink, reader.lines,
+			"Unexpected end of input - Incorrect parenthesization\n");
 		success = 0;
 	}
 
@@ -384,6 +375,7 @@ lex_t *lex(char *filename) {
 
 	if (success)
 		return result;
-	else
-		return NULL;
+
+	clean_lexer(result);
+	return NULL;
 }
@@ -3,7 +3,8 @@
 
 #include "types.h"
 
-lex_t *lex(char *filename);
+lex_t *lex(const char *src, size_t len, dicc_sink *);
 void clean_lexer(lex_t *);
+void print_tokens(lex_t *);
 
 #endif
@@ -0,0 +1,202 @@
+/*******
+Loop-invariant code motion.
+
+HOW IT WORKS:
+An expression inside a loop (in its condition or its body) is invariant if
+none of the variables it reads is assigned (or declared) anywhere in the
+loop. Then it has the same value in every iteration, so we compute it once,
+before the loop, into a new variable, and the loop reads the variable:
+
+	while (i < n * 2) {         .t0 = n * 2;
+		s = s + a * b;    ->    .t1 = a * b;
+		i = i + 1;              while (i < .t0) {
+	}                               s = s + .t1;
+	                                i = i + 1;
+	                            }
+
+We take the largest invariant parts (not a + b and then a + b + c), and
+the same invariant expression in many places uses the same variable.
+Inner loops are handled first, so an expression that is invariant in two
+nested loops ends up before the outer one.
+
+The new statements run even if the loop doesn't, or if the expression
+was in a branch that wouldn't run. That only costs some time, except for
+a division, which could trap (e.g. if (b != 0) x = a / b;). Divisions are
+only hoisted when the divisor is a constant that can't trap.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "ast.h"
+#include "licm.h"
+
+typedef struct {
+	int cap;
+	int used;
+	char **data;
+} names_t;
+
+typedef struct {
+	exp_t *exp;   // the hoisted expression (the rvalue of the declaration)
+	char *temp;   // and the variable that holds its value
+} hoisted_t;
+
+typedef struct {
+	ast_t *ast;
+	statement_node_t *loop;   // the while statement
+	names_t assigned;         // variables assigned in the loop
+	int hoisted_used;
+	int hoisted_cap;
+	hoisted_t *hoisted;
+} licm_t;
+
+internal void add_name(names_t *names, char *name) {
+	if (names->used >= names->cap) {
+		names->cap = (names->cap) ? 2 * names->cap : 16;
+		names->data = realloc(names->data, names->cap * sizeof(char *));
+	}
+	names->data[(names->used)++] = name;
+}
+
+internal int has_name(names_t *names, char *name) {
+	for (int i = 0; i < names->used; ++i) {
+		if (!strcmp(names->data[i], name))
+			return 1;
+	}
+	return 0;
+}
+
+internal void find_assigned(names_t *names, exp_t *exp) {
+	if (exp == NULL)
+		return;
+	if (exp->type == assign_exp) {
+		add_name(names, exp->assignExp.id);
+		find_assigned(names, exp->assignExp.rvalue);
+	} else if (exp->type == unary_exp) {
+		find_assigned(names, exp->unaryExp.operand);
+	} else if (exp->type == bin_exp) {
+		find_assigned(names, exp->binExp.leftOperand);
+		find_assigned(names, exp->binExp.rightOperand);
+	}
+}
+
+internal int is_invariant(licm_t *licm, exp_t *exp) {
+	if (exp->type == int_exp)
+		return 1;
+	if (exp->type == id_exp)
+		return !has_name(&(licm->assigned), exp->id);
+	if (exp->type == unary_exp)
+		return is_invariant(licm, exp->unaryExp.operand);
+	if (exp->type == bin_exp) {
+		char op = exp->binExp.operator[0];
+		exp_t *right = exp->binExp.rightOperand;
+		// Only a division that can't trap.
+		if ((op == '/' || op == '%') && (right->type != int_exp || right->intExp == 0 ||
+										 right->intExp == -1))
+			return 0;
+		return is_invariant(licm, exp->binExp.leftOperand) && is_invariant(licm, right);
+	}
+	return 0;
+}
+
+// Move '*exp' before the loop, or reuse the variable of
+// an identical expression that was moved already.
+internal void hoist(licm_t *licm, exp_t **exp) {
+	char *temp = NULL;
+
+	for (int i = 0; i < licm->hoisted_used; ++i) {
+		if (same_expression(licm->hoisted[i].exp, *exp)) {
+			temp = licm->hoisted[i].temp;
+			clean_expression(*exp);
+			free(*exp);
+			break;
+		}
+	}
+
+	if (temp == NULL) {
+		temp = new_temporary(licm->ast);
+
+		statement_t decl;
+		decl.type = decl_stat;
+		decl.line = licm->loop->stat.line;
+		decl.declStat.id = temp;
+		decl.declStat.rvalue = *exp;
+		decl.declStat.uninitialized = 0;
+		decl.declStat.wide = 0;   // see typing.c
+		insert_statement_before(licm->ast, licm->loop, decl);
+
+		if (licm->hoisted_used >= licm->hoisted_cap) {
+			licm->hoisted_cap = (licm->hoisted_cap) ? 2 * licm->hoisted_cap : 8;
+			licm->hoisted = realloc(licm->hoisted, licm->hoisted_cap * sizeof(hoisted_t));
+		}
+		licm->hoisted[licm->hoisted_used].exp = *exp;
+		licm->hoisted[licm->hoisted_used].temp = temp;
+		licm->hoisted_used += 1;
+	}
+
+	exp_t *id = calloc(1, sizeof(exp_t));
+	id->type = id_exp;
+	id->id = temp;
+	*exp = id;
+}
+
+internal void hoist_expression(licm_t *licm, exp_t **exp) {
+	exp_t *e = *exp;
+	// Variables and constants are as cheap as the new variable.
+	if ((e->type == bin_exp || e->type == unary_exp) && is_invariant(licm, e)) {
+		hoist(licm, exp);
+	} else if (e->type == unary_exp) {
+		hoist_expression(licm, &(e->unaryExp.operand));
+	} else if (e->type == bin_exp) {
+		hoist_expression(licm, &(e->binExp.leftOperand));
+		hoist_expression(licm, &(e->binExp.rightOperand));
+	} else if (e->type == assign_exp) {
+		hoist_expression(licm, &(e->assignExp.rvalue));
+	}
+}
+
+internal void hoist_loop(ast_t *ast, statement_node_t *loop, statement_node_t *end) {
+	licm_t licm = {
+		.ast = ast,
+		.loop = loop,
+	};
+
+	for (statement_node_t *node = loop; node != end; node = node->next) {
+		statement_t *stat = &(node->stat);
+		if (stat->type == decl_stat)
+			add_name(&(licm.assigned), stat->declStat.id);
+		exp_t **exp = statement_expression(stat);
+		if (exp != NULL)
+			find_assigned(&(licm.assigned), *exp);
+	}
+
+	for (statement_node_t *node = loop; node != end; node = node->next) {
+		exp_t **exp = statement_expression(&(node->stat));
+		if (exp != NULL)
+			hoist_expression(&licm, exp);
+	}
+
+	free(licm.assigned.data);
+	free(licm.hoisted);
+}
+
+// Handle the loops from 'first' up to (not including) 'end'.
+internal void hoist_loops(ast_t *ast, statement_node_t *first, statement_node_t *end) {
+	statement_node_t *node = first;
+	while (node != end) {
+		if (node->stat.type == while_stat) {
+			statement_node_t *body_end = block_end(node->next);
+			// The inner ones first.
+			hoist_loops(ast, node->next->next, body_end);
+			hoist_loop(ast, node, body_end);
+			node = body_end;
+		}
+		node = node->next;
+	}
+}
+
+void hoist_invariants(ast_t *ast) {
+	hoist_loops(ast, ast->root, NULL);
+}
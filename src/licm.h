@@ -0,0 +1,8 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "types.h"
+
+void hoist_invariants(ast_t *);
+
+#endif
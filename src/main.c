@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+#include "lex.h"
+#include "parser.h"
+#include "ast.h"
+#include "profile.h"
+#include "optimizer.h"
+#include "code_generator.h"
+
+// Read an entire file. Assume that if it fails, any
+// footprint created, will be freed inside the function.
+// TODO(George): I think that it might be a good idea to
+// enums for these kind of return values
+internal int read_entire_file(const char *filename, read_file_t *file) {
+	int success = 1;
+	FILE *f = fopen(filename, "rb");
+
+	if (f != NULL) {
+		size_t filesize;
+
+		// NOTE(stefanos): Possibly do a check both on the filename
+		// and the filesize.
+		fseek(f, 0, SEEK_END);   // Move to the end of the file
+		filesize = ftell(f);     // Position of the file pointer relative
+		// to the start of the file (in bytes).
+		fseek(f, 0, SEEK_SET);   // Set file pointer to the start of the file.
+		char *file_data = malloc((filesize + 1) * sizeof(char));
+
+		if (!file_data) {
+			fprintf(stderr, "[ERROR]: Couldn't allocate memory for file data\n");
+			success = 0;
+		} else {
+			fread(file_data, filesize, 1, f);
+			file_data[filesize] = 0;
+			file->filesize = filesize;
+			file->file_data = file_data;
+		}
+		fclose(f);
+	} else {
+		success = 0;
+		fprintf(stderr, "[ERROR]: Failed to open %s\n", filename);
+	}
+
+	return success;
+}
+
+internal void write_file(void *ctx, const char *data, size_t len) {
+	fwrite(data, 1, len, (FILE *) ctx);
+}
+
+internal void print_note(void *ctx, const char *msg) {
+	fprintf((FILE *) ctx, "%s", msg);
+}
+
+internal void print_error(void *ctx, int line, const char *msg) {
+	fprintf(stderr, "[ERROR]: ");
+	if(line != -1)
+		fprintf(stderr, "Line %d: ", line);
+	fprintf(stderr, "%s", msg);
+}
+
+// [name].prof for the input file [name].c, the profile file when
+// -fprofile-generate or -fprofile-use don't name one.
+internal char *default_profile(const char *filename) {
+	const char *dot = strrchr(filename, '.');
+	size_t len = (dot != NULL) ? (size_t) (dot - filename) : strlen(filename);
+	char *profile = malloc(len + sizeof(".prof"));
+	if (profile != NULL) {
+		memcpy(profile, filename, len);
+		strcpy(profile + len, ".prof");
+	}
+	return profile;
+}
+
+// Everything that starts with a '-' is an option, the rest is the input file.
+// The file of -fprofile-use goes to 'profile', and an empty name (here and
+// for -fprofile-generate) means the default one.
+// Returns the input file or NULL if the arguments are invalid.
+internal char *parse_arguments(int argc, char **argv, dicc_options *options, const char **profile) {
+	char *filename = NULL;
+
+	for(int i = 1; i < argc; ++i) {
+		char *arg = argv[i];
+		if(arg[0] != '-') {
+			if(filename != NULL)
+				return NULL;
+			filename = arg;
+		} else if(!strcmp(arg, "-O0")) {
+			options->opt_level = 0;
+		} else if(!strcmp(arg, "-O1") || !strcmp(arg, "-O")) {
+			options->opt_level = 1;
+		} else if(!strcmp(arg, "-fomit-frame-pointer")) {
+			options->omit_frame_pointer = 1;
+		} else if(!strcmp(arg, "-fno-omit-frame-pointer")) {
+			options->omit_frame_pointer = 0;
+		} else if(!strcmp(arg, "-mred-zone")) {
+			options->red_zone = 1;
+		} else if(!strcmp(arg, "-mno-red-zone")) {
+			options->red_zone = 0;
+		} else if(!strcmp(arg, "-fprofile-generate")) {
+			options->profile_generate = "";
+		} else if(!strncmp(arg, "-fprofile-generate=", strlen("-fprofile-generate="))) {
+			options->profile_generate = arg + strlen("-fprofile-generate=");
+		} else if(!strcmp(arg, "-fprofile-use")) {
+			*profile = "";
+		} else if(!strncmp(arg, "-fprofile-use=", strlen("-fprofile-use="))) {
+			*profile = arg + strlen("-fprofile-use=");
+		} else if(!strncmp(arg, "-fprecompute-steps=", strlen("-fprecompute-steps="))) {
+			char *end;
+			options->precompute_steps = strtoll(arg + strlen("-fprecompute-steps="), &end, 10);
+			if(*end != '\0' || end == arg + strlen("-fprecompute-steps=") || options->precompute_steps < 0) {
+				fprintf(stderr, "[ERROR]: Invalid number of steps: %s\n", arg);
+				return NULL;
+			}
+		} else if(!strncmp(arg, "-march=", strlen("-march="))) {
+			if(!dicc_target_features(arg + strlen("-march="), &options->features)) {
+				fprintf(stderr, "[ERROR]: Unknown architecture: %s\n", arg + strlen("-march="));
+				return NULL;
+			}
+		} else {
+			fprintf(stderr, "[ERROR]: Unknown option: %s\n", arg);
+			return NULL;
+		}
+	}
+
+	return filename;
+}
+
+int main(int argc, char **argv) {
+
+	FILE *dest;
+	read_file_t source;
+	read_file_t profile_file = { NULL, 0 };
+	profile_t profile;
+	dicc_options options;
+	const char *profile_name = NULL;
+
+	dicc_default_options(&options);
+
+	char *filename = parse_arguments(argc, argv, &options, &profile_name);
+	if(filename == NULL) {
+		fprintf(stderr, "Usage: %s [-O0 | -O1] [-f[no-]omit-frame-pointer] [-m[no-]red-zone] "
+			"[-fprofile-generate[=file] | -fprofile-use[=file]] [-fprecompute-steps=N] [-march=name | -march=native] [name].c\n", argv[0]);
+		return 1;
+	}
+
+	char *default_name = default_profile(filename);
+	if(options.profile_generate != NULL && options.profile_generate[0] == '\0')
+		options.profile_generate = default_name;
+	if(profile_name != NULL && profile_name[0] == '\0')
+		profile_name = default_name;
+	if(profile_name != NULL) {
+		if(!read_entire_file(profile_name, &profile_file)) {
+			free(default_name);
+			return 1;
+		}
+		options.profile_use = profile_file.file_data;
+		options.profile_use_len = profile_file.filesize;
+	}
+
+	dicc_sink console = { .ctx = stdout, .write = write_file, .error = print_error, .note = print_note };
+
+	printf("-----------\n");
+	printf("DICC: 0.0.1\n");
+	printf("-----------\n\n");
+
+	if(!read_entire_file(filename, &source)) {
+		free(profile_file.file_data);
+		free(default_name);
+		return 0;
+	}
+
+	printf("-----------------[LEXER]----------------\n\n");
+	lex_t *lex_output = lex(source.file_data, source.filesize, &console);
+	free(source.file_data);
+
+	if(!lex_output) {
+		free(profile_file.file_data);
+		free(default_name);
+		return 0;
+	}
+	print_tokens(lex_output);
+
+	ast_t *ast = parser(lex_output);
+	if(!ast) {
+		report_error(&console, -1, "Could not generate AST\n");
+		clean_lexer(lex_output);
+		free(profile_file.file_data);
+		free(default_name);
+		return 0;
+	}
+	printf("\n\n-----------------[PARSER]----------------\n\n");
+	print_ast(ast);
+
+	// Read once, for the optimizer and for both runs of the code generator.
+	if(!load_profile(ast, &options, &profile, &console)) {
+		clean_parser(ast);
+		clean_lexer(lex_output);
+		free(profile_file.file_data);
+		free(default_name);
+		return 0;
+	}
+
+	if(options.opt_level > 0) {
+		optimize(ast, &options, &profile);
+		printf("\n\n-----------------[OPTIMIZER]----------------\n\n");
+		print_ast(ast);
+	}
+
+	filename[strlen(filename) - 1] = 's';
+	dest = fopen(filename, "wb");
+
+	if(!dest) {
+		report_error(&console, -1, "Destination file could not be opened for writing.\n");
+		clean_profile(&profile);
+		clean_parser(ast);
+		clean_lexer(lex_output);
+		free(profile_file.file_data);
+		free(default_name);
+		return 0;
+	}
+
+	dicc_sink file = { .ctx = dest, .write = write_file, .error = print_error };
+
+	printf("\n\n-----------------[CODE GENERATOR]----------------\n\n");
+	generate(ast, &options, &profile, &console);
+	generate(ast, &options, &profile, &file);
+
+	fclose(dest);
+	clean_profile(&profile);
+	clean_parser(ast);
+	clean_lexer(lex_output);
+	free(profile_file.file_data);
+	free(default_name);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*******
+Machine-independent optimizations. Each one is a pass over the AST that
+leaves a valid AST behind, so the code generator doesn't know (or care)
+whether they ran.
+
+The errors of a program are found by the code generator, but the passes
+remove code (like a branch that never runs, or a declaration that nothing
+uses) and would take its errors with them. So a program with errors isn't optimized, and it gets the
+same ones as without optimizations.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "ast.h"
+#include "fold.h"
+#include "simplify.h"
+#include "licm.h"
+#include "iv.h"
+#include "cse.h"
+#include "range.h"
+#include "dce.h"
+#include "typing.h"
+#include "precompute.h"
+#include "unroll.h"
+#include "optimizer.h"
+
+/******* ERRORS *******/
+
+typedef struct {
+	int cap;
+	int used;
+	char **ids;
+} names_t;
+
+internal int is_declared(names_t *names, char *id) {
+	for (int i = 0; i < names->used; ++i) {
+		if (!strcmp(names->ids[i], id))
+			return 1;
+	}
+	return 0;
+}
+
+// Whether everything that 'exp' uses is declared.
+internal int uses_declared(names_t *names, exp_t *exp) {
+	if (exp == NULL)
+		return 1;
+	if (exp->type == id_exp)
+		return is_declared(names, exp->id);
+	if (exp->type == unary_exp)
+		return uses_declared(names, exp->unaryExp.operand);
+	if (exp->type == bin_exp)
+		return uses_declared(names, exp->binExp.leftOperand) &&
+			uses_declared(names, exp->binExp.rightOperand);
+	if (exp->type == assign_exp)
+		return is_declared(names, exp->assignExp.id) && uses_declared(names, exp->assignExp.rvalue);
+	return 1;
+}
+
+// Check the statements from 'node' up to (not including) 'end' in the order that
+// the code generator goes over them, as variables have function scope and are
+// known from their declaration on (and only declared once).
+internal int statements_valid(names_t *names, statement_node_t *node, statement_node_t *end, int in_loop) {
+	while (node != end) {
+		statement_t *stat = &(node->stat);
+
+		if (stat->type == decl_stat) {
+			if (is_declared(names, stat->declStat.id))
+				return 0;
+			if (names->used >= names->cap) {
+				names->cap = (names->cap) ? 2 * names->cap : 16;
+				names->ids = realloc(names->ids, names->cap * sizeof(char *));
+			}
+			names->ids[(names->used)++] = stat->declStat.id;
+			if (!uses_declared(names, stat->declStat.rvalue))
+				return 0;
+		} else if (stat->type == simple_stat || stat->type == print_stat || stat->type == ret_stat) {
+			if (!uses_declared(names, stat->unaryStat.exp))
+				return 0;
+		} else if (stat->type == if_stat) {
+			if (!uses_declared(names, stat->ifStat.cond))
+				return 0;
+		} else if (stat->type == break_stat || stat->type == cont_stat) {
+			if (!in_loop)
+				return 0;
+		} else if (stat->type == while_stat) {
+			statement_node_t *body_end = block_end(node->next);
+			if (!uses_declared(names, stat->whileStat.cond) ||
+				!statements_valid(names, node->next->next, body_end, 1))
+				return 0;
+			node = body_end;
+		}
+		node = node->next;
+	}
+	return 1;
+}
+
+internal int is_valid(ast_t *ast) {
+	names_t names = { 0, 0, NULL };
+	// Skip the function statement.
+	int valid = statements_valid(&names, ast->root->next, NULL, 0);
+	free(names.ids);
+	return valid;
+}
+
+void optimize(ast_t *ast, const dicc_options *options, profile_t *profile) {
+	if (options->opt_level < 1 || !is_valid(ast))
+		return;
+
+	// The folding replaces long variables with constants, which
+	// have to stay longs (see typing.c).
+	assign_widths(ast);
+	// Before the folding, which propagates the values of the loops.
+	if (options->precompute_steps > 0)
+		precompute_loops(ast, options->precompute_steps);
+	fold_constants(ast);
+	// After the folding, which gives the counters of the loops their
+	// first value, and before it again, to propagate the counters into
+	// the copies of the bodies (which are typed like the rest first).
+	// The profile is numbered like the branches of the parser, and the
+	// unrolling keeps them.
+	// The instrumented program counts the loops of the source.
+	if (options->profile_generate == NULL)
+		unroll_loops(ast, profile);
+	assign_widths(ast);
+	fold_constants(ast);
+	// After the folding, so that it sees the variables
+	// that were replaced by their values.
+	simplify_expressions(ast);
+	hoist_invariants(ast);
+	// After the hoisting, so that the invariant factors are variables.
+	reduce_induction_variables(ast);
+	// After the hoisting, so that the values computed before a loop
+	// are reused in it.
+	eliminate_common_subexpressions(ast);
+	// The ranges of ints depend on the widths, which have to
+	// include the expressions and variables of the passes above.
+	assign_widths(ast);
+	analyze_ranges(ast);
+	// Again, to remove the branches that the ranges decided.
+	fold_constants(ast);
+	// Last, so that it also removes what the others left unused.
+	eliminate_dead_code(ast);
+}
@@ -0,0 +1,10 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "types.h"
+
+// Runs the AST passes enabled by the options. 'profile' is the
+// one of -fprofile-use (see load_profile()).
+void optimize(ast_t *, const dicc_options *, profile_t *);
+
+#endif
@@ -15,49 +15,37 @@ internal int parse_expression(parser_t *, exp_t *);
 
 internal void initialize_parser(parser_t *parser, lex_t *lex_input) {
 	parser->input = lex_input;
+	parser->sink = lex_input->sink;
 	parser->token_index = 0;
 	
 	// TODO(stefanos): This is probably a very bad solution.
 	parser->blocks = 0;  // how many nested blocks we are.
+	parser->branches = 0;
+	parser->shape = 2166136261u;   // the FNV-1a offset basis
+	parser->ast = NULL;
+	parser->loops_cap = 0;
+	parser->loops_used = 0;
+	parser->loops = NULL;
+	parser->variables_cap = 0;
+	parser->variables_used = 0;
+	parser->variables = NULL;
 }
 
-internal void clean_expression(exp_t *exp) {
-	if (exp->type == bin_exp) {
-		clean_expression(exp->binExp.leftOperand);
-		free(exp->binExp.leftOperand);
-		clean_expression(exp->binExp.rightOperand);
-		free(exp->binExp.rightOperand);
-	} else if (exp->type == unary_exp) {
-		clean_expression(exp->unaryExp.operand);
-		free(exp->unaryExp.operand);
-	} else if (exp->type == assign_exp) {
-		clean_expression(exp->assignExp.rvalue);
-		free(exp->assignExp.rvalue);
-	}
-}
-
-internal void clean_statement(statement_t *stat) {
-	if (stat->type == ret_stat) {
-		clean_expression(stat->retStat.exp);
-		free(stat->retStat.exp);
-	} else if (stat->type == print_stat) {
-		clean_expression(stat->printStat.exp);
-		free(stat->printStat.exp);
-	} else if (stat->type == decl_stat) {
-		if (stat->declStat.rvalue != NULL) {
-			clean_expression(stat->declStat.rvalue);
-			free(stat->declStat.rvalue);
+// What is left of the loops after an error.
+internal void clean_loops(parser_t *parser) {
+	for (int i = 0; i < parser->loops_used; ++i) {
+		exp_t *exp = (parser->loops[i].step != NULL) ? parser->loops[i].step : parser->loops[i].cond;
+		if (exp != NULL) {
+			clean_expression(exp);
+			free(exp);
 		}
-	} else if (stat->type == simple_stat) {
-		clean_expression(stat->simpleStat.exp);
-		free(stat->simpleStat.exp);
-	} else if (stat->type == if_stat) {
-		clean_expression(stat->ifStat.cond);
-		free(stat->ifStat.cond);
-	} else if (stat->type == while_stat) {
-		clean_expression(stat->whileStat.cond);
-		free(stat->whileStat.cond);
 	}
+	free(parser->loops);
+	parser->loops = NULL;
+	parser->loops_used = parser->loops_cap = 0;
+	free(parser->variables);
+	parser->variables = NULL;
+	parser->variables_used = parser->variables_cap = 0;
 }
 
 void clean_parser(ast_t *ast) {
@@ -71,6 +59,7 @@ void clean_parser(ast_t *ast) {
 			temp = save;
 		}
 
+		clean_temporaries(ast);
 		free(ast);
 	}
 }
@@ -81,23 +70,32 @@ internal inline int what_type(token_t token) {
 	return token.type;
 }
 
+internal int curr_line(parser_t *parser) {
+	int index = parser->token_index;
+	if (index >= parser->input->token_num)
+		index = parser->input->token_num - 1;
+	return (index >= 0) ? parser->input->token[index].line : -1;
+}
+
 // Returns a pointer to the current token
 // without advancing to the next
 internal token_t peek_token(parser_t *parser) {
-	assert(parser->token_index < parser->input->token_num);
+	// Running out of tokens is a syntax error of the input,
+	// so hand back a token that no rule accepts.
+	if (parser->token_index >= parser->input->token_num) {
+		token_t end = { .tok = "", .line = curr_line(parser), .type = UNKNOWN };
+		return end;
+	}
 	token_t next_token = parser->input->token[parser->token_index];
 	return next_token;
 }
 
-internal int curr_line(parser_t *parser) {
-	return parser->input->token[parser->token_index].line;
-}
-
 // Same as peek_token(), it just advances to
 // the next token.
 internal token_t get_token(parser_t *parser) {
 	token_t next_token = peek_token(parser);
-	parser->token_index += 1;
+	if (parser->token_index < parser->input->token_num)
+		parser->token_index += 1;
 	return next_token;
 }
 
@@ -126,7 +124,7 @@ internal int parse_unit(parser_t *parser, exp_t *output) {
 		output->unaryExp.operator = next_token.tok;
 		// the operand can be a whole expression itself,
 		// so take space.
-		output->unaryExp.operand = malloc(sizeof(exp_t));
+		output->unaryExp.operand = calloc(1, sizeof(exp_t));
 
 		if (!parse_unit(parser, output->unaryExp.operand)) {
 			success = 0;
@@ -141,6 +139,11 @@ internal int parse_unit(parser_t *parser, exp_t *output) {
 		next_token = get_token(parser);
 		if (what_type(next_token) != RPAR)
 			success = 0;
+	} else {
+		// Leave a node that is safe to clean up.
+		output->type = int_exp;
+		output->intExp = 0;
+		success = 0;
 	}
 
 	return success;
@@ -200,13 +203,13 @@ internal int parse_binary_exp(parser_t *parser, exp_t *output, int *types, int t
 		next_token = get_token(parser);
 
 		// construct the right term
-		exp_t *right = malloc(sizeof(exp_t));
+		exp_t *right = calloc(1, sizeof(exp_t));
 		int res = higher_prec_exp(parser, right);
 
 		// You have to do this first (before change its
 		// type and stuff)
 		// The new left term is the current term.
-		exp_t *temp = malloc(sizeof(exp_t));
+		exp_t *temp = calloc(1, sizeof(exp_t));
 		*temp = *output;
 		
 		// Construct the binary expression.
@@ -274,7 +277,7 @@ internal int parse_expression(parser_t *parser, exp_t *output) {
 			output->type = assign_exp;
 			output->assignExp.id = id;
 
-			exp_t *temp_exp = malloc(sizeof(exp_t));
+			exp_t *temp_exp = calloc(1, sizeof(exp_t));
 			if (!parse_logical_or_exp(parser, temp_exp)) {
 				//printf("failed\n");
 				success = 0;
@@ -323,19 +326,19 @@ internal int unary_statement(statement_t *output, char *keyword, parser_t *parse
 	else if (!strcmp(keyword, "print"))
 		output->type = print_stat;
 
-	exp_t *temp_exp = malloc(sizeof(exp_t));
+	exp_t *temp_exp = calloc(1, sizeof(exp_t));
 	res = parse_expression(parser, temp_exp);
 
 	output->unaryStat.exp = temp_exp;
 	if (res) {
 		res = require_semicolon(parser);
 		if (!res) {
-			report_error(curr_line(parser),
+			report_error(parser->sink, curr_line(parser),
 				"No semicolon after the %s expression\n", keyword);
 			success = 0;
 		}
 	} else {
-		report_error(curr_line(parser), 
+		report_error(parser->sink, curr_line(parser), 
 			"Invalid %s expression\n", keyword);
 		success = 0;
 	}
@@ -355,10 +358,263 @@ internal int no_op_statement(parser_t *parser, char *keyword, statement_t *outpu
 	get_token(parser);
 	res = require_semicolon(parser);
 	if (!res) {
-		report_error(curr_line(parser), "No semicolon in no op statement\n");
+		report_error(parser->sink, curr_line(parser), "No semicolon in no op statement\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/******* LOOPS *******/
+// NOTE: The rest of the compiler only knows while. A for is the
+// statement of its initialization and a while whose body ends with the step:
+//
+//     for (i = 0; i < n; i = i + 1) {        i = 0;
+//         if (x) {                           while (i < n) {
+//             continue;                 ->       if (x) {
+//         }                                          i = i + 1;
+//         ...                                        continue;
+//     }                                          }
+//                                                ...
+//                                                i = i + 1;
+//                                            }
+//
+// and a do-while is a while (1) whose body ends with the test of the condition
+// (the code generator tests it at the bottom of the loop, see bottom_exit()):
+//
+//     do {                                   while (1) {
+//         ...                           ->       ...
+//     } while (c);                               if (!(c)) {
+//                                                    break;
+//                                                }
+//                                            }
+//
+// A continue skips to the step, or to the test, so a copy of it goes
+// before every continue of the loop.
+
+internal int parse_statement(parser_t *, statement_t *);
+
+internal void push_loop(parser_t *parser, exp_t *step, exp_t *cond, int after, int variable) {
+	if (parser->loops_used >= parser->loops_cap) {
+		parser->loops_cap = (parser->loops_cap) ? 2 * parser->loops_cap : 8;
+		parser->loops = realloc(parser->loops, parser->loops_cap * sizeof(parsed_loop_t));
+	}
+	parsed_loop_t *loop = &(parser->loops[(parser->loops_used)++]);
+	loop->blocks = parser->blocks;
+	loop->step = step;
+	loop->cond = cond;
+	loop->after = after;
+	loop->variable = variable;
+}
+
+internal exp_t *new_integer(int value) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = int_exp;
+	exp->intExp = value;
+	return exp;
+}
+
+// Number a new if or while for the profiles (see profile.c). Its kind
+// ('i'f, 'w'hile, 'f'or or 'd'o) and line go into the shape of the
+// program, so that a profile of another program with the same number
+// of branches is told apart. The shape is an FNV-1a hash.
+internal int new_branch(parser_t *parser, char kind, int line) {
+	unsigned int values[2] = { (unsigned char) kind, (unsigned int) line };
+	for (int i = 0; i < 2; ++i) {
+		for (int byte = 0; byte < 4; ++byte) {
+			parser->shape ^= (values[i] >> (8 * byte)) & 0xff;
+			parser->shape *= 16777619u;
+		}
+	}
+	return (parser->branches)++;
+}
+
+// if (!(cond)) { break; }, which takes 'cond'.
+internal void add_exit_test(parser_t *parser, exp_t *cond, int line) {
+	statement_t stat;
+	stat.line = line;
+
+	exp_t *negated = calloc(1, sizeof(exp_t));
+	negated->type = unary_exp;
+	negated->unaryExp.operator = "!";
+	negated->unaryExp.operand = cond;
+	stat.type = if_stat;
+	stat.ifStat.cond = negated;
+	stat.ifStat.branch = new_branch(parser, 'd', line);
+	add_statement(parser->ast, stat);
+
+	stat.type = start_block;
+	add_statement(parser->ast, stat);
+	stat.type = break_stat;
+	add_statement(parser->ast, stat);
+	stat.type = end_block;
+	add_statement(parser->ast, stat);
+}
+
+// What a for or a do-while runs before 'continue' (if 'copy') or at
+// the end of its body (then it hands over its expression).
+internal void add_loop_end(parser_t *parser, parsed_loop_t *loop, int copy, int line) {
+	if (loop->step != NULL) {
+		statement_t stat;
+		stat.type = simple_stat;
+		stat.line = line;
+		stat.simpleStat.exp = (copy) ? copy_expression(loop->step) : loop->step;
+		add_statement(parser->ast, stat);
+	} else if (loop->cond != NULL) {
+		add_exit_test(parser, (copy) ? copy_expression(loop->cond) : loop->cond, line);
+	}
+}
+
+// The declaration 'init' of a for. The index of its variable in
+// parser->variables, -1 if it's not one of them.
+// NOTE: for (int i = 0; ...) in two loops of a function would
+// declare i twice. So the second one (if it comes after the end of
+// the first, and i has the same type) becomes i = 0.
+internal int declare_for_variable(parser_t *parser, statement_t *init) {
+	char *id = init->declStat.id;
+	int wide = init->declStat.wide;
+
+	for (int i = 0; i < parser->variables_used; ++i) {
+		for_variable_t *variable = &(parser->variables[i]);
+		if (strcmp(variable->id, id))
+			continue;
+		// Otherwise, it's a redeclaration, which the code generator reports.
+		if (variable->in_use || variable->wide != wide)
+			return -1;
+		exp_t *rvalue = init->declStat.rvalue;
+		exp_t *assign = calloc(1, sizeof(exp_t));
+		assign->type = assign_exp;
+		assign->assignExp.id = id;
+		assign->assignExp.rvalue = (rvalue != NULL) ? rvalue : new_integer(0);
+		init->type = simple_stat;
+		init->simpleStat.exp = assign;
+		variable->in_use = 1;
+		return i;
+	}
+
+	if (parser->variables_used >= parser->variables_cap) {
+		parser->variables_cap = (parser->variables_cap) ? 2 * parser->variables_cap : 8;
+		parser->variables = realloc(parser->variables, parser->variables_cap * sizeof(for_variable_t));
+	}
+	for_variable_t *variable = &(parser->variables[parser->variables_used]);
+	variable->id = id;
+	variable->wide = wide;
+	variable->in_use = 1;
+	return (parser->variables_used)++;
+}
+
+// for (init; cond; step) {, after the for. The loop is 'output'.
+internal int parse_for(parser_t *parser, statement_t *output) {
+	exp_t *step = NULL;
+	int variable = -1;
+
+	output->type = while_stat;
+	output->whileStat.branch = new_branch(parser, 'f', output->line);
+	// No condition means that it always holds.
+	output->whileStat.cond = new_integer(1);
+
+	if (what_type(get_token(parser)) != LPAR) {
+		report_error(parser->sink, curr_line(parser), "Missing left paren in the for\n");
+		return 0;
+	}
+
+	// The initialization is a declaration or an expression, which
+	// (as a statement) ends with the semicolon and goes before the loop.
+	int type = what_type(peek_token(parser));
+	if (type == SEMICOLON) {
+		get_token(parser);
+	} else if (type == KEYWORD || type == LBRACE || type == RBRACE) {
+		report_error(parser->sink, curr_line(parser), "Invalid initialization in the for\n");
 		return 0;
+	} else {
+		statement_t init;
+		memset(&init, 0, sizeof(init));
+		int res = parse_statement(parser, &init);
+		if (res && init.type == decl_stat)
+			variable = declare_for_variable(parser, &init);
+		// Added anyway, so that it is freed.
+		add_statement(parser->ast, init);
+		if (!res)
+			return 0;
 	}
 
+	if (what_type(peek_token(parser)) != SEMICOLON) {
+		if (!parse_expression(parser, output->whileStat.cond) || !require_semicolon(parser)) {
+			report_error(parser->sink, curr_line(parser), "Invalid condition expression in the for\n");
+			return 0;
+		}
+	} else {
+		get_token(parser);
+	}
+
+	if (what_type(peek_token(parser)) != RPAR) {
+		step = calloc(1, sizeof(exp_t));
+		if (!parse_expression(parser, step)) {
+			report_error(parser->sink, curr_line(parser), "Invalid step expression in the for\n");
+			clean_expression(step);
+			free(step);
+			return 0;
+		}
+	}
+	if (what_type(get_token(parser)) != RPAR || what_type(peek_token(parser)) != LBRACE) {
+		report_error(parser->sink, curr_line(parser), "Missing right paren or block in the for\n");
+		if (step != NULL) {
+			clean_expression(step);
+			free(step);
+		}
+		return 0;
+	}
+
+	push_loop(parser, step, NULL, 0, variable);
+	return 1;
+}
+
+// do {, after the do. The loop is 'output'.
+// NOTE: The condition comes after the body, but a continue in
+// the body needs it, so we look ahead for it here and skip it at the
+// end of the body.
+internal int parse_do(parser_t *parser, statement_t *output) {
+	int start = parser->token_index;
+	int blocks = 0;
+
+	output->type = while_stat;
+	output->whileStat.branch = new_branch(parser, 'd', output->line);
+	output->whileStat.cond = new_integer(1);
+
+	if (what_type(peek_token(parser)) != LBRACE) {
+		report_error(parser->sink, curr_line(parser), "Expected a block after the do\n");
+		return 0;
+	}
+	// Skip the body.
+	do {
+		if (parser->token_index >= parser->input->token_num) {
+			report_error(parser->sink, curr_line(parser), "Missing end of the do block\n");
+			return 0;
+		}
+		int type = what_type(get_token(parser));
+		if (type == LBRACE)
+			++blocks;
+		else if (type == RBRACE)
+			--blocks;
+	} while (blocks > 0);
+
+	token_t next_token = get_token(parser);
+	if (what_type(next_token) != KEYWORD || strcmp(next_token.tok, "while") ||
+		what_type(get_token(parser)) != LPAR) {
+		report_error(parser->sink, curr_line(parser), "Expected while (condition) after the do block\n");
+		return 0;
+	}
+	exp_t *cond = calloc(1, sizeof(exp_t));
+	if (!parse_expression(parser, cond) || what_type(get_token(parser)) != RPAR ||
+		!require_semicolon(parser)) {
+		report_error(parser->sink, curr_line(parser), "Invalid condition of the do-while\n");
+		clean_expression(cond);
+		free(cond);
+		return 0;
+	}
+
+	push_loop(parser, NULL, cond, parser->token_index, -1);
+	parser->token_index = start;
 	return 1;
 }
 
@@ -382,6 +638,16 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 		get_token(parser);
 		parser->blocks -= 1;
 		output->type = end_block;
+		parsed_loop_t *loop = (parser->loops_used) ? &(parser->loops[parser->loops_used - 1]) : NULL;
+		if (loop != NULL && loop->blocks == parser->blocks) {
+			// The end of the body of the loop.
+			add_loop_end(parser, loop, 0, output->line);
+			if (loop->cond != NULL)
+				parser->token_index = loop->after;
+			if (loop->variable != -1)
+				parser->variables[loop->variable].in_use = 0;
+			--(parser->loops_used);
+		}
 	} else if (what_type(next_token) == KEYWORD && !strcmp(tok_str, "return")) {
 		// return statement
 
@@ -408,23 +674,24 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 		next_token = get_token(parser);
 		
 		output->type = if_stat;
+		output->ifStat.branch = new_branch(parser, 'i', output->line);
 
 		if (what_type(next_token) == LPAR) {
-			exp_t *temp_exp = malloc(sizeof(exp_t));
+			exp_t *temp_exp = calloc(1, sizeof(exp_t));
 			res = parse_expression(parser, temp_exp);
 			output->ifStat.cond = temp_exp;
 			if (res) {
 				next_token = get_token(parser);
 				if (what_type(next_token) != RPAR) {
-					report_error(curr_line(parser), "Missing right paren in the if\n");
+					report_error(parser->sink, curr_line(parser), "Missing right paren in the if\n");
 					success = 0;
 				}
 			} else {
-				report_error(curr_line(parser), "Invalid condition expression in the if\n");
+				report_error(parser->sink, curr_line(parser), "Invalid condition expression in the if\n");
 				success = 0;
 			}
 		} else {
-			report_error(curr_line(parser), "Missing left paren in the if\n");
+			report_error(parser->sink, curr_line(parser), "Missing left paren in the if\n");
 			success = 0;
 		}
 	} else if (what_type(next_token) == KEYWORD && !strcmp(tok_str, "else")) {
@@ -434,6 +701,16 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 				(!strcmp(tok_str, "break") || !strcmp(tok_str, "continue"))) {
 		if(!no_op_statement(parser, next_token.tok, output))
 			success = 0;
+		else if (output->type == cont_stat && parser->loops_used)
+			add_loop_end(parser, &(parser->loops[parser->loops_used - 1]), 1, output->line);
+	} else if (what_type(next_token) == KEYWORD && !strcmp(tok_str, "for")) {
+		get_token(parser);
+		if (!parse_for(parser, output))
+			success = 0;
+	} else if (what_type(next_token) == KEYWORD && !strcmp(tok_str, "do")) {
+		get_token(parser);
+		if (!parse_do(parser, output))
+			success = 0;
 	} else if (what_type(next_token) == KEYWORD && !strcmp(tok_str, "while")) {
 		// while statement
 		// similar to if
@@ -441,26 +718,30 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 		next_token = get_token(parser);
 		
 		output->type = while_stat;
+		output->whileStat.branch = new_branch(parser, 'w', output->line);
 
 		if (what_type(next_token) == LPAR) {
-			exp_t *temp_exp = malloc(sizeof(exp_t));
+			exp_t *temp_exp = calloc(1, sizeof(exp_t));
 			res = parse_expression(parser, temp_exp);
 			output->whileStat.cond = temp_exp;
 			if (res) {
 				next_token = get_token(parser);
 				if (what_type(next_token) != RPAR) {
-					report_error(curr_line(parser),
-						"Missing right paren in the while, got: %s\n", next_token);
+					report_error(parser->sink, curr_line(parser),
+						"Missing right paren in the while, got: %s\n", next_token.tok);
 					success = 0;
 				}
 			} else {
-				report_error(curr_line(parser), "Invalid condition expression in the while\n");
+				report_error(parser->sink, curr_line(parser), "Invalid condition expression in the while\n");
 				success = 0;
 			}
 		} else {
-			report_error(curr_line(parser), "Missing left paren in the while\n");
+			report_error(parser->sink, curr_line(parser), "Missing left paren in the while\n");
 			success = 0;
 		}
+		// A continue in it doesn't go to an outer for or do-while.
+		if (success && what_type(peek_token(parser)) == LBRACE)
+			push_loop(parser, NULL, NULL, 0, -1);
 
 	} else if (what_type(next_token) == DATA_TYPE) {
 		// Declaration statement
@@ -468,12 +749,18 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 		next_token = get_token(parser);
 
 		output->type = decl_stat;
+		// Everything but long is an int (see typing.c).
+		output->declStat.wide = !strcmp(next_token.tok, "long");
+		// Cleaned on any error below, so it must not be left over.
+		output->declStat.id = NULL;
+		output->declStat.rvalue = NULL;
 
 		// Next token should be indentifier
 		next_token = get_token(parser);
 
 		if (what_type(next_token) == IDENTIFIER) {
 			output->declStat.id = next_token.tok;
+			output->declStat.uninitialized = 0;
 
 			next_token = peek_token(parser);  // either ';' or '='
 			// i.e. either we have initialization or not.
@@ -483,7 +770,7 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 			get_token(parser);
 			if (type == ASSIGN) {
 				// We _must_ have an rvalue.
-				exp_t *temp_exp = malloc(sizeof(exp_t));
+				exp_t *temp_exp = calloc(1, sizeof(exp_t));
 				res = parse_expression(parser, temp_exp);
 
 				output->declStat.rvalue = temp_exp;
@@ -492,7 +779,7 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 				if (res) {
 					res = require_semicolon(parser);
 					if (!res) {
-						report_error(curr_line(parser), "No semicolon in the declaration\n");
+						report_error(parser->sink, curr_line(parser), "No semicolon in the declaration\n");
 						success = 0;
 					}
 				} else {
@@ -502,7 +789,7 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 				// We don't have an rvalue.
 				output->declStat.rvalue = NULL;
 			} else {
-				report_error(curr_line(parser), 
+				report_error(parser->sink, curr_line(parser), 
 					"Invalid declaration statement: %s\n", 
 					output->declStat.id);
 				success = 0;
@@ -513,7 +800,7 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 	} else {
 		output->type = simple_stat;
 
-		exp_t *temp_exp = malloc(sizeof(exp_t));
+		exp_t *temp_exp = calloc(1, sizeof(exp_t));
 		res = parse_expression(parser, temp_exp);
 
 		output->simpleStat.exp = temp_exp;
@@ -522,7 +809,7 @@ internal int parse_statement(parser_t *parser, statement_t *output) {
 		if (res) {
 			res = require_semicolon(parser);
 			if (!res) {
-				report_error(curr_line(parser), "No semicolon in the simple statement\n");
+				report_error(parser->sink, curr_line(parser), "No semicolon in the simple statement\n");
 				success = 0;
 			}
 		} else {
@@ -547,8 +834,7 @@ internal int parse_function(parser_t *parser, ast_t *ast) {
 	// a data type (function's return type)
 	next_token = get_token(parser);
 	if (what_type(next_token) != DATA_TYPE) {
-		printf("%s\n", peek_token(parser).tok);
-		report_error(curr_line(parser), "Expected data type\n");
+		report_error(parser->sink, curr_line(parser), "Expected data type\n");
 		return 0;
 	}
 
@@ -556,7 +842,7 @@ internal int parse_function(parser_t *parser, ast_t *ast) {
 	// an identifier (function's name)
 	next_token = get_token(parser);
 	if (what_type(next_token) != IDENTIFIER) {
-		report_error(curr_line(parser), "Expected identifier\n");
+		report_error(parser->sink, curr_line(parser), "Expected identifier\n");
 		return 0;
 	}
 
@@ -568,26 +854,29 @@ internal int parse_function(parser_t *parser, ast_t *ast) {
 
 	// Next token should be an open (left) paren
 	if (what_type(get_token(parser)) != LPAR) {
-		report_error(curr_line(parser), 
+		report_error(parser->sink, curr_line(parser), 
 			"Expected left paren while parsing function: %s\n", name);
 		return 0;
 	}
 
 	// Next token should be a closing paren
 	if (what_type(get_token(parser)) != RPAR) {
-		report_error(curr_line(parser), 
+		report_error(parser->sink, curr_line(parser), 
 			"Expected right paren while parsing function: %s\n", name);
 		return 0;
 	}
 
 	// Next token should be {
 	if (what_type(get_token(parser)) != LBRACE) {
-		report_error(curr_line(parser), 
+		report_error(parser->sink, curr_line(parser), 
 			"Expected left brace while parsing function: %s\n", name);
 		return 0;
 	}
 
 	while (!(what_type(peek_token(parser)) == RBRACE && parser->blocks == 0)) {
+		// A statement that fails half-way is cleaned by what it has
+		// set, so it must not see what the previous one left.
+		memset(&result, 0, sizeof(result));
 		int res = parse_statement(parser, &result);
 
 		// IMPORTANT(stefanos): We add the statement anyway
@@ -614,13 +903,18 @@ ast_t *parser(lex_t *input) {
 	
 	ast_t *ast = malloc(sizeof(ast_t));
 	initialize_ast(ast);
+	parser.ast = ast;
 
 	// Parse function
 	if (!parse_function(&parser, ast)) {
-		report_error(-1, "Failed to parse function\n");
+		report_error(parser.sink, -1, "Failed to parse function\n");
+		clean_loops(&parser);
 		clean_parser(ast);
 		return NULL;
 	}
+	ast->branches = parser.branches;
+	ast->shape = parser.shape;
+	clean_loops(&parser);
 
 	return ast;
 }
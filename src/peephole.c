@@ -0,0 +1,480 @@
+/*******
+Peephole optimization of the generated assembly.
+
+HOW IT WORKS:
+The code generator produces every instruction in isolation, so the output
+has patterns that a human would never write (e.g. a push followed by a pop
+to move a value between two registers). These are described as rules,
+in the table below. A rule has a few lines of pattern and the lines that
+replace them. In the pattern, %1 to %9 match an operand (anything up to the
+next character of the pattern) and the same number has to match the same
+thing everywhere in the rule. In the replacement they are substituted with
+what they matched. A rule can also have a check, for what the pattern can't
+express (e.g. that an operand is a register).
+
+We go over the instructions and try all the rules at every position. When
+one matches, we replace the lines, go back a few lines (the replacement
+may have formed a new pattern with the previous instructions) and continue.
+Every rule makes the code shorter or cheaper, so this ends.
+
+Some rules need to know that a register isn't used after the pattern
+(e.g. sub rcx, rax / mov rax, rcx is neg rax / add rax, rcx only if
+nobody reads rcx afterwards). For that, we look at the instructions
+that follow, until one overwrites it. Anything that we don't understand
+(a jump, a label, a call etc.) is assumed to read it.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "types.h"
+#include "utils.h"
+#include "peephole.h"
+
+#define MAX_RULE_LINES 3
+#define MAX_OPERANDS 10
+
+typedef struct {
+	int cap;
+	int used;
+	char **data;
+} lines_t;
+
+typedef struct {
+	char *op[MAX_OPERANDS];   // what %1 to %9 matched, NULL if nothing yet
+	lines_t *lines;
+	int after;                // the first line after the pattern
+} match_t;
+
+typedef struct {
+	const char *name;
+	const char *pattern[MAX_RULE_LINES];       // NULL-terminated
+	const char *replacement[MAX_RULE_LINES];   // same, can be empty
+	int (*check)(match_t *);
+} rule_t;
+
+// 0 for a 64-bit register, 1 for a 32-bit one, 2 for
+// an 8-bit one and -1 if it's not a register.
+internal int register_size(const char *operand) {
+	int reg = register_index(operand);
+	for (int size = 0; reg != -1 && size < 3; ++size) {
+		if (!strcmp(operand, registers[reg][size]))
+			return size;
+	}
+	return -1;
+}
+
+// Whether any name of register 'reg' appears in 'text'.
+internal int mentions_register(const char *text, int reg) {
+	for (const char *c = text; *c; ++c) {
+		// At the start of a word.
+		if (c != text && (isalnum(c[-1]) || c[-1] == '_'))
+			continue;
+		for (int size = 0; size < 3; ++size) {
+			size_t len = strlen(registers[reg][size]);
+			if (!strncmp(c, registers[reg][size], len) && !isalnum(c[len]))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+// Whether the value of 'reg' is not needed after the pattern.
+internal int dead_after(match_t *match, const char *name) {
+	int reg = register_index(name);
+	lines_t *lines = match->lines;
+
+	// NOTE: A few instructions are enough for
+	// what the code generator emits.
+	for (int i = match->after; i < lines->used && i < match->after + 16; ++i) {
+		const char *line = lines->data[i];
+		const char *space = strchr(line, ' ');
+		if (space == NULL)
+			return 0;   // cdq, ret, a label etc.
+		size_t len = space - line;
+		const char *operands = space + 1;
+		const char *comma = strchr(operands, ',');
+
+		// These read rax or rdx without naming it.
+		if (!strncmp(line, "idiv", len) || !strncmp(line, "div", len) || !strncmp(line, "call", len) ||
+			!strncmp(line, "mulx", len) ||
+			(!strncmp(line, "imul", len) && comma == NULL))
+			return 0;
+		if (line[0] == 'j' || !strncmp(line, "xchg", len))
+			return 0;
+
+		if (comma == NULL) {
+			if (mentions_register(operands, reg))
+				return 0;
+			continue;
+		}
+		if (mentions_register(comma + 1, reg))
+			return 0;
+		// A write of the whole register (32-bit writes zero the
+		// upper half) that doesn't read it.
+		int writes_only = !strncmp(line, "mov", len) || !strncmp(line, "movzx", len) ||
+			!strncmp(line, "lea", len);
+		char dst[16];
+		size_t dst_len = comma - operands;
+		if (writes_only && dst_len < sizeof(dst)) {
+			memcpy(dst, operands, dst_len);
+			dst[dst_len] = '\0';
+			if (register_index(dst) == reg && strcmp(dst, registers[reg][2]))
+				return 1;
+		}
+		if (mentions_register(operands, reg))
+			return 0;
+	}
+	return 0;
+}
+
+/******* CHECKS *******/
+
+internal int first_is_register(match_t *match) {
+	return register_index(match->op[1]) != -1;
+}
+
+// sub %1, %2 / mov %2, %1: %2 has to be a register too, a neg of a
+// variable on the stack would need its size said (and is slower).
+internal int subtracted_in_registers(match_t *match) {
+	return register_index(match->op[1]) != -1 && register_index(match->op[2]) != -1 &&
+		dead_after(match, match->op[1]);
+}
+
+// mov %1, %2 / mov %3, %1: %1 is only used to carry %2 to register %3
+// (all of them 64-bit or all of them 32-bit).
+internal int moved_through_dead(match_t *match) {
+	char *src = match->op[2];
+	int immediate = isdigit(src[0]) || src[0] == '-';
+	int size = register_size(match->op[1]);
+	return (size == 0 || size == 1) && register_size(match->op[3]) == size &&
+		(register_size(src) == size || immediate || src[0] == '[') &&
+		dead_after(match, match->op[1]);
+}
+
+// mov %1, %2 / movsxd %3, %1: %3 is the 64-bit register of %1, so
+// the value is only moved there to be sign-extended.
+internal int extended_in_place(match_t *match) {
+	int reg = register_index(match->op[1]);
+	char *src = match->op[2];
+	return reg != -1 && register_size(match->op[1]) == 1 && !strcmp(match->op[3], registers[reg][0]) &&
+		(register_size(src) == 1 || src[0] == '[');
+}
+
+// cmp %1, %2 / mov %3, 0 / set%4 %5: %5 is the low byte of %3.
+// Sets %6 to the 32-bit name of %3, as zeroing (and zero-extending)
+// the 32-bit register clears the whole of it, with a shorter instruction.
+internal int zeroed_is_set(match_t *match) {
+	int reg = register_index(match->op[3]);
+	int size = register_size(match->op[3]);
+	if (reg == -1 || (size != 0 && size != 1) || strcmp(match->op[5], registers[reg][2]))
+		return 0;
+	match->op[6] = strdup(registers[reg][1]);
+	return 1;
+}
+
+internal int is_compared(match_t *match) {
+	int reg = register_index(match->op[3]);
+	return register_index(match->op[1]) == reg ||
+		(match->op[2] != NULL && register_index(match->op[2]) == reg);
+}
+
+// The register can be zeroed before the comparison.
+internal int zeroed_not_compared(match_t *match) {
+	return zeroed_is_set(match) && !is_compared(match);
+}
+
+// It can't, as it is one of the operands.
+internal int zeroed_compared(match_t *match) {
+	return zeroed_is_set(match) && is_compared(match);
+}
+
+// The line after an unconditional jump is an instruction (and not
+// a label), so it can never run.
+internal int second_is_instruction(match_t *match) {
+	char *line = match->op[2];
+	size_t len = strlen(line);
+	return len && line[len - 1] != ':' && line[0] != '.';
+}
+
+// The value is read back in the same size as it was stored.
+internal int stored_from_register(match_t *match) {
+	return register_index(match->op[2]) != -1 && register_size(match->op[2]) == register_size(match->op[3]);
+}
+
+/******* RULES *******/
+
+global_var const rule_t rules[] = {
+	{
+		"push/pop to mov",
+		{ "push %1", "pop %2" },
+		{ "mov %2, %1" },
+		NULL
+	},
+	{
+		"move to itself",
+		{ "mov %1, %1" },
+		{ NULL },
+		first_is_register
+	},
+	{
+		"jump to the next label",
+		{ "jmp %1", "%1:" },
+		{ "%1:" },
+		NULL
+	},
+	{
+		"unreachable after jmp",
+		{ "jmp %1", "%2" },
+		{ "jmp %1" },
+		second_is_instruction
+	},
+	{
+		"cmp with 0 to test",
+		{ "cmp %1, 0" },
+		{ "test %1, %1" },
+		first_is_register
+	},
+	// mov zeroes without affecting the flags, so it can sit between the
+	// cmp and the setcc, but xor is shorter and breaks the dependency
+	// on the old value of the register. It has to go before the cmp.
+	{
+		"mov 0 before setcc to xor",
+		{ "cmp %1, %2", "mov %3, 0", "set%4 %5" },
+		{ "xor %6, %6", "cmp %1, %2", "set%4 %5" },
+		zeroed_not_compared
+	},
+	{
+		"mov 0 before setcc to xor",
+		{ "test %1, %1", "mov %3, 0", "set%4 %5" },
+		{ "xor %6, %6", "test %1, %1", "set%4 %5" },
+		zeroed_not_compared
+	},
+	// If the register is compared, it's zero-extended after the setcc.
+	{
+		"mov 0 before setcc to movzx",
+		{ "cmp %1, %2", "mov %3, 0", "set%4 %5" },
+		{ "cmp %1, %2", "set%4 %5", "movzx %6, %5" },
+		zeroed_compared
+	},
+	{
+		"mov 0 before setcc to movzx",
+		{ "test %1, %1", "mov %3, 0", "set%4 %5" },
+		{ "test %1, %1", "set%4 %5", "movzx %6, %5" },
+		zeroed_compared
+	},
+	{
+		"sub and mov to neg and add",
+		{ "sub %1, %2", "mov %2, %1" },
+		{ "neg %2", "add %2, %1" },
+		subtracted_in_registers
+	},
+	{
+		"move through a dead register",
+		{ "mov %1, %2", "mov %3, %1" },
+		{ "mov %3, %2" },
+		moved_through_dead
+	},
+	{
+		"sign extension of a moved value",
+		{ "mov %1, %2", "movsxd %3, %1" },
+		{ "movsxd %3, %2" },
+		extended_in_place
+	},
+	{
+		"reload of a stored value",
+		{ "mov [%1], %2", "mov %3, [%1]" },
+		{ "mov [%1], %2", "mov %3, %2" },
+		stored_from_register
+	},
+};
+
+#define NUM_RULES ((int) (sizeof(rules) / sizeof(rules[0])))
+
+internal void clean_match(match_t *match) {
+	for (int i = 0; i < MAX_OPERANDS; ++i) {
+		free(match->op[i]);
+		match->op[i] = NULL;
+	}
+}
+
+// Match one line against one line of a pattern, binding the operands.
+internal int match_line(const char *pattern, const char *line, match_t *match) {
+	while (*pattern) {
+		if (pattern[0] == '%' && isdigit(pattern[1])) {
+			int n = pattern[1] - '0';
+			char stop = pattern[2];
+			const char *end = line;
+			// Up to the next character of the pattern.
+			while (*end && *end != stop)
+				++end;
+			if (end == line)
+				return 0;
+			size_t len = end - line;
+			if (match->op[n] != NULL) {
+				if (strlen(match->op[n]) != len || strncmp(match->op[n], line, len))
+					return 0;
+			} else {
+				match->op[n] = malloc(len + 1);
+				memcpy(match->op[n], line, len);
+				match->op[n][len] = '\0';
+			}
+			line = end;
+			pattern += 2;
+		} else {
+			if (*pattern != *line)
+				return 0;
+			++pattern;
+			++line;
+		}
+	}
+	return *line == '\0';
+}
+
+internal char *substitute(const char *replacement, match_t *match) {
+	size_t len = 0;
+	for (const char *c = replacement; *c; ++c) {
+		if (c[0] == '%' && isdigit(c[1]))
+			len += strlen(match->op[*(++c) - '0']);
+		else
+			++len;
+	}
+	char *line = malloc(len + 1);
+	char *out = line;
+	for (const char *c = replacement; *c; ++c) {
+		if (c[0] == '%' && isdigit(c[1])) {
+			const char *op = match->op[*(++c) - '0'];
+			memcpy(out, op, strlen(op));
+			out += strlen(op);
+		} else {
+			*(out++) = *c;
+		}
+	}
+	*out = '\0';
+	return line;
+}
+
+internal int count_lines(const char * const *lines) {
+	int n = 0;
+	while (n < MAX_RULE_LINES && lines[n] != NULL)
+		++n;
+	return n;
+}
+
+// Try a rule at line 'pos'. Returns whether it was applied.
+internal int apply_rule(const rule_t *rule, lines_t *lines, int pos) {
+	match_t match = { { NULL }, lines, pos + count_lines(rule->pattern) };
+	int n = count_lines(rule->pattern);
+
+	if (pos + n > lines->used)
+		return 0;
+	for (int i = 0; i < n; ++i) {
+		if (!match_line(rule->pattern[i], lines->data[pos + i], &match)) {
+			clean_match(&match);
+			return 0;
+		}
+	}
+	if (rule->check != NULL && !rule->check(&match)) {
+		clean_match(&match);
+		return 0;
+	}
+
+	int m = count_lines(rule->replacement);
+	char *replaced[MAX_RULE_LINES];
+	for (int i = 0; i < m; ++i)
+		replaced[i] = substitute(rule->replacement[i], &match);
+	clean_match(&match);
+
+	for (int i = 0; i < n; ++i)
+		free(lines->data[pos + i]);
+	// Replacements never have more lines than their patterns.
+	memmove(lines->data + pos + m, lines->data + pos + n, (lines->used - pos - n) * sizeof(char *));
+	lines->used -= n - m;
+	for (int i = 0; i < m; ++i)
+		lines->data[pos + i] = replaced[i];
+
+	return 1;
+}
+
+internal void split_lines(lines_t *lines, char *code, size_t len) {
+	lines->cap = 0;
+	lines->used = 0;
+	lines->data = NULL;
+
+	size_t start = 0;
+	while (start < len) {
+		size_t end = start;
+		while (end < len && code[end] != '\n')
+			++end;
+		// Without the trailing whitespace, to make the matching simpler.
+		size_t trimmed = end;
+		while (trimmed > start && isspace(code[trimmed - 1]))
+			--trimmed;
+
+		if (lines->used >= lines->cap) {
+			lines->cap = (lines->cap) ? 2 * lines->cap : 256;
+			lines->data = realloc(lines->data, lines->cap * sizeof(char *));
+		}
+		char *line = malloc(trimmed - start + 1);
+		memcpy(line, code + start, trimmed - start);
+		line[trimmed - start] = '\0';
+		lines->data[(lines->used)++] = line;
+
+		start = end + 1;
+	}
+}
+
+void peephole(gen_t *gen) {
+	lines_t lines;
+	int counts[NUM_RULES] = { 0 };
+
+	split_lines(&lines, gen->out, gen->out_len);
+
+	int pos = 0;
+	while (pos < lines.used) {
+		int applied = 0;
+		for (int r = 0; r < NUM_RULES && !applied; ++r) {
+			if (apply_rule(&rules[r], &lines, pos)) {
+				counts[r] += 1;
+				applied = 1;
+			}
+		}
+		if (applied)
+			pos = (pos >= MAX_RULE_LINES) ? pos - MAX_RULE_LINES : 0;
+		else
+			++pos;
+	}
+
+	// Put the code back in the buffer.
+	size_t total = 0;
+	for (int i = 0; i < lines.used; ++i)
+		total += strlen(lines.data[i]) + 1;
+	if (total > gen->out_cap) {
+		gen->out_cap = total;
+		gen->out = realloc(gen->out, gen->out_cap);
+	}
+	gen->out_len = 0;
+	for (int i = 0; i < lines.used; ++i) {
+		size_t len = strlen(lines.data[i]);
+		memcpy(gen->out + gen->out_len, lines.data[i], len);
+		gen->out_len += len;
+		gen->out[(gen->out_len)++] = '\n';
+		free(lines.data[i]);
+	}
+	free(lines.data);
+
+	// Rules with the same name are variations of the same pattern.
+	for (int r = 0; r < NUM_RULES; ++r) {
+		int count = 0;
+		int first = 1;
+		for (int other = 0; other < NUM_RULES; ++other) {
+			if (!strcmp(rules[other].name, rules[r].name)) {
+				count += counts[other];
+				first = first && other >= r;
+			}
+		}
+		if (first && count)
+			report_note(gen->sink, "peephole: %s: %d\n", rules[r].name, count);
+	}
+}
@@ -0,0 +1,10 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "types.h"
+
+// Rewrites the assembly in the buffer of the generator and
+// reports how many times each rule was applied.
+void peephole(gen_t *);
+
+#endif
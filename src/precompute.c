@@ -0,0 +1,400 @@
+/*******
+Compile-time evaluation of loops.
+
+HOW IT WORKS:
+A program has no inputs, so all of its values come from the constants of
+the source. The folding (see fold.c) finds the ones that are the same in
+every iteration of a loop, but gives up on a variable that changes in a
+loop, even if the loop always runs the same way. Here we run the function
+in the compiler instead, with the actual values of the variables, the way
+the generated code would: ints are 32 bits and longs 64 (see typing.c), a
+long becomes an int by keeping its lower half, and && and || skip their
+second operand.
+
+A loop that runs once every time the function runs (it is not inside another
+loop) ends the same way every time, so when it's done we know the values
+that it left behind. If it printed nothing, it is replaced with assignments
+of these values to the variables that it assigns, and the folding that
+follows propagates them:
+
+	i = 0;                         i = 0;
+	s = 0;                         s = 0;
+	while (i < 10) {         ->    s = 45;
+		s = s + i;                 i = 10;
+		i = i + 1;
+	}
+
+A loop that prints is left as it is, but we still know the values after it
+and go on with the next one.
+
+We stop at the first thing that we can't do like the generated code would:
+a division by zero and an overflow (which trap or are undefined), an
+assignment in both operands of an operation (they can happen in any order),
+an undeclared variable, or the budget of steps running out (the program
+could as well never end, see precompute_steps in dicc.h). The loops before it stay replaced, and everything
+from it on is compiled as usual.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "types.h"
+#include "ast.h"
+#include "precompute.h"
+
+typedef struct {
+	char *id;
+	long long value;
+	int wide;
+} variable_t;
+
+typedef struct {
+	ast_t *ast;
+	int cap;
+	int used;
+	variable_t *vars;
+	long long steps;   // left in the budget
+	int prints;        // print statements run so far
+} machine_t;
+
+// How a statement hands over control.
+typedef enum { FLOW_NEXT, FLOW_BREAK, FLOW_CONTINUE, FLOW_RETURN, FLOW_FAIL } flow_t;
+
+internal variable_t *find_variable(machine_t *m, char *id) {
+	for (int i = 0; i < m->used; ++i) {
+		if (!strcmp(m->vars[i].id, id))
+			return &(m->vars[i]);
+	}
+	return NULL;
+}
+
+internal void declare_variable(machine_t *m, char *id, int wide) {
+	if (find_variable(m, id) != NULL)
+		return;
+	if (m->used >= m->cap) {
+		m->cap = (m->cap) ? 2 * m->cap : 16;
+		m->vars = realloc(m->vars, m->cap * sizeof(variable_t));
+	}
+	variable_t *var = &(m->vars[(m->used)++]);
+	var->id = id;
+	var->value = 0;
+	var->wide = wide;
+}
+
+// The value that a variable of the width 'wide' gets for 'value'.
+internal long long convert(long long value, int wide) {
+	return (wide) ? value : (long long) (int) (unsigned int) value;
+}
+
+internal int fits(long long value, int wide) {
+	return wide || (value >= INT_MIN && value <= INT_MAX);
+}
+
+// The arithmetic operations of 'exp', on the width of 'exp'.
+// Returns 0 if the operation traps or overflows.
+internal int compute(exp_t *exp, long long l, long long r, long long *result) {
+	switch (exp->binExp.operator[0]) {
+		case '+':
+			if (__builtin_add_overflow(l, r, result))
+				return 0;
+			break;
+		case '-':
+			if (__builtin_sub_overflow(l, r, result))
+				return 0;
+			break;
+		case '*':
+			if (__builtin_mul_overflow(l, r, result))
+				return 0;
+			break;
+		case '/':
+		case '%':
+			if (r == 0 || (l == LLONG_MIN && r == -1))
+				return 0;
+			*result = (exp->binExp.operator[0] == '/') ? l / r : l % r;
+			break;
+		case '=': *result = (l == r); break;
+		case '!': *result = (l != r); break;
+		case '<': *result = (exp->binExp.operator[1] == '=') ? l <= r : l < r; break;
+		case '>': *result = (exp->binExp.operator[1] == '=') ? l >= r : l > r; break;
+		default: return 0;
+	}
+	return fits(*result, exp->wide);
+}
+
+internal int evaluate(machine_t *m, exp_t *exp, long long *value) {
+	if (--(m->steps) < 0)
+		return 0;
+
+	if (exp->type == int_exp) {
+		*value = exp->intExp;
+	} else if (exp->type == id_exp) {
+		variable_t *var = find_variable(m, exp->id);
+		if (var == NULL)
+			return 0;
+		*value = var->value;
+	} else if (exp->type == unary_exp) {
+		long long operand;
+		if (!evaluate(m, exp->unaryExp.operand, &operand))
+			return 0;
+		char op = exp->unaryExp.operator[0];
+		if (op == '-') {
+			if (operand == LLONG_MIN || !fits(-operand, exp->wide))
+				return 0;
+			*value = -operand;
+		} else if (op == '~') {
+			*value = ~operand;
+		} else if (op == '!') {
+			*value = !operand;
+		} else {
+			return 0;
+		}
+	} else if (exp->type == bin_exp) {
+		exp_t *left = exp->binExp.leftOperand;
+		exp_t *right = exp->binExp.rightOperand;
+		long long l, r;
+
+		if (!strcmp(exp->binExp.operator, "&&") || !strcmp(exp->binExp.operator, "||")) {
+			int is_and = (exp->binExp.operator[0] == '&');
+			if (!evaluate(m, left, &l))
+				return 0;
+			if ((is_and && !l) || (!is_and && l)) {
+				*value = !is_and;
+				return 1;
+			}
+			if (!evaluate(m, right, &r))
+				return 0;
+			*value = (r != 0);
+			return 1;
+		}
+		// NOTE: The code generator picks which operand goes first
+		// (see select_tiles()), so an assignment in one of them is
+		// only safe if the other one doesn't read anything.
+		if ((has_side_effects(left) && right->type != int_exp) ||
+			(has_side_effects(right) && left->type != int_exp))
+			return 0;
+		if (!evaluate(m, left, &l) || !evaluate(m, right, &r))
+			return 0;
+		return compute(exp, l, r, value);
+	} else if (exp->type == assign_exp) {
+		variable_t *var = find_variable(m, exp->assignExp.id);
+		if (var == NULL || !evaluate(m, exp->assignExp.rvalue, value))
+			return 0;
+		var->value = convert(*value, var->wide);
+		*value = var->value;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+internal flow_t run_statements(machine_t *, statement_node_t *, statement_node_t *, int once);
+
+/******* REPLACEMENT *******/
+
+typedef struct {
+	char *id;
+	statement_t *decl;   // its declaration, if it is in the loop
+} target_t;
+
+typedef struct {
+	int cap;
+	int used;
+	target_t *data;
+} targets_t;
+
+internal void add_target(targets_t *targets, char *id, statement_t *decl) {
+	for (int i = 0; i < targets->used; ++i) {
+		if (!strcmp(targets->data[i].id, id)) {
+			if (decl != NULL && targets->data[i].decl == NULL)
+				targets->data[i].decl = decl;
+			return;
+		}
+	}
+	if (targets->used >= targets->cap) {
+		targets->cap = (targets->cap) ? 2 * targets->cap : 16;
+		targets->data = realloc(targets->data, targets->cap * sizeof(target_t));
+	}
+	target_t *target = &(targets->data[(targets->used)++]);
+	target->id = id;
+	target->decl = decl;
+}
+
+internal void collect_assigned(targets_t *targets, exp_t *exp) {
+	if (exp->type == assign_exp) {
+		add_target(targets, exp->assignExp.id, NULL);
+		collect_assigned(targets, exp->assignExp.rvalue);
+	} else if (exp->type == unary_exp) {
+		collect_assigned(targets, exp->unaryExp.operand);
+	} else if (exp->type == bin_exp) {
+		collect_assigned(targets, exp->binExp.leftOperand);
+		collect_assigned(targets, exp->binExp.rightOperand);
+	}
+}
+
+internal exp_t *new_integer(long long value, int wide) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = int_exp;
+	exp->intExp = (int) value;
+	exp->wide = wide;
+	return exp;
+}
+
+// The loop from 'node' to 'end' has run, replace it with the values that it
+// left behind. The declarations in it stay, as variables have function scope.
+// Leaves it if a value doesn't fit in an integer expression.
+internal void replace_loop(machine_t *m, statement_node_t *node, statement_node_t *end) {
+	targets_t targets = { 0, 0, NULL };
+
+	for (statement_node_t *it = node; ; it = it->next) {
+		statement_t *stat = &(it->stat);
+		if (stat->type == decl_stat) {
+			add_target(&targets, stat->declStat.id, stat);
+			if (stat->declStat.rvalue != NULL)
+				collect_assigned(&targets, stat->declStat.rvalue);
+		} else if (stat->type == simple_stat || stat->type == print_stat || stat->type == ret_stat) {
+			collect_assigned(&targets, stat->unaryStat.exp);
+		} else if (stat->type == if_stat || stat->type == while_stat) {
+			collect_assigned(&targets, stat->ifStat.cond);
+		}
+		if (it == end)
+			break;
+	}
+
+	for (int i = 0; i < targets.used; ++i) {
+		variable_t *var = find_variable(m, targets.data[i].id);
+		if (var != NULL && (var->value < INT_MIN || var->value > INT_MAX)) {
+			free(targets.data);
+			return;
+		}
+	}
+
+	for (int i = 0; i < targets.used; ++i) {
+		target_t *target = &(targets.data[i]);
+		// NULL if the loop never got to it.
+		variable_t *var = find_variable(m, target->id);
+		statement_t stat;
+
+		if (target->decl != NULL) {
+			stat = *(target->decl);
+			stat.declStat.rvalue = (var != NULL) ? new_integer(var->value, var->wide) : NULL;
+		} else if (var != NULL) {
+			exp_t *assign = calloc(1, sizeof(exp_t));
+			assign->type = assign_exp;
+			assign->wide = var->wide;
+			assign->assignExp.id = var->id;
+			assign->assignExp.rvalue = new_integer(var->value, var->wide);
+			stat.type = simple_stat;
+			stat.simpleStat.exp = assign;
+		} else {
+			continue;
+		}
+		stat.line = node->stat.line;
+		insert_statement_before(m->ast, node, stat);
+	}
+	remove_statements(m->ast, node, end);
+
+	free(targets.data);
+}
+
+/******* EXECUTION *******/
+
+// Run the loop of 'node'. If 'once', the loop runs once every time
+// the function runs and it can be replaced with its results.
+internal flow_t run_loop(machine_t *m, statement_node_t *node, int once) {
+	statement_node_t *body_start = node->next;
+	statement_node_t *body_end = block_end(body_start);
+	int prints = m->prints;
+	long long cond;
+
+	for (;;) {
+		if (!evaluate(m, node->stat.whileStat.cond, &cond))
+			return FLOW_FAIL;
+		if (!cond)
+			break;
+		flow_t flow = run_statements(m, body_start->next, body_end, 0);
+		if (flow == FLOW_BREAK)
+			break;
+		if (flow == FLOW_FAIL || flow == FLOW_RETURN)
+			return flow;
+	}
+
+	if (once && m->prints == prints)
+		replace_loop(m, node, body_end);
+	return FLOW_NEXT;
+}
+
+// Run the statements from 'node' up to (not including) 'end'.
+internal flow_t run_statements(machine_t *m, statement_node_t *node, statement_node_t *end, int once) {
+	long long value;
+
+	while (node != end) {
+		statement_t *stat = &(node->stat);
+		// The loop may replace itself.
+		statement_node_t *next = node->next;
+
+		if (stat->type == decl_stat) {
+			value = 0;   // default initialization
+			if (stat->declStat.rvalue != NULL && !evaluate(m, stat->declStat.rvalue, &value))
+				return FLOW_FAIL;
+			declare_variable(m, stat->declStat.id, stat->declStat.wide);
+			variable_t *var = find_variable(m, stat->declStat.id);
+			var->value = convert(value, var->wide);
+		} else if (stat->type == simple_stat || stat->type == print_stat) {
+			if (!evaluate(m, stat->unaryStat.exp, &value))
+				return FLOW_FAIL;
+			if (stat->type == print_stat)
+				++(m->prints);
+		} else if (stat->type == ret_stat) {
+			return FLOW_RETURN;
+		} else if (stat->type == break_stat) {
+			return FLOW_BREAK;
+		} else if (stat->type == cont_stat) {
+			return FLOW_CONTINUE;
+		} else if (stat->type == if_stat) {
+			statement_node_t *then_start = node->next;
+			statement_node_t *then_end = block_end(then_start);
+			statement_node_t *else_start = NULL;
+			statement_node_t *else_end = NULL;
+			next = then_end->next;
+			if (next != NULL && next->stat.type == else_stat) {
+				else_start = next->next;
+				else_end = block_end(else_start);
+				next = else_end->next;
+			}
+
+			if (!evaluate(m, stat->ifStat.cond, &value))
+				return FLOW_FAIL;
+			flow_t flow = FLOW_NEXT;
+			if (value)
+				flow = run_statements(m, then_start->next, then_end, once);
+			else if (else_start != NULL)
+				flow = run_statements(m, else_start->next, else_end, once);
+			if (flow != FLOW_NEXT)
+				return flow;
+		} else if (stat->type == while_stat) {
+			next = block_end(node->next)->next;
+			flow_t flow = run_loop(m, node, once);
+			if (flow != FLOW_NEXT)
+				return flow;
+		}
+		node = next;
+	}
+	return FLOW_NEXT;
+}
+
+void precompute_loops(ast_t *ast, long long steps) {
+	machine_t m = {
+		.ast = ast,
+		.cap = 0,
+		.used = 0,
+		.vars = NULL,
+		.steps = steps,
+		.prints = 0
+	};
+
+	// Skip the function statement.
+	run_statements(&m, ast->root->next, NULL, 1);
+
+	free(m.vars);
+}
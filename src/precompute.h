@@ -0,0 +1,9 @@
+#ifndef PRECOMPUTE_H
+#define PRECOMPUTE_H
+
+#include "types.h"
+
+// 'steps' is how many expressions it may evaluate, in all.
+void precompute_loops(ast_t *, long long steps);
+
+#endif
@@ -0,0 +1,121 @@
+/*******
+Profiles for profile-guided optimization.
+
+HOW IT WORKS:
+The parser numbers the ifs and the whiles of the program in the order of the
+source. With -fprofile-generate, every one of them gets two counters in the
+generated program (see PROFILING in code_generator.c):
+- for an if, how many times it ran and how many times the if block ran,
+- for a while, how many times the loop was reached and how many times the
+  body ran.
+When the program exits, it writes them to the profile file as text:
+
+    dicc-profile <number of branches> <shape>
+    <branch> <runs> <taken>
+    ...
+
+With -fprofile-use, the code generator is given that file back and lays out the
+code for the paths that actually run (see BLOCK LAYOUT and IF-CONVERSION in
+code_generator.c), and the unrolling of loops reads it too (see unroll.c). The
+branches are numbered before any optimization, and the optimizations don't
+add any, so the same profile works for any -O, but not if the source changes.
+The parser also hashes the kinds and lines of the branches into the shape of
+the program, and a profile with a different number of branches or a different
+shape is rejected. The profile is read once, after parsing, and handed to
+both the optimizer and the code generator.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+#include "profile.h"
+
+// Parses the NUL-terminated 'text' into profile->count.
+internal int parse_profile(char *text, int branches, unsigned int shape, profile_t *profile) {
+	char *cp = text;
+	char *end;
+	const char *magic = "dicc-profile";
+
+	if (strncmp(cp, magic, strlen(magic)) != 0)
+		return 0;
+	cp += strlen(magic);
+	if (strtol(cp, &end, 10) != branches || end == cp)
+		return 0;
+	cp = end;
+	if (strtoul(cp, &end, 10) != shape || end == cp)
+		return 0;
+	cp = end;
+
+	for (int i = 0; i < branches; ++i) {
+		long long values[3];
+		for (int j = 0; j < 3; ++j) {
+			values[j] = strtoll(cp, &end, 10);
+			if (end == cp || values[j] < 0)
+				return 0;
+			cp = end;
+		}
+		if (values[0] != i)
+			return 0;
+		profile->count[2 * i] = values[1];
+		profile->count[2 * i + 1] = values[2];
+	}
+	return 1;
+}
+
+int read_profile(const char *data, size_t len, int branches, unsigned int shape, profile_t *profile) {
+	profile->num = 0;
+	// strtoll() needs a NUL-terminated string.
+	char *text = malloc(len + 1);
+	profile->count = calloc(2 * branches + 1, sizeof(long long));
+	if (text == NULL || profile->count == NULL) {
+		free(text);
+		clean_profile(profile);
+		return 0;
+	}
+	memcpy(text, data, len);
+	text[len] = '\0';
+
+	int success = parse_profile(text, branches, shape, profile);
+	free(text);
+	if (!success) {
+		clean_profile(profile);
+		return 0;
+	}
+	profile->num = branches;
+	return 1;
+}
+
+int load_profile(ast_t *ast, const dicc_options *options, profile_t *profile, dicc_sink *sink) {
+	profile->num = 0;
+	profile->count = NULL;
+	if (options->profile_use == NULL)
+		return 1;
+	if (!read_profile(options->profile_use, options->profile_use_len, ast->branches, ast->shape, profile)) {
+		report_error(sink, -1, "The profile is invalid or was made for another program\n");
+		return 0;
+	}
+	return 1;
+}
+
+int branch_counts(profile_t *profile, int branch, long long *runs, long long *taken) {
+	if (profile == NULL || branch < 0 || branch >= profile->num)
+		return 0;
+	*runs = profile->count[2 * branch];
+	*taken = profile->count[2 * branch + 1];
+	return 1;
+}
+
+int taken_percent(profile_t *profile, int branch) {
+	long long runs, taken;
+	if (!branch_counts(profile, branch, &runs, &taken) || runs == 0)
+		return -1;
+	return (int) ((100 * taken) / runs);
+}
+
+void clean_profile(profile_t *profile) {
+	free(profile->count);
+	profile->count = NULL;
+	profile->num = 0;
+}
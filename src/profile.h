@@ -0,0 +1,22 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+
+// Reads the counts that a program built with -fprofile-generate wrote.
+// 'branches' is the number of ifs and whiles of the program it should be
+// for and 'shape' their hash (see ast_t). Returns 0 if the data is
+// malformed or is for another program.
+int read_profile(const char *, size_t, int branches, unsigned int shape, profile_t *);
+// The profile of options->profile_use for 'ast', an empty one if there is
+// none. Returns 0, and reports it, if it doesn't fit the program.
+int load_profile(ast_t *, const dicc_options *, profile_t *, dicc_sink *);
+// How many times the if or while 'branch' ran, and of them how many times
+// it went into its block. Returns 0 if there is no profile.
+int branch_counts(profile_t *, int branch, long long *runs, long long *taken);
+// The percentage of the runs of an if that went into the if block,
+// -1 if there is no profile or the if never ran.
+int taken_percent(profile_t *, int branch);
+void clean_profile(profile_t *);
+
+#endif
@@ -0,0 +1,518 @@
+/*******
+Value range analysis.
+
+HOW IT WORKS:
+It is the constant propagation of fold.c, but instead of a known constant,
+every variable has a range [lo, hi] of the values it can have at that point
+(a constant is a range with one value, and an unknown variable is the range
+of all the integers). The ranges of expressions are computed from the ones of
+their operands, e.g. for a + b it is [lo(a) + lo(b), hi(a) + hi(b)].
+
+Where control flow joins, the ranges of the incoming paths are joined to the
+smallest range that contains all of them. A loop goes over its body until
+the ranges at its start don't change. A range that still grows after a few
+passes is widened to the end (e.g. i = i + 1 makes i go up to the largest
+integer), so that this ends.
+
+The conditions make the ranges smaller: in the body of 'while (i < n)', i is
+less than the largest value of n, and after it, it is at least the smallest.
+The same goes for the branches of an if.
+
+We use what we find in two ways:
+- An expression (that doesn't assign anything) whose range has one value is
+  replaced by it. Mostly, that's a comparison that is always true or always
+  false (like i >= 0 for an i that starts at 0 and only grows), so the
+  branches it decides are removed by the constant folding that follows.
+- Every expression is marked when it is never negative, so the code generator
+  can divide it with unsigned shifts, masks and div, without the corrections
+  that a negative dividend needs.
+
+NOTE: Like C, we assume that the arithmetic on variables doesn't
+overflow, so a result that doesn't fit stops at the smallest or largest integer.
+Without that, i = i + 1 in a loop could make i negative, and we'd know nothing
+about most induction variables.
+
+An int keeps only the lower 32 bits of a long that is assigned to it, so the
+range of an int expression (or variable) that doesn't fit in an int is all
+of the ints. This needs the widths of the expressions (see typing.c).
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "types.h"
+#include "ast.h"
+#include "state.h"
+#include "range.h"
+
+// The integers of the generated code.
+#define RANGE_MIN LLONG_MIN
+#define RANGE_MAX LLONG_MAX
+
+// Loop passes before the ranges that still grow are widened.
+#define PASSES_BEFORE_WIDENING 3
+
+typedef struct {
+	long long lo;
+	long long hi;
+} range_t;
+
+typedef struct {
+	int transform;        // change the AST, or just compute the states
+	state_t *breaks;      // join of the states at the breaks of the current loop
+	state_t *continues;   // same for the continues
+} analysis_t;
+
+global_var const range_t full = { RANGE_MIN, RANGE_MAX };
+
+internal range_t make_range(__int128 lo, __int128 hi) {
+	range_t range;
+	range.lo = (lo < RANGE_MIN) ? RANGE_MIN : (lo > RANGE_MAX) ? RANGE_MAX : (long long) lo;
+	range.hi = (hi < RANGE_MIN) ? RANGE_MIN : (hi > RANGE_MAX) ? RANGE_MAX : (long long) hi;
+	return range;
+}
+
+// The range of an expression of the width 'wide', whose value is in 'range'.
+internal range_t in_width(range_t range, int wide) {
+	if (!wide && (range.lo < INT_MIN || range.hi > INT_MAX))
+		return make_range(INT_MIN, INT_MAX);
+	return range;
+}
+
+internal range_t boolean(int can_be_false, int can_be_true) {
+	return make_range(can_be_false ? 0 : 1, can_be_true ? 1 : 0);
+}
+
+// The variables that are not in a state (see state.c) can have any value.
+internal range_t lookup(state_t *state, char *id) {
+	range_t *range = find_binding(state, id);
+	return (range != NULL) ? *range : full;
+}
+
+// dst = dst join src
+internal void join_state(state_t *dst, state_t *src) {
+	if (!src->reachable)
+		return;
+	if (!dst->reachable) {
+		clean_state(dst);
+		copy_state(dst, src);
+		return;
+	}
+	for (int i = 0; i < dst->used; ++i) {
+		range_t *a = state_value(dst, i);
+		range_t b = lookup(src, dst->ids[i]);
+		a->lo = (a->lo < b.lo) ? a->lo : b.lo;
+		a->hi = (a->hi > b.hi) ? a->hi : b.hi;
+	}
+}
+
+// The ranges of 'next' that grew since 'prev' go all the way.
+internal void widen_state(state_t *next, state_t *prev) {
+	for (int i = 0; i < next->used; ++i) {
+		range_t *range = state_value(next, i);
+		range_t old = lookup(prev, next->ids[i]);
+		if (range->lo < old.lo)
+			range->lo = RANGE_MIN;
+		if (range->hi > old.hi)
+			range->hi = RANGE_MAX;
+	}
+}
+
+internal int same_range(const void *a, const void *b) {
+	const range_t *x = a, *y = b;
+	return x->lo == y->lo && x->hi == y->hi;
+}
+
+internal long long magnitude(range_t range) {
+	__int128 lo = range.lo, hi = range.hi;
+	__int128 m = (-lo > hi) ? -lo : hi;
+	return (m > RANGE_MAX) ? RANGE_MAX : (long long) m;
+}
+
+internal range_t compute_unary(char *operator, range_t operand) {
+	__int128 lo = operand.lo, hi = operand.hi;
+	if (operator[0] == '-')
+		return make_range(-hi, -lo);
+	if (operator[0] == '~')
+		return make_range(-hi - 1, -lo - 1);
+	if (operator[0] == '!')
+		return boolean(operand.lo != 0 || operand.hi != 0, operand.lo <= 0 && operand.hi >= 0);
+	return full;
+}
+
+internal range_t compute_comparison(char *operator, range_t l, range_t r) {
+	// Whether it can be true and whether it can be false.
+	if (!strcmp(operator, "<"))
+		return boolean(l.hi >= r.lo, l.lo < r.hi);
+	if (!strcmp(operator, "<="))
+		return boolean(l.hi > r.lo, l.lo <= r.hi);
+	if (!strcmp(operator, ">"))
+		return boolean(l.lo <= r.hi, l.hi > r.lo);
+	if (!strcmp(operator, ">="))
+		return boolean(l.lo < r.hi, l.hi >= r.lo);
+	int disjoint = (l.hi < r.lo || r.hi < l.lo);
+	int same = (l.lo == l.hi && r.lo == r.hi && l.lo == r.lo);
+	if (!strcmp(operator, "=="))
+		return boolean(!same, !disjoint);
+	return boolean(!disjoint, !same);   // !=
+}
+
+internal range_t compute_binary(char *operator, range_t left, range_t right) {
+	__int128 l1 = left.lo, h1 = left.hi, l2 = right.lo, h2 = right.hi;
+
+	if (!strcmp(operator, "&&") || !strcmp(operator, "||")) {
+		int left_false = (left.lo <= 0 && left.hi >= 0);
+		int left_true = (left.lo != 0 || left.hi != 0);
+		int right_false = (right.lo <= 0 && right.hi >= 0);
+		int right_true = (right.lo != 0 || right.hi != 0);
+		if (operator[0] == '&')
+			return boolean(left_false || right_false, left_true && right_true);
+		return boolean(left_false && right_false, left_true || right_true);
+	}
+
+	switch (operator[0]) {
+		case '+': return make_range(l1 + l2, h1 + h2);
+		case '-': return make_range(l1 - h2, h1 - l2);
+		case '*': {
+			__int128 p[4] = { l1 * l2, l1 * h2, h1 * l2, h1 * h2 };
+			__int128 lo = p[0], hi = p[0];
+			for (int i = 1; i < 4; ++i) {
+				lo = (p[i] < lo) ? p[i] : lo;
+				hi = (p[i] > hi) ? p[i] : hi;
+			}
+			return make_range(lo, hi);
+		}
+		case '/': {
+			if (left.lo >= 0 && right.lo >= 0)
+				return make_range(0, h1);
+			if (right.lo > 0 || right.hi < 0) {
+				// Monotonic in each operand, so the ends
+				// are among the quotients of the ends.
+				__int128 q[4] = { l1 / l2, l1 / h2, h1 / l2, h1 / h2 };
+				__int128 lo = q[0], hi = q[0];
+				for (int i = 1; i < 4; ++i) {
+					lo = (q[i] < lo) ? q[i] : lo;
+					hi = (q[i] > hi) ? q[i] : hi;
+				}
+				return make_range(lo, hi);
+			}
+			__int128 m = magnitude(left);
+			return make_range(-m, m);
+		}
+		case '%': {
+			// Smaller than the divisor, and with the sign of the dividend.
+			__int128 m = magnitude(right) - 1;
+			if (m < 0)
+				m = 0;
+			if (left.lo >= 0)
+				return make_range(0, (h1 < m) ? h1 : m);
+			if (left.hi <= 0)
+				return make_range((l1 > -m) ? l1 : -m, 0);
+			return make_range(-m, m);
+		}
+	}
+	// A comparison
+	return compute_comparison(operator, left, right);
+}
+
+// Compute the range of 'exp' and, if we're transforming, mark its
+// non-negative parts and replace the parts that have a single value.
+// Assignments inside the expression are not applied to the state,
+// the caller takes care of them.
+internal range_t compute_range(analysis_t *analysis, state_t *state, exp_t *exp) {
+	range_t range = full;
+
+	if (exp->type == int_exp) {
+		range = make_range(exp->intExp, exp->intExp);
+	} else if (exp->type == id_exp) {
+		range = lookup(state, exp->id);
+	} else if (exp->type == unary_exp) {
+		range_t operand = compute_range(analysis, state, exp->unaryExp.operand);
+		range = compute_unary(exp->unaryExp.operator, operand);
+	} else if (exp->type == bin_exp) {
+		range_t left = compute_range(analysis, state, exp->binExp.leftOperand);
+		range_t right = compute_range(analysis, state, exp->binExp.rightOperand);
+		range = compute_binary(exp->binExp.operator, left, right);
+	} else if (exp->type == assign_exp) {
+		range = compute_range(analysis, state, exp->assignExp.rvalue);
+	}
+	range = in_width(range, exp->wide);
+
+	if (analysis->transform) {
+		exp->nonnegative = (range.lo >= 0);
+		if (range.lo == range.hi && range.lo >= INT_MIN && range.lo <= INT_MAX &&
+			exp->type != int_exp && !has_side_effects(exp)) {
+			clean_expression(exp);
+			exp->type = int_exp;
+			exp->intExp = (int) range.lo;
+		}
+	}
+	return range;
+}
+
+// Compute the range of the expression of a statement and apply its assignments.
+internal range_t compute_full_range(analysis_t *analysis, state_t *state, exp_t *exp) {
+	// The usual 'x = e', where 'e' doesn't assign anything.
+	if (exp->type == assign_exp && !has_side_effects(exp->assignExp.rvalue)) {
+		range_t range = in_width(compute_range(analysis, state, exp->assignExp.rvalue), exp->wide);
+		if (analysis->transform)
+			exp->nonnegative = (range.lo >= 0);
+		bind(state, exp->assignExp.id, &range);
+		return range;
+	}
+	// NOTE: Otherwise, the order in which the assignments
+	// happen is up to the code generator, so forget everything they
+	// touch, before and after.
+	kill_assigned(state, exp, &full);
+	range_t range = compute_range(analysis, state, exp);
+	kill_assigned(state, exp, &full);
+	return range;
+}
+
+// Make the range of 'id' smaller, [lo, hi] at most.
+internal void restrict_variable(state_t *state, char *id, __int128 lo, __int128 hi) {
+	range_t range = lookup(state, id);
+	if (lo > range.lo)
+		range.lo = (lo > RANGE_MAX) ? RANGE_MAX : (long long) lo;
+	if (hi < range.hi)
+		range.hi = (hi < RANGE_MIN) ? RANGE_MIN : (long long) hi;
+	if (range.lo > range.hi || lo > RANGE_MAX || hi < RANGE_MIN)
+		// No value makes the condition hold.
+		state->reachable = 0;
+	else
+		bind(state, id, &range);
+}
+
+internal char *mirrored_comparison(char *operator) {
+	if (!strcmp(operator, "<"))
+		return ">";
+	if (!strcmp(operator, "<="))
+		return ">=";
+	if (!strcmp(operator, ">"))
+		return "<";
+	if (!strcmp(operator, ">="))
+		return "<=";
+	return operator;
+}
+
+// 'id <operator> other' is 'truth'.
+internal void restrict_comparison(state_t *state, char *id, char *operator, range_t other, int truth) {
+	const char *negated[][2] = {
+		{ "<", ">=" }, { "<=", ">" }, { ">", "<=" }, { ">=", "<" }, { "==", "!=" }, { "!=", "==" }
+	};
+	if (!truth) {
+		for (int i = 0; i < 6; ++i) {
+			if (!strcmp(operator, negated[i][0])) {
+				operator = (char *) negated[i][1];
+				break;
+			}
+		}
+	}
+
+	__int128 lo = other.lo, hi = other.hi;
+	if (!strcmp(operator, "<"))
+		restrict_variable(state, id, RANGE_MIN, hi - 1);
+	else if (!strcmp(operator, "<="))
+		restrict_variable(state, id, RANGE_MIN, hi);
+	else if (!strcmp(operator, ">"))
+		restrict_variable(state, id, lo + 1, RANGE_MAX);
+	else if (!strcmp(operator, ">="))
+		restrict_variable(state, id, lo, RANGE_MAX);
+	else if (!strcmp(operator, "=="))
+		restrict_variable(state, id, lo, hi);
+}
+
+// Make the ranges of 'state' smaller, knowing that the value of
+// 'cond' is 'truth' (non-zero or zero). 'cond' doesn't assign anything.
+internal void restrict_condition(state_t *state, exp_t *cond, int truth) {
+	analysis_t analysis = { .transform = 0 };
+
+	range_t range = compute_range(&analysis, state, cond);
+	if ((truth && range.lo == 0 && range.hi == 0) || (!truth && (range.lo > 0 || range.hi < 0))) {
+		// It can't have that value.
+		state->reachable = 0;
+		return;
+	}
+
+	if (cond->type == unary_exp && cond->unaryExp.operator[0] == '!') {
+		restrict_condition(state, cond->unaryExp.operand, !truth);
+	} else if (cond->type == id_exp) {
+		if (!truth)
+			restrict_variable(state, cond->id, 0, 0);
+	} else if (cond->type == bin_exp) {
+		char *operator = cond->binExp.operator;
+		exp_t *left = cond->binExp.leftOperand;
+		exp_t *right = cond->binExp.rightOperand;
+		// Both of them are true, or both false.
+		if ((operator[0] == '&' && truth) || (operator[0] == '|' && operator[1] == '|' && !truth)) {
+			restrict_condition(state, left, truth);
+			if (state->reachable)
+				restrict_condition(state, right, truth);
+		} else if (strchr("<>=!", operator[0])) {
+			range_t left_range = compute_range(&analysis, state, left);
+			range_t right_range = compute_range(&analysis, state, right);
+			if (left->type == id_exp)
+				restrict_comparison(state, left->id, operator, right_range, truth);
+			if (right->type == id_exp && state->reachable)
+				restrict_comparison(state, right->id, mirrored_comparison(operator), left_range, truth);
+		}
+	}
+}
+
+internal void analyze_statements(analysis_t *, state_t *, statement_node_t *, statement_node_t *);
+
+internal statement_node_t *analyze_if(analysis_t *analysis, state_t *state, statement_node_t *node) {
+	statement_node_t *then_start = node->next;
+	statement_node_t *then_end = block_end(then_start);
+	statement_node_t *else_start = NULL;
+	statement_node_t *else_end = NULL;
+
+	if (then_end->next != NULL && then_end->next->stat.type == else_stat) {
+		else_start = then_end->next->next;
+		else_end = block_end(else_start);
+	}
+	statement_node_t *after = (else_start != NULL) ? else_end->next : then_end->next;
+
+	exp_t *cond = node->stat.ifStat.cond;
+	compute_full_range(analysis, state, cond);
+	state_t else_state;
+	copy_state(&else_state, state);
+	if (!has_side_effects(cond)) {
+		restrict_condition(state, cond, 1);
+		restrict_condition(&else_state, cond, 0);
+	}
+
+	analyze_statements(analysis, state, then_start->next, then_end);
+	if (else_start != NULL)
+		analyze_statements(analysis, &else_state, else_start->next, else_end);
+	join_state(state, &else_state);
+	clean_state(&else_state);
+
+	return after;
+}
+
+// One pass over the loop, starting from 'header' (the state before the
+// condition). Leaves in 'body' the state at the end of the body and in
+// 'exit' the state after the loop.
+internal void analyze_loop_pass(analysis_t *analysis, statement_node_t *node, state_t *header,
+								state_t *body, state_t *exit) {
+	statement_node_t *body_start = node->next;
+	statement_node_t *body_end = block_end(body_start);
+	exp_t *cond = node->stat.whileStat.cond;
+
+	state_t *saved_breaks = analysis->breaks;
+	state_t *saved_continues = analysis->continues;
+	state_t breaks, continues;
+	initialize_state(&breaks, 0, sizeof(range_t));
+	initialize_state(&continues, 0, sizeof(range_t));
+	analysis->breaks = &breaks;
+	analysis->continues = &continues;
+
+	copy_state(body, header);
+	compute_full_range(analysis, body, cond);
+	copy_state(exit, body);
+	if (!has_side_effects(cond)) {
+		restrict_condition(body, cond, 1);
+		restrict_condition(exit, cond, 0);
+	}
+
+	analyze_statements(analysis, body, body_start->next, body_end);
+
+	join_state(body, &continues);
+	join_state(exit, &breaks);
+
+	clean_state(&breaks);
+	clean_state(&continues);
+	analysis->breaks = saved_breaks;
+	analysis->continues = saved_continues;
+}
+
+internal statement_node_t *analyze_while(analysis_t *analysis, state_t *state, statement_node_t *node) {
+	statement_node_t *body_end = block_end(node->next);
+	statement_node_t *after = body_end->next;
+	state_t header, body, exit;
+
+	// Find the state at the start of an iteration.
+	int transform = analysis->transform;
+	analysis->transform = 0;
+	copy_state(&header, state);
+	for (int pass = 1; ; ++pass) {
+		analyze_loop_pass(analysis, node, &header, &body, &exit);
+		join_state(&body, state);
+		join_state(&body, &header);
+		if (pass >= PASSES_BEFORE_WIDENING)
+			widen_state(&body, &header);
+		clean_state(&exit);
+		int done = same_state(&body, &header, same_range, &full);
+		move_state(&header, &body);
+		if (done)
+			break;
+	}
+	analysis->transform = transform;
+
+	// And now the real pass.
+	analyze_loop_pass(analysis, node, &header, &body, &exit);
+
+	move_state(state, &exit);
+	clean_state(&header);
+	clean_state(&body);
+
+	return after;
+}
+
+// Analyze the statements from 'node' up to (not including) 'end'.
+internal void analyze_statements(analysis_t *analysis, state_t *state, statement_node_t *node,
+								 statement_node_t *end) {
+	while (node != end) {
+		statement_t *stat = &(node->stat);
+
+		if (!state->reachable) {
+			node = node->next;
+			continue;
+		}
+
+		if (stat->type == decl_stat) {
+			range_t range = make_range(0, 0);   // default initialization
+			if (stat->declStat.rvalue != NULL)
+				range = in_width(compute_full_range(analysis, state, stat->declStat.rvalue),
+								 stat->declStat.wide);
+			else if (stat->declStat.uninitialized)
+				range = full;
+			bind(state, stat->declStat.id, &range);
+		} else if (stat->type == simple_stat || stat->type == print_stat) {
+			compute_full_range(analysis, state, stat->unaryStat.exp);
+		} else if (stat->type == ret_stat) {
+			compute_full_range(analysis, state, stat->retStat.exp);
+			state->reachable = 0;
+		} else if (stat->type == break_stat || stat->type == cont_stat) {
+			// Invalid ones are reported by the code generator.
+			state_t *target = (stat->type == break_stat) ? analysis->breaks : analysis->continues;
+			if (target != NULL)
+				join_state(target, state);
+			state->reachable = 0;
+		} else if (stat->type == if_stat) {
+			node = analyze_if(analysis, state, node);
+			continue;
+		} else if (stat->type == while_stat) {
+			node = analyze_while(analysis, state, node);
+			continue;
+		}
+		node = node->next;
+	}
+}
+
+void analyze_ranges(ast_t *ast) {
+	analysis_t analysis = {
+		.transform = 1,
+		.breaks = NULL,
+		.continues = NULL
+	};
+	state_t state;
+	initialize_state(&state, 1, sizeof(range_t));
+
+	// Skip the function statement.
+	analyze_statements(&analysis, &state, ast->root->next, NULL);
+
+	clean_state(&state);
+}
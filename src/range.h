@@ -0,0 +1,8 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include "types.h"
+
+void analyze_ranges(ast_t *);
+
+#endif
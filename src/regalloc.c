@@ -0,0 +1,334 @@
+/*******
+Register allocation for the local variables.
+
+HOW IT WORKS:
+It is the linear-scan algorithm of Poletto and Sarkar. Every statement of
+the function gets a number (its position in the statement list) and every
+variable gets a live range, from its declaration to the last statement
+that reads or writes it. A variable that is used inside a loop but was
+declared before it, is live until the end of the loop, because the next
+iteration may need its value.
+
+Then we walk the ranges in the order they start, keeping which range
+holds each register. A range gets a free register if there is one. If not,
+of all the candidates (the ones currently holding a register, plus the new
+one), the one with the smallest weight stays in memory. The weight of a
+variable is the number of times it is used, where a use inside a loop
+counts 10 times more than a use outside of it (so it's the nesting depth
+that decides who stays in a register).
+
+Since variables have function scope and their address is never taken,
+a variable that got a register lives there for its entire range.
+
+The variables that stay in memory get a slot of the frame each, 8 bytes
+for a long and 4 for an int, so that twice as many ints fit in a cache line.
+The longs go first, so that every slot is aligned to its size.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "regalloc.h"
+
+// The callee-saved registers survive the call of a print statement, but
+// the function has to save and restore them. The caller-saved ones are
+// free, but can only hold variables that don't live across a call.
+// None of them is used for the evaluation of expressions.
+// rbp is one more, if it's not the frame pointer (-fomit-frame-pointer).
+#define NUM_CALLEE_SAVED 6
+#define NUM_ALLOCATABLE 8
+#define RBP 5
+
+global_var const char *allocatable[NUM_ALLOCATABLE] = {
+	"rbx", "r12", "r13", "r14", "r15", "rbp",   // callee-saved
+	"r9", "r10"                                 // caller-saved
+};
+
+// Deeper loops than that don't make any difference.
+#define MAX_WEIGHT_DEPTH 6
+
+typedef struct {
+	int start;   // the while statement
+	int level;   // block nesting level of its body
+} open_loop_t;
+
+typedef struct {
+	allocation_t *alloc;
+	int depth;        // loop nesting depth of the current statement
+	int *calls;       // positions of the print statements
+	int calls_used;
+	int calls_cap;
+} scan_t;
+
+internal int find_range(allocation_t *alloc, char *id) {
+	for (int i = 0; i < alloc->used; ++i) {
+		if (!strcmp(alloc->data[i].id, id))
+			return i;
+	}
+	return -1;
+}
+
+internal long use_weight(int depth) {
+	long weight = 1;
+	if (depth > MAX_WEIGHT_DEPTH)
+		depth = MAX_WEIGHT_DEPTH;
+	while (depth--)
+		weight *= 10;
+	return weight;
+}
+
+internal void use_variable(scan_t *scan, char *id, int pos) {
+	int index = find_range(scan->alloc, id);
+	// Undeclared variables are reported by the code generator.
+	if (index == -1)
+		return;
+	live_range_t *range = &(scan->alloc->data[index]);
+	range->weight += use_weight(scan->depth);
+	if (pos > range->end)
+		range->end = pos;
+}
+
+internal void use_expression(scan_t *scan, exp_t *exp, int pos) {
+	if (exp == NULL)
+		return;
+	if (exp->type == id_exp) {
+		use_variable(scan, exp->id, pos);
+	} else if (exp->type == unary_exp) {
+		use_expression(scan, exp->unaryExp.operand, pos);
+	} else if (exp->type == bin_exp) {
+		use_expression(scan, exp->binExp.leftOperand, pos);
+		use_expression(scan, exp->binExp.rightOperand, pos);
+	} else if (exp->type == assign_exp) {
+		use_expression(scan, exp->assignExp.rvalue, pos);
+		use_variable(scan, exp->assignExp.id, pos);
+	}
+}
+
+internal void declare_variable(scan_t *scan, char *id, int pos, int wide) {
+	allocation_t *alloc = scan->alloc;
+
+	// Redeclarations are reported by the code generator.
+	if (find_range(alloc, id) != -1)
+		return;
+
+	if (alloc->used >= alloc->cap) {
+		alloc->cap = (alloc->cap) ? 2 * alloc->cap : 16;
+		alloc->data = realloc(alloc->data, alloc->cap * sizeof(live_range_t));
+	}
+	live_range_t *range = &(alloc->data[alloc->used]);
+	range->id = id;
+	range->start = pos;
+	range->end = pos;
+	range->weight = use_weight(scan->depth);
+	range->calls = 0;
+	range->reg = -1;
+	range->wide = wide;
+	range->slot = -1;
+	alloc->used += 1;
+}
+
+// The loop that started at 'start' ends at 'end'. Everything that was
+// declared before it and used inside it, has to stay alive until its end.
+internal void close_loop(scan_t *scan, int start, int end) {
+	allocation_t *alloc = scan->alloc;
+	for (int i = 0; i < alloc->used; ++i) {
+		live_range_t *range = &(alloc->data[i]);
+		if (range->start < start && range->end >= start && range->end < end)
+			range->end = end;
+	}
+}
+
+// Compute the live ranges, in the order they start.
+internal void compute_live_ranges(scan_t *scan, ast_t *ast) {
+	int blocks = 0;
+	int loops_used = 0;
+	int loops_cap = 8;
+	open_loop_t *loops = malloc(loops_cap * sizeof(open_loop_t));
+
+	int pos = 0;
+	for (statement_node_t *node = ast->root; node != NULL; node = node->next, ++pos) {
+		statement_t *stat = &(node->stat);
+
+		if (stat->type == decl_stat) {
+			use_expression(scan, stat->declStat.rvalue, pos);
+			declare_variable(scan, stat->declStat.id, pos, stat->declStat.wide);
+		} else if (stat->type == ret_stat || stat->type == simple_stat) {
+			use_expression(scan, stat->unaryStat.exp, pos);
+		} else if (stat->type == print_stat) {
+			use_expression(scan, stat->printStat.exp, pos);
+			if (scan->calls_used >= scan->calls_cap) {
+				scan->calls_cap = (scan->calls_cap) ? 2 * scan->calls_cap : 16;
+				scan->calls = realloc(scan->calls, scan->calls_cap * sizeof(int));
+			}
+			scan->calls[(scan->calls_used)++] = pos;
+		} else if (stat->type == if_stat) {
+			use_expression(scan, stat->ifStat.cond, pos);
+		} else if (stat->type == while_stat) {
+			// The condition is evaluated in every iteration,
+			// so it is part of the loop.
+			if (loops_used >= loops_cap) {
+				loops_cap *= 2;
+				loops = realloc(loops, loops_cap * sizeof(open_loop_t));
+			}
+			loops[loops_used].start = pos;
+			loops[loops_used].level = blocks + 1;
+			++loops_used;
+			scan->depth += 1;
+			use_expression(scan, stat->whileStat.cond, pos);
+		} else if (stat->type == start_block) {
+			blocks += 1;
+		} else if (stat->type == end_block) {
+			if (loops_used && loops[loops_used - 1].level == blocks) {
+				--loops_used;
+				close_loop(scan, loops[loops_used].start, pos);
+				scan->depth -= 1;
+			}
+			blocks -= 1;
+		}
+	}
+
+	// Mark the ranges that a call happens inside of.
+	for (int i = 0; i < scan->alloc->used; ++i) {
+		live_range_t *range = &(scan->alloc->data[i]);
+		for (int c = 0; c < scan->calls_used; ++c) {
+			// A variable read by the print itself is
+			// not needed after the call.
+			if (range->start < scan->calls[c] && scan->calls[c] < range->end)
+				range->calls = 1;
+		}
+	}
+
+	free(loops);
+}
+
+internal int usable(allocation_t *alloc, int reg) {
+	return reg != RBP || alloc->free_rbp;
+}
+
+internal int free_register(allocation_t *alloc, int *active, int calls) {
+	// Prefer the caller-saved registers, as the
+	// callee-saved ones cost a save and a restore.
+	if (!calls) {
+		for (int reg = NUM_CALLEE_SAVED; reg < NUM_ALLOCATABLE; ++reg) {
+			if (active[reg] == -1)
+				return reg;
+		}
+	}
+	for (int reg = 0; reg < NUM_CALLEE_SAVED; ++reg) {
+		if (active[reg] == -1 && usable(alloc, reg))
+			return reg;
+	}
+	return -1;
+}
+
+internal void linear_scan(allocation_t *alloc) {
+	// Range that holds each register, -1 if it's free.
+	int active[NUM_ALLOCATABLE];
+	for (int reg = 0; reg < NUM_ALLOCATABLE; ++reg)
+		active[reg] = -1;
+
+	for (int i = 0; i < alloc->used; ++i) {
+		live_range_t *range = &(alloc->data[i]);
+
+		// Expire the ranges that have ended.
+		for (int reg = 0; reg < NUM_ALLOCATABLE; ++reg) {
+			if (active[reg] != -1 && alloc->data[active[reg]].end < range->start)
+				active[reg] = -1;
+		}
+
+		int reg = free_register(alloc, active, range->calls);
+		if (reg == -1) {
+			// Everything is taken. Find the cheapest range that
+			// holds a register this one can use, and if it is
+			// cheaper than this one, take its register.
+			int limit = (range->calls) ? NUM_CALLEE_SAVED : NUM_ALLOCATABLE;
+			int victim = 0;
+			for (int r = 1; r < limit; ++r) {
+				if (usable(alloc, r) &&
+					alloc->data[active[r]].weight < alloc->data[active[victim]].weight)
+					victim = r;
+			}
+			if (alloc->data[active[victim]].weight < range->weight) {
+				alloc->data[active[victim]].reg = -1;
+				reg = victim;
+			}
+		}
+
+		if (reg != -1) {
+			active[reg] = i;
+			range->reg = reg;
+		}
+	}
+}
+
+// Give the spilled ranges their slots, the longs first.
+internal void lay_out_slots(allocation_t *alloc) {
+	int offset = 0;
+	for (int wide = 1; wide >= 0; --wide) {
+		for (int i = 0; i < alloc->used; ++i) {
+			live_range_t *range = &(alloc->data[i]);
+			if (range->reg == -1 && range->wide == wide) {
+				range->slot = offset;
+				offset += (wide) ? 8 : 4;
+			}
+		}
+	}
+	alloc->spill_size = (offset + 7) & ~7;
+}
+
+void allocate_registers(ast_t *ast, allocation_t *alloc, int free_rbp) {
+	alloc->cap = 0;
+	alloc->used = 0;
+	alloc->data = NULL;
+	alloc->free_rbp = free_rbp;
+	alloc->spill_size = 0;
+
+	scan_t scan = {
+		.alloc = alloc,
+		.depth = 0,
+		.calls = NULL,
+		.calls_used = 0,
+		.calls_cap = 0
+	};
+
+	compute_live_ranges(&scan, ast);
+	linear_scan(alloc);
+	lay_out_slots(alloc);
+
+	free(scan.calls);
+}
+
+const char *allocated_register(allocation_t *alloc, char *id) {
+	int index = find_range(alloc, id);
+	if (index == -1 || alloc->data[index].reg == -1)
+		return NULL;
+	return allocatable[alloc->data[index].reg];
+}
+
+int saved_registers(allocation_t *alloc, const char **regs) {
+	int num = 0;
+	for (int reg = 0; reg < NUM_CALLEE_SAVED; ++reg) {
+		for (int i = 0; i < alloc->used; ++i) {
+			if (alloc->data[i].reg == reg) {
+				regs[num++] = allocatable[reg];
+				break;
+			}
+		}
+	}
+	return num;
+}
+
+int spilled_slot(allocation_t *alloc, char *id) {
+	int index = find_range(alloc, id);
+	return (index == -1) ? -1 : alloc->data[index].slot;
+}
+
+int spill_size(allocation_t *alloc) {
+	return alloc->spill_size;
+}
+
+void clean_allocation(allocation_t *alloc) {
+	if (alloc && alloc->data)
+		free(alloc->data);
+}
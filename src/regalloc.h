@@ -0,0 +1,21 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "types.h"
+
+// Upper bound of the registers returned by saved_registers().
+#define MAX_SAVED_REGISTERS 6
+
+// If the last argument is set, rbp can also hold variables.
+void allocate_registers(ast_t *, allocation_t *, int);
+// Register of a variable, NULL if it lives on the stack.
+const char *allocated_register(allocation_t *, char *);
+// Callee-saved registers that the function has to preserve.
+int saved_registers(allocation_t *, const char **);
+// Offset of the slot of a variable that lives on the stack.
+int spilled_slot(allocation_t *, char *);
+// Bytes of the frame that the variables on the stack take, a multiple of 8.
+int spill_size(allocation_t *);
+void clean_allocation(allocation_t *);
+
+#endif
@@ -10,39 +10,38 @@ TODO
 
 #include "types.h"
 
-#define REG_SIZE 8    // AMD64 Architecture
-
 void initialize_table(table_t *table) {
 	table->cap = 10;
 	table->used = 0;
 	table->data = malloc(table->cap * sizeof(symbol_t));
-	table->stack_top = 0;
-}
-
-// NOTE(stefanos): Currently, we compile for 64bit architectures,
-// meaning that by default, registers are 8 bytes (and so when
-// we push them, we use 8 bytes from the stack memory).
-void increment_stack_top(table_t *table) {
-	table->stack_top += REG_SIZE;
 }
 
-void decrement_stack_top(table_t *table) {
-	table->stack_top -= REG_SIZE;
-}
-
-int is_stack_aligned(table_t *table, int a) {
-	return (table->stack_top % a == 0);
+// The variable lives in the slot at the offset 'slot' of the frame.
+void insert(table_t *table, char *id, int line, int slot, int wide) {
+	if(table->used >= table->cap) {
+		table->cap *= 2;
+		table->data = realloc(table->data, table->cap * sizeof(symbol_t));
+	}
+	table->data[table->used].id = id;
+	table->data[table->used].line = line;
+	table->data[table->used].slot = slot;
+	table->data[table->used].reg = NULL;
+	table->data[table->used].wide = wide;
+	table->used += 1;
 }
 
-void insert(table_t *table, char *id, int line) {
+// Same as insert(), but the variable lives in 'reg'
+// and doesn't take any stack space.
+void insert_register(table_t *table, char *id, int line, const char *reg, int wide) {
 	if(table->used >= table->cap) {
 		table->cap *= 2;
 		table->data = realloc(table->data, table->cap * sizeof(symbol_t));
 	}
 	table->data[table->used].id = id;
 	table->data[table->used].line = line;
-	increment_stack_top(table);
-	table->data[table->used].offset = table->stack_top;
+	table->data[table->used].slot = -1;
+	table->data[table->used].reg = reg;
+	table->data[table->used].wide = wide;
 	table->used += 1;
 }
 
@@ -2,10 +2,8 @@
 #define SYMBOL_TABLE_H
 
 void initialize_table(table_t *);
-void increment_stack_top(table_t *);
-int is_stack_aligned(table_t *, int);
-void decrement_stack_top(table_t *);
-void insert(table_t *, char *, int);
+void insert(table_t *, char *, int, int, int);
+void insert_register(table_t *, char *, int, const char *, int);
 int search(table_t *, char *);
 void clean_table(table_t *);
 
@@ -0,0 +1,497 @@
+/*******
+Instruction scheduling.
+
+HOW IT WORKS:
+The code generator emits the instructions in the order it walks the
+expressions, so an instruction that needs a result comes right after the
+one that computes it. For most instructions that doesn't matter, as their
+result is ready in the next cycle, but a division takes tens of cycles, a
+load 4-5 and a multiplication 3. The CPU can fill the wait only with
+instructions that it has already decoded and that don't depend on the slow one,
+so it helps to have the independent work early.
+
+We take one basic block at a time (the instructions between two labels,
+jumps or calls) and find which instruction has to stay after which:
+- it reads a register (or the flags) that the other writes, and then it
+  has to wait for the latency of the other,
+- it writes one that the other reads or writes, so it only has to come after,
+- both access the same memory and one of them writes it. Slots of the frame
+  at different offsets and a slot and a global are different memory.
+Then we simulate the issue of the block on a simple model of a core, close to
+the Skylake and Zen ones: 4 instructions per cycle, of which at most 2 loads,
+1 store, 1 multiplication and 1 division, and the divider isn't pipelined,
+so it takes no other division for a while. Every cycle, of the instructions
+whose operands are ready, the ones with the longest path (in cycles) to the
+end of the block go first. The order they issued in is the new order.
+
+NOTE: The registers are allocated already and we don't rename them.
+Every register holds the same values as before, so a new order can never
+need more registers than the allocator handed out. The price is that nothing
+moves past a reuse of its registers, and rax is reused a lot.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "types.h"
+#include "utils.h"
+#include "schedule.h"
+
+// Bit i of a set of registers is registers[i] (see utils.h),
+// and FLAGS is the bit after them.
+#define RAX (1u << 0)
+#define RDX (1u << 3)
+#define FLAGS (1u << NUM_REGISTERS)
+
+// The execution units of the model and how many
+// instructions each of them takes in a cycle.
+typedef enum { UNIT_ALU, UNIT_LOAD, UNIT_STORE, UNIT_MUL, UNIT_DIV, NUM_UNITS } unit_t;
+global_var const int unit_width[NUM_UNITS] = { 4, 2, 1, 1, 1 };
+#define ISSUE_WIDTH 4
+
+// Latencies in cycles, roughly the ones of Agner Fog's tables for
+// Skylake and Zen 2.
+#define LATENCY_ALU 1
+#define LATENCY_LOAD 5     // from the L1 cache, also of a store to a load
+#define LATENCY_IMUL 3
+#define LATENCY_MULX 4
+#define LATENCY_XCHG 2
+#define LATENCY_DIV32 26
+#define LATENCY_DIV64 40
+// Cycles after a division before the divider takes another one.
+#define DIV_BUSY 20
+
+// The longest block we schedule at once, longer ones are cut.
+#define MAX_BLOCK 128
+// The longest instruction we understand.
+#define MAX_LINE 128
+
+// Where an instruction accesses memory: symbol[base + disp].
+typedef struct {
+	int known;          // 0 if the address isn't a base and a constant
+	char symbol[32];    // a global, empty for the frame
+	char base[8];
+	long disp;
+	int version;        // of the base register, the writes to it before
+} location_t;
+
+typedef struct {
+	const char *line;
+	size_t len;
+	unsigned int reads;    // registers and flags
+	unsigned int writes;
+	int loads;
+	int stores;
+	location_t mem;
+	unit_t unit;
+	int latency;           // until the result can be used
+
+	// While scheduling.
+	int height;            // cycles from its issue to the end of the block
+	int preds;             // instructions it waits for that haven't issued
+	int earliest;          // the first cycle its operands are ready
+	int done;
+} instr_t;
+
+// The registers that appear in 'text'.
+internal unsigned int registers_in(const char *text) {
+	unsigned int set = 0;
+	for (const char *c = text; *c; ++c) {
+		// At the start of a word.
+		if (c != text && (isalnum(c[-1]) || c[-1] == '_'))
+			continue;
+		for (int i = 0; i < NUM_REGISTERS; ++i) {
+			for (int size = 0; size < 3; ++size) {
+				size_t len = strlen(registers[i][size]);
+				if (!strncmp(c, registers[i][size], len) && !isalnum(c[len]) && c[len] != '_')
+					set |= 1u << i;
+			}
+		}
+	}
+	return set;
+}
+
+internal int is_memory(const char *operand) {
+	return strchr(operand, '[') != NULL;
+}
+
+// Parse the address of a memory operand, like [rsp + 8] or counts[rip + 16].
+internal void parse_location(const char *operand, location_t *mem) {
+	const char *open = strchr(operand, '[');
+	size_t symbol_len = open - operand;
+	char sign = '+';
+
+	mem->known = 0;
+	if (symbol_len >= sizeof(mem->symbol))
+		return;
+	memcpy(mem->symbol, operand, symbol_len);
+	mem->symbol[symbol_len] = '\0';
+
+	const char *c = open + 1;
+	size_t base_len = 0;
+	while (isalnum(c[base_len]))
+		++base_len;
+	if (base_len == 0 || base_len >= sizeof(mem->base))
+		return;
+	memcpy(mem->base, c, base_len);
+	mem->base[base_len] = '\0';
+	c += base_len;
+
+	mem->disp = 0;
+	while (*c == ' ')
+		++c;
+	if (*c == '+' || *c == '-') {
+		sign = *(c++);
+		char *end;
+		mem->disp = strtol(c, &end, 10);
+		if (end == c)
+			return;   // an index register
+		if (sign == '-')
+			mem->disp = -mem->disp;
+		c = end;
+	}
+	mem->known = (*c == ']');
+}
+
+// Whether two accesses can touch the same bytes. The frame and the
+// globals don't overlap, and no access is larger than 8 bytes.
+internal int may_alias(location_t *a, location_t *b) {
+	if (!a->known || !b->known)
+		return 1;
+	if ((a->symbol[0] != '\0') != (b->symbol[0] != '\0'))
+		return 0;
+	if (strcmp(a->symbol, b->symbol) || strcmp(a->base, b->base))
+		return a->symbol[0] == '\0';   // rsp and rbp can point to the same frame
+	// The base may point elsewhere after it's written.
+	return a->version != b->version || labs(a->disp - b->disp) < 8;
+}
+
+internal const char *strip_size(const char *operand) {
+	const char *sizes[] = { "qword ptr ", "dword ptr ", "word ptr ", "byte ptr " };
+	for (int i = 0; i < 4; ++i) {
+		if (!strncmp(operand, sizes[i], strlen(sizes[i])))
+			return operand + strlen(sizes[i]);
+	}
+	return operand;
+}
+
+// The instruction reads 'src' (a register, a memory operand or a constant).
+internal void read_operand(instr_t *in, const char *src) {
+	in->reads |= registers_in(src);
+	if (is_memory(src)) {
+		in->loads = 1;
+		parse_location(src, &(in->mem));
+	}
+}
+
+// The instruction writes 'dst', and also reads it if 'modifies'.
+internal void write_operand(instr_t *in, const char *dst, int modifies) {
+	if (is_memory(dst)) {
+		in->reads |= registers_in(dst);
+		in->stores = 1;
+		in->loads = in->loads || modifies;
+		parse_location(dst, &(in->mem));
+		return;
+	}
+	int reg = register_index(dst);
+	if (reg == -1)
+		return;
+	in->writes |= 1u << reg;
+	// Writing the low byte keeps the rest of the register.
+	if (modifies || !strcmp(dst, registers[reg][2]))
+		in->reads |= 1u << reg;
+}
+
+// Fill in what 'text' reads and writes. Returns 0 for anything that
+// has to stay where it is (labels, jumps, calls, pushes, directives etc.).
+internal int parse_instruction(char *text, instr_t *in) {
+	char *operand[3];
+	int num = 0;
+
+	in->reads = in->writes = 0;
+	in->loads = in->stores = 0;
+	in->mem.known = 0;
+	in->unit = UNIT_ALU;
+	in->latency = LATENCY_ALU;
+
+	char *space = strchr(text, ' ');
+	if (space != NULL) {
+		*space = '\0';
+		char *c = space + 1;
+		while (num < 3) {
+			operand[num++] = (char *) strip_size(c);
+			c = strchr(c, ',');
+			if (c == NULL)
+				break;
+			*(c++) = '\0';
+			while (*c == ' ')
+				++c;
+		}
+		if (c != NULL)
+			return 0;
+	}
+	// Only registers, memory and constants.
+	for (int i = 0; i < num; ++i) {
+		if (!is_memory(operand[i]) && register_index(operand[i]) == -1 &&
+			!isdigit(operand[i][0]) && operand[i][0] != '-')
+			return 0;
+	}
+	const char *op = text;
+
+	if ((!strcmp(op, "mov") || !strcmp(op, "movzx") || !strcmp(op, "movsxd")) && num == 2) {
+		read_operand(in, operand[1]);
+		write_operand(in, operand[0], 0);
+	} else if (!strcmp(op, "lea") && num == 2 && is_memory(operand[1])) {
+		// It only computes the address.
+		in->reads |= registers_in(operand[1]);
+		write_operand(in, operand[0], 0);
+	} else if ((!strcmp(op, "add") || !strcmp(op, "sub") || !strcmp(op, "and") ||
+				!strcmp(op, "or") || !strcmp(op, "xor") || !strcmp(op, "shl") ||
+				!strcmp(op, "shr") || !strcmp(op, "sar") || !strcmp(op, "imul")) && num == 2) {
+		// xor and sub of a register with itself don't depend on its value.
+		int zeroes = (!strcmp(op, "xor") || !strcmp(op, "sub")) && !strcmp(operand[0], operand[1]);
+		if (!zeroes)
+			read_operand(in, operand[1]);
+		write_operand(in, operand[0], !zeroes);
+		in->writes |= FLAGS;
+		if (!strcmp(op, "imul")) {
+			in->unit = UNIT_MUL;
+			in->latency = LATENCY_IMUL;
+		}
+	} else if (!strcmp(op, "imul") && num == 3) {
+		read_operand(in, operand[1]);
+		write_operand(in, operand[0], 0);
+		in->writes |= FLAGS;
+		in->unit = UNIT_MUL;
+		in->latency = LATENCY_IMUL;
+	} else if (!strcmp(op, "imul") && num == 1) {
+		// rdx:rax = rax * operand
+		read_operand(in, operand[0]);
+		in->reads |= RAX;
+		in->writes |= RAX | RDX | FLAGS;
+		in->unit = UNIT_MUL;
+		in->latency = LATENCY_IMUL;
+	} else if (!strcmp(op, "mulx") && num == 3) {
+		// operand 0 : operand 1 = rdx * operand 2, and the flags stay.
+		read_operand(in, operand[2]);
+		in->reads |= RDX;
+		write_operand(in, operand[0], 0);
+		write_operand(in, operand[1], 0);
+		in->unit = UNIT_MUL;
+		in->latency = LATENCY_MULX;
+	} else if ((!strcmp(op, "cmp") || !strcmp(op, "test")) && num == 2) {
+		read_operand(in, operand[0]);
+		read_operand(in, operand[1]);
+		in->writes |= FLAGS;
+	} else if ((!strcmp(op, "neg") || !strcmp(op, "not") || !strcmp(op, "inc") ||
+				!strcmp(op, "dec")) && num == 1) {
+		write_operand(in, operand[0], 1);
+		in->writes |= FLAGS;
+	} else if (!strncmp(op, "set", 3) && num == 1) {
+		write_operand(in, operand[0], 0);
+		in->reads |= FLAGS;
+	} else if (!strncmp(op, "cmov", 4) && num == 2) {
+		read_operand(in, operand[1]);
+		write_operand(in, operand[0], 1);
+		in->reads |= FLAGS;
+	} else if ((!strcmp(op, "idiv") || !strcmp(op, "div")) && num == 1) {
+		// rax = rdx:rax / operand, rdx = rdx:rax % operand
+		read_operand(in, operand[0]);
+		in->reads |= RAX | RDX;
+		in->writes |= RAX | RDX | FLAGS;
+		in->unit = UNIT_DIV;
+		int reg = register_index(operand[0]);
+		int is32 = (reg != -1 && !strcmp(operand[0], registers[reg][1]));
+		in->latency = (is32) ? LATENCY_DIV32 : LATENCY_DIV64;
+	} else if ((!strcmp(op, "cdq") || !strcmp(op, "cqo")) && num == 0) {
+		in->reads |= RAX;
+		in->writes |= RDX;
+	} else if (!strcmp(op, "xchg") && num == 2 && !is_memory(operand[0]) && !is_memory(operand[1])) {
+		write_operand(in, operand[0], 1);
+		write_operand(in, operand[1], 1);
+		in->latency = LATENCY_XCHG;
+	} else {
+		return 0;
+	}
+
+	if (in->loads && in->unit == UNIT_ALU)
+		in->unit = (in->stores) ? UNIT_STORE : UNIT_LOAD;
+	else if (in->stores && in->unit == UNIT_ALU)
+		in->unit = UNIT_STORE;
+	if (in->loads)
+		in->latency += LATENCY_LOAD;
+	return 1;
+}
+
+// The cycles that 'later' has to issue after 'earlier', or -1 if
+// they can go in any order.
+internal int dependency(instr_t *earlier, instr_t *later) {
+	int wait = -1;
+
+	if (earlier->writes & later->reads)
+		wait = earlier->latency;
+	else if ((earlier->writes | earlier->reads) & later->writes)
+		wait = 0;
+
+	if (((earlier->stores && (later->loads || later->stores)) || (earlier->loads && later->stores)) &&
+		may_alias(&(earlier->mem), &(later->mem))) {
+		int through_memory = (earlier->stores && later->loads) ? LATENCY_LOAD : 0;
+		if (through_memory > wait)
+			wait = through_memory;
+	}
+	return wait;
+}
+
+// Schedule the 'n' instructions of 'block' and put them in 'order'.
+// Returns whether the order changed.
+internal int schedule_block(instr_t *block, int n, int *order) {
+	int *wait = malloc(n * n * sizeof(int));
+
+	for (int i = n - 1; i >= 0; --i) {
+		block[i].height = block[i].latency;
+		block[i].preds = 0;
+		block[i].earliest = 0;
+		block[i].done = 0;
+		for (int j = i + 1; j < n; ++j) {
+			wait[i * n + j] = dependency(&block[i], &block[j]);
+			if (wait[i * n + j] != -1 && wait[i * n + j] + block[j].height > block[i].height)
+				block[i].height = wait[i * n + j] + block[j].height;
+		}
+	}
+	for (int i = 0; i < n; ++i) {
+		for (int j = i + 1; j < n; ++j) {
+			if (wait[i * n + j] != -1)
+				++(block[j].preds);
+		}
+	}
+
+	int count = 0;
+	int cycle = 0;
+	int divider_free = 0;   // the first cycle the divider can take a division
+	while (count < n) {
+		int used[NUM_UNITS] = { 0 };
+		for (int issued = 0; issued < ISSUE_WIDTH; ++issued) {
+			int best = -1;
+			for (int i = 0; i < n; ++i) {
+				instr_t *in = &block[i];
+				if (in->done || in->preds || in->earliest > cycle ||
+					used[in->unit] == unit_width[in->unit] ||
+					(in->unit == UNIT_DIV && divider_free > cycle))
+					continue;
+				// Ties go to the first in the source.
+				if (best == -1 || in->height > block[best].height)
+					best = i;
+			}
+			if (best == -1)
+				break;
+
+			instr_t *in = &block[best];
+			in->done = 1;
+			order[count++] = best;
+			++(used[in->unit]);
+			if (in->unit == UNIT_DIV)
+				divider_free = cycle + DIV_BUSY;
+			for (int j = best + 1; j < n; ++j) {
+				if (wait[best * n + j] == -1)
+					continue;
+				--(block[j].preds);
+				if (cycle + wait[best * n + j] > block[j].earliest)
+					block[j].earliest = cycle + wait[best * n + j];
+			}
+		}
+		++cycle;
+	}
+	free(wait);
+
+	for (int i = 0; i < n; ++i) {
+		if (order[i] != i)
+			return 1;
+	}
+	return 0;
+}
+
+typedef struct {
+	char *data;
+	size_t len;
+	int blocks;
+	int reordered;
+} output_t;
+
+internal void write_line(output_t *out, const char *line, size_t len) {
+	memcpy(out->data + out->len, line, len);
+	out->len += len;
+	out->data[(out->len)++] = '\n';
+}
+
+internal void flush_block(output_t *out, instr_t *block, int n) {
+	int order[MAX_BLOCK];
+	if (n == 0)
+		return;
+	++(out->blocks);
+	if (n > 1 && schedule_block(block, n, order)) {
+		++(out->reordered);
+		for (int i = 0; i < n; ++i)
+			write_line(out, block[order[i]].line, block[order[i]].len);
+	} else {
+		for (int i = 0; i < n; ++i)
+			write_line(out, block[i].line, block[i].len);
+	}
+}
+
+void schedule(gen_t *gen) {
+	instr_t block[MAX_BLOCK];
+	int n = 0;
+	int versions[NUM_REGISTERS] = { 0 };
+	// Every line comes out once, with a newline.
+	output_t out = { malloc(gen->out_len + 1), 0, 0, 0 };
+
+	size_t start = 0;
+	while (start < gen->out_len) {
+		size_t end = start;
+		while (end < gen->out_len && gen->out[end] != '\n')
+			++end;
+		const char *line = gen->out + start;
+		size_t len = end - start;
+		start = end + 1;
+
+		char text[MAX_LINE];
+		instr_t in;
+		int understood = 0;
+		if (len < sizeof(text)) {
+			memcpy(text, line, len);
+			text[len] = '\0';
+			understood = parse_instruction(text, &in);
+		}
+		if (!understood) {
+			flush_block(&out, block, n);
+			n = 0;
+			write_line(&out, line, len);
+			continue;
+		}
+		if (in.mem.known) {
+			int base = register_index(in.mem.base);
+			in.mem.version = (base != -1) ? versions[base] : 0;
+		}
+		for (int i = 0; i < NUM_REGISTERS; ++i) {
+			if (in.writes & (1u << i))
+				++(versions[i]);
+		}
+		if (n == MAX_BLOCK) {
+			flush_block(&out, block, n);
+			n = 0;
+		}
+		in.line = line;
+		in.len = len;
+		block[n++] = in;
+	}
+	flush_block(&out, block, n);
+
+	free(gen->out);
+	gen->out = out.data;
+	gen->out_len = out.len;
+	gen->out_cap = out.len + 1;
+
+	if (out.reordered)
+		report_note(gen->sink, "schedule: reordered %d of %d blocks\n", out.reordered, out.blocks);
+}
@@ -0,0 +1,10 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "types.h"
+
+// Reorders the instructions of every basic block in the buffer of the
+// generator, so that the slow ones start as early as they can.
+void schedule(gen_t *);
+
+#endif
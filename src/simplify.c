@@ -0,0 +1,464 @@
+/*******
+Algebraic simplification of the expressions.
+
+HOW IT WORKS:
+Every expression is rewritten bottom-up, so when we look at an operator,
+its operands are already simplified. There are three kinds of rewrites:
+
+- Identities: x + 0, x * 1, x - x, x * 0, - - x, ~ ~ x, !!x etc. Nothing is
+  dropped if it has side effects (an assignment that wouldn't happen).
+
+- Reassociation: a chain of additions and subtractions (or of
+  multiplications) is flattened into a list of terms (factors). All the
+  constants among them are combined into one, which goes last, so that
+  the code generator can use it as a factor / divisor etc.
+  E.g. 3 + a - 1 + b becomes (a + b) + 2.
+
+- Balancing: the parser builds left-deep trees, so a + b + c + d is
+  ((a + b) + c) + d, where every addition has to wait for the previous one.
+  We rebuild the terms as a balanced tree, (a + b) + (c + d), in which the
+  two inner additions are independent. A balanced tree with 2^n leaves needs
+  n + 1 registers (see select_tiles()), so we build balanced trees of
+  up to MAX_BALANCED_LEAVES leaves and chain those, to not run out of
+  scratch registers.
+
+NOTE: The order of evaluation of the operands is decided by the
+code generator, so the reassociation doesn't lose anything. Still, chains
+with an assignment in them are left as they are, as moving a variable
+from one side of the assignment to the other would change its value.
+A chain is also only as long as its operations have the same width (see
+typing.c): the ints in a chain of longs are computed in long, so two of
+them can't be combined as ints, which could overflow. The nodes that we build
+have the width of what they replace, and a long never becomes an int.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "types.h"
+#include "ast.h"
+#include "simplify.h"
+
+// 8 leaves need 4 registers, and chaining the trees needs one
+// more to keep the result so far. That's all of the scratch registers.
+#define MAX_BALANCED_LEAVES 8
+
+typedef struct {
+	int cap;
+	int used;
+	exp_t **data;
+} exp_list_t;
+
+typedef struct {
+	char operator;        // '+' or '*'
+	exp_list_t terms;     // subtracted ones are in 'negated'
+	exp_list_t negated;
+	exp_list_t nodes;     // the nodes of the chain itself, including the constants
+	long long constant;
+	int constants;        // how many constants were combined
+	int overflow;         // the combined constant doesn't fit in an int
+	int wide;             // the operations are done in long
+} chain_t;
+
+internal void add_to_list(exp_list_t *list, exp_t *exp) {
+	if (list->used >= list->cap) {
+		list->cap = (list->cap) ? 2 * list->cap : 8;
+		list->data = realloc(list->data, list->cap * sizeof(exp_t *));
+	}
+	list->data[(list->used)++] = exp;
+}
+
+internal exp_t *new_integer(long long value, int wide) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = int_exp;
+	exp->intExp = (int) value;
+	exp->wide = wide;
+	return exp;
+}
+
+internal exp_t *new_unary(char *operator, exp_t *operand, int wide) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = unary_exp;
+	exp->unaryExp.operator = operator;
+	exp->unaryExp.operand = operand;
+	exp->wide = wide;
+	return exp;
+}
+
+internal exp_t *new_binary(char *operator, exp_t *left, exp_t *right, int wide) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = bin_exp;
+	exp->binExp.operator = operator;
+	exp->binExp.leftOperand = left;
+	exp->binExp.rightOperand = right;
+	exp->wide = wide;
+	return exp;
+}
+
+// Free an expression along with everything below it.
+internal void free_expression(exp_t *exp) {
+	clean_expression(exp);
+	free(exp);
+}
+
+internal int is_integer(exp_t *exp, long long value) {
+	return exp->type == int_exp && exp->intExp == value;
+}
+
+internal int is_operator(exp_t *exp, char *operator) {
+	if (exp->type == bin_exp)
+		return !strcmp(exp->binExp.operator, operator);
+	if (exp->type == unary_exp)
+		return !strcmp(exp->unaryExp.operator, operator);
+	return 0;
+}
+
+internal char *inverted_relational(char *operator) {
+	if (!strcmp(operator, "<"))  return ">=";
+	if (!strcmp(operator, "<=")) return ">";
+	if (!strcmp(operator, ">"))  return "<=";
+	if (!strcmp(operator, ">=")) return "<";
+	if (!strcmp(operator, "==")) return "!=";
+	if (!strcmp(operator, "!=")) return "==";
+	return NULL;
+}
+
+internal int is_relational(char *operator) {
+	return inverted_relational(operator) != NULL;
+}
+
+// Whether the value of 'exp' is always 0 or 1.
+internal int is_boolean(exp_t *exp) {
+	if (exp->type == int_exp)
+		return exp->intExp == 0 || exp->intExp == 1;
+	if (exp->type == unary_exp)
+		return exp->unaryExp.operator[0] == '!';
+	if (exp->type == bin_exp) {
+		char *operator = exp->binExp.operator;
+		return is_relational(operator) || !strcmp(operator, "&&") || !strcmp(operator, "||");
+	}
+	return 0;
+}
+
+// Replace '*exp' with 'with', which is one of its operands.
+// The rest of the expression is freed. A variable that is an int can't
+// replace a long, as it would make the operations on it ints. Returns
+// whether it was replaced.
+internal int replace_with_operand(exp_t **exp, exp_t *with) {
+	exp_t *old = *exp;
+	if (old->wide && !with->wide) {
+		if (with->type == id_exp || with->type == assign_exp)
+			return 0;
+		with->wide = 1;
+	}
+	if (old->type == bin_exp) {
+		if (old->binExp.leftOperand != with)
+			free_expression(old->binExp.leftOperand);
+		if (old->binExp.rightOperand != with)
+			free_expression(old->binExp.rightOperand);
+	}
+	free(old);
+	*exp = with;
+	return 1;
+}
+
+internal void replace_with_integer(exp_t **exp, long long value) {
+	int wide = (*exp)->wide;
+	free_expression(*exp);
+	*exp = new_integer(value, wide);
+}
+
+/******* REASSOCIATION *******/
+
+internal void combine_constant(chain_t *chain, long long value) {
+	chain->constants += 1;
+	if (chain->overflow)
+		return;
+	if (chain->operator == '+')
+		chain->constant += value;
+	else
+		chain->constant *= value;
+	if (chain->constant < INT_MIN || chain->constant > INT_MAX)
+		chain->overflow = 1;
+}
+
+// 'negated' is set if the term is subtracted (only for sums).
+internal void flatten(chain_t *chain, exp_t *exp, int negated) {
+	if (exp->type != int_exp && exp->wide != chain->wide) {
+		// A term of its own.
+		add_to_list((negated) ? &(chain->negated) : &(chain->terms), exp);
+	} else if (chain->operator == '+' && exp->type == bin_exp &&
+		(is_operator(exp, "+") || is_operator(exp, "-"))) {
+		add_to_list(&(chain->nodes), exp);
+		int minus = (exp->binExp.operator[0] == '-');
+		flatten(chain, exp->binExp.leftOperand, negated);
+		flatten(chain, exp->binExp.rightOperand, (minus) ? !negated : negated);
+	} else if (chain->operator == '*' && exp->type == bin_exp && is_operator(exp, "*")) {
+		add_to_list(&(chain->nodes), exp);
+		flatten(chain, exp->binExp.leftOperand, 0);
+		flatten(chain, exp->binExp.rightOperand, 0);
+	} else if (exp->type == unary_exp && is_operator(exp, "-")) {
+		// -x is a subtracted term, or a factor of -1.
+		add_to_list(&(chain->nodes), exp);
+		if (chain->operator == '*') {
+			combine_constant(chain, -1);
+			chain->constants -= 1;   // not a constant of the source
+			flatten(chain, exp->unaryExp.operand, 0);
+		} else {
+			flatten(chain, exp->unaryExp.operand, !negated);
+		}
+	} else if (exp->type == int_exp) {
+		add_to_list(&(chain->nodes), exp);
+		combine_constant(chain, (negated) ? -(long long) exp->intExp : exp->intExp);
+	} else {
+		add_to_list((negated) ? &(chain->negated) : &(chain->terms), exp);
+	}
+}
+
+internal exp_t *balanced_tree(char *operator, exp_t **terms, int n, int wide) {
+	if (n == 1)
+		return terms[0];
+	int half = n / 2;
+	return new_binary(operator, balanced_tree(operator, terms, half, wide),
+					  balanced_tree(operator, terms + half, n - half, wide), wide);
+}
+
+// Combine the terms with 'operator', NULL if there are none.
+internal exp_t *build_tree(char *operator, exp_list_t *list, int wide) {
+	exp_t *tree = NULL;
+	for (int i = 0; i < list->used; i += MAX_BALANCED_LEAVES) {
+		int n = list->used - i;
+		if (n > MAX_BALANCED_LEAVES)
+			n = MAX_BALANCED_LEAVES;
+		exp_t *part = balanced_tree(operator, list->data + i, n, wide);
+		tree = (tree == NULL) ? part : new_binary(operator, tree, part, wide);
+	}
+	return tree;
+}
+
+internal exp_t *build_sum(chain_t *chain) {
+	int wide = chain->wide;
+	exp_t *positive = build_tree("+", &(chain->terms), wide);
+	exp_t *negative = build_tree("+", &(chain->negated), wide);
+	long long constant = chain->constant;
+	exp_t *sum;
+
+	if (positive == NULL && negative == NULL)
+		return new_integer(constant, wide);
+
+	if (positive == NULL) {
+		// c - n is better than -n + c
+		if (constant != 0)
+			return new_binary("-", new_integer(constant, wide), negative, wide);
+		return new_unary("-", negative, wide);
+	}
+
+	sum = positive;
+	if (negative != NULL)
+		sum = new_binary("-", sum, negative, wide);
+	if (constant > 0 || constant == INT_MIN)
+		sum = new_binary("+", sum, new_integer(constant, wide), wide);
+	else if (constant < 0)
+		sum = new_binary("-", sum, new_integer(-constant, wide), wide);
+	return sum;
+}
+
+internal exp_t *build_product(chain_t *chain) {
+	int wide = chain->wide;
+	exp_t *product = build_tree("*", &(chain->terms), wide);
+	long long constant = chain->constant;
+
+	if (product == NULL)
+		return new_integer(constant, wide);
+	if (constant == -1)
+		return new_unary("-", product, wide);
+	if (constant != 1)
+		product = new_binary("*", product, new_integer(constant, wide), wide);
+	return product;
+}
+
+internal void clean_chain(chain_t *chain) {
+	free(chain->terms.data);
+	free(chain->negated.data);
+	free(chain->nodes.data);
+}
+
+internal void reassociate(exp_t **exp, char operator) {
+	chain_t chain = {
+		.operator = operator,
+		.constant = (operator == '+') ? 0 : 1,
+		.wide = (*exp)->wide,
+	};
+
+	if (has_side_effects(*exp))
+		return;
+
+	flatten(&chain, *exp, 0);
+
+	int leaves = chain.terms.used + chain.negated.used;
+	// A product with a zero constant is zero (no side effects, see above).
+	int zero = (operator == '*' && chain.constants && chain.constant == 0);
+	// A constant on the left of a commutative operator.
+	int constant_first = (chain.constants == 1 && (*exp)->type == bin_exp &&
+		(*exp)->binExp.operator[0] == operator && (*exp)->binExp.leftOperand->type == int_exp);
+	// NOTE: Chains of two leaves are already as good as they get,
+	// unless there's something to be combined, removed or moved.
+	int worth = zero || constant_first || chain.constants > 1 || leaves > 2 ||
+		(chain.constants == 1 && chain.constant == ((operator == '+') ? 0 : 1)) ||
+		(operator == '+' && chain.terms.used == 0 && chain.negated.used > 1);
+	if (chain.overflow || !worth) {
+		clean_chain(&chain);
+		return;
+	}
+
+	exp_t *result;
+	if (zero) {
+		// Free the terms too.
+		for (int i = 0; i < chain.terms.used; ++i)
+			free_expression(chain.terms.data[i]);
+		result = new_integer(0, chain.wide);
+	} else {
+		result = (operator == '+') ? build_sum(&chain) : build_product(&chain);
+	}
+
+	// The old chain nodes were replaced. Their operands (the terms)
+	// now belong to the new tree, so free just the nodes.
+	for (int i = 0; i < chain.nodes.used; ++i)
+		free(chain.nodes.data[i]);
+	*exp = result;
+
+	clean_chain(&chain);
+}
+
+/******* IDENTITIES *******/
+
+// The same comparison with the operands swapped.
+internal char *swapped_relational(char *operator) {
+	if (!strcmp(operator, "<"))  return ">";
+	if (!strcmp(operator, "<=")) return ">=";
+	if (!strcmp(operator, ">"))  return "<";
+	if (!strcmp(operator, ">=")) return "<=";
+	return operator;
+}
+
+internal void simplify(exp_t **exp, int condition);
+
+// 'condition' is set when only whether the value is zero or
+// not matters (e.g. the condition of an if).
+internal void simplify_unary(exp_t **exp, int condition) {
+	exp_t *unary = *exp;
+	char operator = unary->unaryExp.operator[0];
+	simplify(&(unary->unaryExp.operand), operator == '!');
+	exp_t *operand = unary->unaryExp.operand;
+
+	if (operand->type == int_exp && operator != '+') {
+		long long value = operand->intExp;
+		value = (operator == '-') ? -value : (operator == '~') ? ~value : !value;
+		if (value >= INT_MIN && value <= INT_MAX)
+			replace_with_integer(exp, value);
+	} else if ((operator == '-' || operator == '~') && operand->type == unary_exp &&
+		is_operator(operand, unary->unaryExp.operator)) {
+		// - - x = x, ~ ~ x = x
+		*exp = operand->unaryExp.operand;
+		free(operand);
+		free(unary);
+	} else if (operator == '-' && (is_operator(operand, "+") || is_operator(operand, "-"))) {
+		reassociate(exp, '+');
+	} else if (operator == '-' && is_operator(operand, "*")) {
+		reassociate(exp, '*');
+	} else if (operator == '!' && operand->type == bin_exp && inverted_relational(operand->binExp.operator)) {
+		// !(a < b) = a >= b
+		operand->binExp.operator = inverted_relational(operand->binExp.operator);
+		*exp = operand;
+		free(unary);
+	} else if (operator == '!' && is_operator(operand, "!") && (condition || is_boolean(operand->unaryExp.operand))) {
+		// !!x = x, if x is 0 or 1, or we only care if it's zero.
+		*exp = operand->unaryExp.operand;
+		free(operand);
+		free(unary);
+	}
+}
+
+internal void simplify_binary(exp_t **exp, int condition) {
+	exp_t *bin = *exp;
+	char *operator = bin->binExp.operator;
+	int logical = (!strcmp(operator, "&&") || !strcmp(operator, "||"));
+
+	simplify(&(bin->binExp.leftOperand), logical);
+	simplify(&(bin->binExp.rightOperand), logical);
+	exp_t *left = bin->binExp.leftOperand;
+	exp_t *right = bin->binExp.rightOperand;
+
+	switch (operator[0]) {
+	case '+':
+	case '-':
+		if (operator[0] == '-' && same_expression(left, right) && !has_side_effects(left)) {
+			replace_with_integer(exp, 0);
+			return;
+		}
+		reassociate(exp, '+');
+		return;
+	case '*':
+		reassociate(exp, '*');
+		return;
+	case '/':
+	case '%':
+		if (right->type == int_exp && (right->intExp == 1 || right->intExp == -1)) {
+			int negate = (right->intExp == -1);
+			if (operator[0] == '%') {
+				if (!has_side_effects(left))
+					replace_with_integer(exp, 0);
+			} else if (replace_with_operand(exp, left) && negate) {
+				*exp = new_unary("-", left, left->wide);
+			}
+		}
+		return;
+	}
+
+	if (logical) {
+		// x && 1 and x || 0 are x, if it is 0 or 1 or we only care if it's zero.
+		// And x && 0 is 0, x || 1 is 1.
+		long long neutral = (operator[0] == '&') ? 1 : 0;
+		if (is_integer(right, !neutral) && !has_side_effects(left))
+			replace_with_integer(exp, !neutral);
+		else if (is_integer(right, neutral) && (condition || is_boolean(left)))
+			replace_with_operand(exp, left);
+		else if (is_integer(left, neutral) && (condition || is_boolean(right)))
+			replace_with_operand(exp, right);
+		return;
+	}
+
+	if (is_relational(operator)) {
+		if (condition && !strcmp(operator, "!=") && is_integer(right, 0)) {
+			// if (x != 0) is if (x)
+			replace_with_operand(exp, left);
+		} else if (left->type == int_exp && right->type != int_exp) {
+			// Constants go to the right.
+			bin->binExp.operator = swapped_relational(operator);
+			bin->binExp.leftOperand = right;
+			bin->binExp.rightOperand = left;
+		}
+	}
+}
+
+internal void simplify(exp_t **exp, int condition) {
+	if ((*exp)->type == unary_exp)
+		simplify_unary(exp, condition);
+	else if ((*exp)->type == bin_exp)
+		simplify_binary(exp, condition);
+	else if ((*exp)->type == assign_exp)
+		simplify(&((*exp)->assignExp.rvalue), 0);
+}
+
+void simplify_expressions(ast_t *ast) {
+	for (statement_node_t *node = ast->root; node != NULL; node = node->next) {
+		statement_t *stat = &(node->stat);
+		if (stat->type == ret_stat || stat->type == print_stat || stat->type == simple_stat)
+			simplify(&(stat->unaryStat.exp), 0);
+		else if (stat->type == decl_stat && stat->declStat.rvalue != NULL)
+			simplify(&(stat->declStat.rvalue), 0);
+		else if (stat->type == if_stat || stat->type == while_stat)
+			simplify(&(stat->ifStat.cond), 1);
+	}
+}
@@ -0,0 +1,8 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "types.h"
+
+void simplify_expressions(ast_t *);
+
+#endif
@@ -0,0 +1,106 @@
+/*******
+The states of the forward analyses (the constant folding and the value ranges).
+
+HOW IT WORKS:
+A state is a list of the variables with what the analysis knows about them,
+which is opaque here: the values are 'size' bytes each, in one array, in
+the order of the variables. The analyses wrap the lookups and the bindings
+with their own value types, and meet (or join) the states themselves.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "state.h"
+
+void initialize_state(state_t *state, int reachable, int size) {
+	state->reachable = reachable;
+	state->size = size;
+	state->cap = 0;
+	state->used = 0;
+	state->ids = NULL;
+	state->values = NULL;
+}
+
+void clean_state(state_t *state) {
+	free(state->ids);
+	free(state->values);
+	state->ids = NULL;
+	state->values = NULL;
+	state->used = state->cap = 0;
+}
+
+void copy_state(state_t *dst, state_t *src) {
+	*dst = *src;
+	dst->cap = src->used;
+	dst->ids = NULL;
+	dst->values = NULL;
+	if (src->used) {
+		dst->ids = malloc(src->used * sizeof(char *));
+		memcpy(dst->ids, src->ids, src->used * sizeof(char *));
+		dst->values = malloc(src->used * src->size);
+		memcpy(dst->values, src->values, src->used * src->size);
+	}
+}
+
+void move_state(state_t *dst, state_t *src) {
+	clean_state(dst);
+	*dst = *src;
+	src->ids = NULL;
+	src->values = NULL;
+	src->used = src->cap = 0;
+}
+
+void *state_value(state_t *state, int i) {
+	return state->values + i * state->size;
+}
+
+void *find_binding(state_t *state, char *id) {
+	for (int i = 0; i < state->used; ++i) {
+		if (!strcmp(state->ids[i], id))
+			return state_value(state, i);
+	}
+	return NULL;
+}
+
+void bind(state_t *state, char *id, const void *value) {
+	void *binding = find_binding(state, id);
+	if (binding == NULL) {
+		if (state->used >= state->cap) {
+			state->cap = (state->cap) ? 2 * state->cap : 16;
+			state->ids = realloc(state->ids, state->cap * sizeof(char *));
+			state->values = realloc(state->values, state->cap * state->size);
+		}
+		state->ids[state->used] = id;
+		binding = state_value(state, (state->used)++);
+	}
+	memcpy(binding, value, state->size);
+}
+
+// Whether every variable of 'a' has the same value in 'b'.
+internal int included(state_t *a, state_t *b, same_value_fn same, const void *unknown) {
+	for (int i = 0; i < a->used; ++i) {
+		void *value = find_binding(b, a->ids[i]);
+		if (!same(state_value(a, i), (value != NULL) ? value : unknown))
+			return 0;
+	}
+	return 1;
+}
+
+int same_state(state_t *a, state_t *b, same_value_fn same, const void *unknown) {
+	return a->reachable == b->reachable && included(a, b, same, unknown) &&
+		included(b, a, same, unknown);
+}
+
+void kill_assigned(state_t *state, exp_t *exp, const void *unknown) {
+	if (exp->type == assign_exp) {
+		kill_assigned(state, exp->assignExp.rvalue, unknown);
+		bind(state, exp->assignExp.id, unknown);
+	} else if (exp->type == unary_exp) {
+		kill_assigned(state, exp->unaryExp.operand, unknown);
+	} else if (exp->type == bin_exp) {
+		kill_assigned(state, exp->binExp.leftOperand, unknown);
+		kill_assigned(state, exp->binExp.rightOperand, unknown);
+	}
+}
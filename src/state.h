@@ -0,0 +1,37 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "types.h"
+
+// What a forward analysis knows about every variable at some point of the
+// program (see fold.c and range.c). Every variable is bound to a value of
+// 'size' bytes, whose meaning is up to the analysis. The ones that are not
+// bound have the value of a variable the analysis knows nothing about.
+typedef struct {
+	int reachable;
+	int size;
+	int cap;
+	int used;
+	char **ids;
+	char *values;
+} state_t;
+
+// Whether two values of a state are the same.
+typedef int (*same_value_fn)(const void *, const void *);
+
+void initialize_state(state_t *, int reachable, int size);
+void clean_state(state_t *);
+void copy_state(state_t *dst, state_t *src);
+// Replace 'dst' with 'src' (which is consumed).
+void move_state(state_t *dst, state_t *src);
+// The value of the i-th binding.
+void *state_value(state_t *, int i);
+// The value of 'id', NULL if it isn't bound.
+void *find_binding(state_t *, char *id);
+void bind(state_t *, char *id, const void *value);
+// 'unknown' is the value of the variables that are not bound.
+int same_state(state_t *, state_t *, same_value_fn, const void *unknown);
+// All the variables assigned inside 'exp' become 'unknown'.
+void kill_assigned(state_t *, exp_t *, const void *unknown);
+
+#endif
@@ -0,0 +1,95 @@
+/*******
+Selection of the instruction set extensions (-march).
+
+HOW IT WORKS:
+Without -march, the generated code runs on any x86_64: it can only use the
+instructions of the first AMD64 processors, which include cmov. An -march
+name is a list of the extensions that the code can assume, like the
+processors of gcc (haswell, znver2 etc.) or the x86-64-v2/v3 levels. For
+-march=native we ask the processor that the compiler runs on, with cpuid.
+Only the extensions that the code generator has a use for are tracked:
+- BMI2: mulx, a multiplication that takes its operand in rdx and writes
+  any two registers, without touching the flags. A division by a constant
+  of a dividend that is never negative doesn't need rax with it (see
+  divide_by_constant()).
+- BMI1: tzcnt, which counts the trailing zero bits. The loop that strips the
+  factors of 2 of a number, while (n % 2 == 0) { n = n / 2; }, becomes a
+  tzcnt and a single shift (see halving_loop()).
+- CMOV, for if-conversion.
+Everything that the code generator emits for an extension checks that it
+was selected.
+*******/
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "types.h"
+
+#define HASWELL (DICC_CMOV | DICC_BMI1 | DICC_BMI2)
+
+typedef struct {
+	const char *name;
+	unsigned int features;
+} arch_t;
+
+global_var const arch_t archs[] = {
+	{ "x86-64", DICC_CMOV },
+	{ "x86-64-v2", DICC_CMOV },
+	{ "x86-64-v3", HASWELL },
+	{ "x86-64-v4", HASWELL },
+	{ "core2", DICC_CMOV },
+	{ "nehalem", DICC_CMOV },
+	{ "westmere", DICC_CMOV },
+	{ "sandybridge", DICC_CMOV },
+	{ "ivybridge", DICC_CMOV },
+	{ "haswell", HASWELL },
+	{ "broadwell", HASWELL },
+	{ "skylake", HASWELL },
+	{ "icelake-client", HASWELL },
+	{ "alderlake", HASWELL },
+	{ "k8", DICC_CMOV },
+	{ "amdfam10", DICC_CMOV },
+	{ "btver2", DICC_CMOV | DICC_BMI1 },
+	{ "znver1", HASWELL },
+	{ "znver2", HASWELL },
+	{ "znver3", HASWELL },
+	{ "znver4", HASWELL },
+};
+
+// The extensions of the processor we run on, 0 if we can't tell.
+internal int native_features(unsigned int *features) {
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	*features = 0;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	if (edx & bit_CMOV)
+		*features |= DICC_CMOV;
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		if (ebx & bit_BMI)
+			*features |= DICC_BMI1;
+		if (ebx & bit_BMI2)
+			*features |= DICC_BMI2;
+	}
+	return 1;
+#else
+	(void) features;
+	return 0;
+#endif
+}
+
+int dicc_target_features(const char *arch, unsigned int *features) {
+	if (!strcmp(arch, "native"))
+		return native_features(features);
+
+	for (int i = 0; i < (int) (sizeof(archs) / sizeof(archs[0])); ++i) {
+		if (!strcmp(arch, archs[i].name)) {
+			*features = archs[i].features;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 
+#include "dicc.h"
+
 #define internal static
 #define global_var static
 
@@ -37,21 +39,58 @@ typedef struct {
 		
 		read_file_t file_contents;
 	};
+	dicc_sink *sink;   // where errors are reported
 } lex_t;
 
 
 /********* PARSER *********/
 
+// A loop whose body is being parsed. for and do-while are parsed
+// as whiles (see parse_for() and parse_do()), and these are
+// the parts that go at the end of the body and before a continue.
+typedef struct {
+	int blocks;          // the nested blocks the loop is in (not its body)
+	struct exp *step;    // of a for
+	struct exp *cond;    // of a do-while
+	int after;           // the token after the 'while (cond);' of a do-while
+	int variable;        // the one that its initialization declares, -1 if none
+} parsed_loop_t;
+
+// A variable declared in the initialization of a for. Variables have
+// function scope, so a for after the end of this one that declares
+// it again reuses it (see declare_for_variable()).
+typedef struct {
+	char *id;
+	int wide;
+	int in_use;   // its for hasn't ended yet
+} for_variable_t;
+
 typedef struct {
 	int token_index;
 	lex_t *input;
 	int blocks;   // number of nested blocks we are
 				  // currently in.
+	int branches; // ifs and whiles parsed so far
+	unsigned int shape;   // of the branches so far (see new_branch())
+	dicc_sink *sink;
+	struct ast *ast;   // where the statements go
+	// The loops we are in, the innermost last.
+	int loops_cap;
+	int loops_used;
+	parsed_loop_t *loops;
+	int variables_cap;
+	int variables_used;
+	for_variable_t *variables;
 } parser_t;
 
 
 typedef struct exp {
 	enum { int_exp, id_exp, unary_exp, function_exp, bin_exp, decl_exp, assign_exp } type;
+	int need;   // registers needed to evaluate it (see select_tiles())
+	int tile;   // the instructions that cover it, picked by select_tiles()
+	int cost;   // of the cheapest cover, rough cycles
+	int nonnegative;   // set by the range analysis if its value is always >= 0
+	int wide;          // a long (64 bits), or else an int (see typing.c)
 	union { 
 		int intExp;
 		
@@ -98,10 +137,15 @@ typedef struct statement {
 		struct {
 			char *id;
 			exp_t *rvalue;
+			// Set by the optimizer when the initial value (or the
+			// default 0) is never read, so nothing has to be stored.
+			int uninitialized;
+			int wide;   // declared long (or given a long, see typing.c)
 		} declStat;
 
 		struct {
 			exp_t *cond;
+			int branch;   // its counters in the profile (see profile.c)
 		} ifStat, whileStat;
 		
 		struct {
@@ -123,37 +167,92 @@ typedef struct statement_node {
 
 typedef struct ast {
 	statement_node_t *root;
+	// Names of the variables introduced by the optimizer. The names
+	// of the source are owned by the lexer, these by the AST.
+	int temps_used;
+	int temps_cap;
+	char **temps;
+	int branches;   // ifs and whiles of the source, numbered by the parser
+	unsigned int shape;   // hash of their kinds and lines, for the profiles
 } ast_t;
 
 
 
+/********* PROFILE *********/
+// Counts of a run of the program (see profile.c). For the branch i,
+// count[2*i] is how many times it ran and count[2*i + 1] how many
+// times it went into its block.
+typedef struct {
+	int num;   // branches, 0 if there is no profile
+	long long *count;
+} profile_t;
+
 /********* GENERATOR ************/
 
 /********* SYMBOL TABLE *********/
-// NOTE(stefanos): Remember that the runtime stack
-// grows towards lower addresses. That means that every time
-// we push something to the stack, its address is lower relative
-// to %rbp. So if a variable has an offset of 8 (the offset we save),
-// then its value is at %rbp - 8;
+// NOTE: A variable that lives on the stack has a slot of the frame.
+// Where the slot is (relative to rbp or to rsp) depends on how the frame
+// is laid out (see assemble_function()), so we only save its offset.
 typedef struct {
 	char *id;
 	int line;     // line of declaration
-	int offset;   // relative to %rbp
+	int slot;     // byte offset in the frame, if it is on the stack
+	const char *reg;   // register it lives in (the 64-bit name), NULL if it is on the stack
+	int wide;     // a long, or else an int
 } symbol_t;
 
 typedef struct {
 	int cap;
 	int used;
 	symbol_t *data;
-	int stack_top;  // relative to %rbp
 } table_t;
 
+/********* REGISTER ALLOCATOR *********/
+// Live range of a local variable. Positions are indices of statements
+// in the statement list of the function.
+typedef struct {
+	char *id;
+	int start;    // its declaration
+	int end;      // last statement that needs its value
+	long weight;  // spill cost, uses weighted by the loop depth
+	int calls;    // whether there is a call inside the range
+	int reg;      // index in the allocatable registers, -1 if spilled
+	int wide;     // a long takes 8 bytes on the stack, an int 4
+	int slot;     // byte offset in the frame, if spilled
+} live_range_t;
+
+typedef struct {
+	int cap;
+	int used;
+	live_range_t *data;
+	int free_rbp;   // rbp isn't the frame pointer, so it can hold a variable
+	int spill_size; // bytes of the slots of the spilled ranges
+} allocation_t;
+
 typedef struct gen {
-	FILE *output;
+	const dicc_options *options;
+	dicc_sink *sink;
+	// The assembly is accumulated here and handed to the sink
+	// in one go when the generation has finished.
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+	// Code that rarely runs, put after the function.
+	char *cold;
+	size_t cold_len;
+	size_t cold_cap;
 	statement_node_t *curr_stat;   // TODO(stefanos): Bad name...
 	table_t table;
+	allocation_t alloc;
+	profile_t *profile;            // of -fprofile-use
 	unsigned int label;    		   // general-purpose labels
 	unsigned int curr_loop_label;  // label of the loop we're currently in.
+	int frame_pointer;             // the frame is addressed off rbp (or else off rsp)
+	int red_zone;                  // the frame is under rsp, it isn't allocated
+	int num_saved;                 // callee-saved registers pushed in the prologue
+	int temp_base;                 // the offset of the first slot for temporaries
+	int temps;                     // slots for temporaries in use
+	int max_temps;                 // the most of them the function needs
 } gen_t;
 
 #endif
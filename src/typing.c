@@ -0,0 +1,128 @@
+/*******
+Widths of the integer expressions.
+
+HOW IT WORKS:
+An int is 32 bits and a long is 64. A variable has the type it was declared
+with (the other data types are ints), and an expression the type that C gives
+it: the integer constants are ints, an arithmetic operation is done in long if
+either of its operands is a long, and comparisons, ! and logical AND/OR are
+ints. An assignment has the type of its variable. The code generator picks
+the registers and the instructions by the width (rax or eax, cqo or cdq
+etc.), and the register allocator the size of the slot of a variable that
+lives on the stack.
+
+The widths are assigned before the optimizations and again after them, as
+the optimizer rewrites the expressions. What it rewrites never becomes
+narrower: a constant that replaced a long variable (see fold.c) is a long,
+and so are the operations on it, or else the result of a rewrite could
+overflow where the source didn't. An operation that C would do in int can be
+done in long without changing the result, as long as it doesn't overflow.
+
+The variables that the optimizer introduces (see new_temporary()) aren't
+declared with a type. They are longs if any value that is given to them
+is, and since these values can be other such variables, we go over the
+function until none of them changes.
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "typing.h"
+
+typedef struct {
+	int cap;
+	int used;
+	statement_t **decls;
+} variables_t;
+
+internal statement_t *find_declaration(variables_t *vars, char *id) {
+	for (int i = 0; i < vars->used; ++i) {
+		if (!strcmp(vars->decls[i]->declStat.id, id))
+			return vars->decls[i];
+	}
+	return NULL;
+}
+
+// The names of the optimizer start with a dot, which no name of the source can.
+internal int is_temporary(char *id) {
+	return id[0] == '.';
+}
+
+// The variable of 'decl' is given a value of the width 'wide'.
+// Returns whether it had to become a long.
+internal int give_value(statement_t *decl, int wide) {
+	if (decl == NULL || !wide || decl->declStat.wide || !is_temporary(decl->declStat.id))
+		return 0;
+	decl->declStat.wide = 1;
+	return 1;
+}
+
+// Set the width of 'exp' and everything in it. Returns whether a
+// variable of the optimizer became a long.
+internal int type_expression(variables_t *vars, exp_t *exp) {
+	int changed = 0;
+	statement_t *decl;
+
+	if (exp->type == id_exp) {
+		// Undeclared variables are reported by the code generator.
+		decl = find_declaration(vars, exp->id);
+		exp->wide = (decl != NULL) ? decl->declStat.wide : 0;
+	} else if (exp->type == unary_exp) {
+		changed = type_expression(vars, exp->unaryExp.operand);
+		exp->wide = exp->unaryExp.operator[0] != '!' && (exp->wide || exp->unaryExp.operand->wide);
+	} else if (exp->type == bin_exp) {
+		exp_t *left = exp->binExp.leftOperand;
+		exp_t *right = exp->binExp.rightOperand;
+		changed = type_expression(vars, left);
+		changed |= type_expression(vars, right);
+		// Comparisons and logical AND/OR are 0 or 1.
+		exp->wide = strchr("<>=!&|", exp->binExp.operator[0]) == NULL &&
+			(exp->wide || left->wide || right->wide);
+	} else if (exp->type == assign_exp) {
+		changed = type_expression(vars, exp->assignExp.rvalue);
+		decl = find_declaration(vars, exp->assignExp.id);
+		changed |= give_value(decl, exp->assignExp.rvalue->wide);
+		exp->wide = (decl != NULL) ? decl->declStat.wide : 0;
+	}
+	// A constant keeps the width that it was given.
+	return changed;
+}
+
+internal int type_statements(ast_t *ast, variables_t *vars) {
+	int changed = 0;
+	vars->used = 0;
+
+	for (statement_node_t *node = ast->root; node != NULL; node = node->next) {
+		statement_t *stat = &(node->stat);
+
+		if (stat->type == decl_stat) {
+			if (stat->declStat.rvalue != NULL) {
+				changed |= type_expression(vars, stat->declStat.rvalue);
+				changed |= give_value(stat, stat->declStat.rvalue->wide);
+			}
+			if (find_declaration(vars, stat->declStat.id) != NULL)
+				continue;
+			if (vars->used >= vars->cap) {
+				vars->cap = (vars->cap) ? 2 * vars->cap : 16;
+				vars->decls = realloc(vars->decls, vars->cap * sizeof(statement_t *));
+			}
+			vars->decls[(vars->used)++] = stat;
+		} else if (stat->type == ret_stat || stat->type == print_stat || stat->type == simple_stat) {
+			changed |= type_expression(vars, stat->unaryStat.exp);
+		} else if (stat->type == if_stat || stat->type == while_stat) {
+			changed |= type_expression(vars, stat->ifStat.cond);
+		}
+	}
+	return changed;
+}
+
+void assign_widths(ast_t *ast) {
+	variables_t vars = { 0, 0, NULL };
+
+	// A variable of the optimizer can be used before the statement
+	// that makes it a long (in a loop), so that has to settle first.
+	while (type_statements(ast, &vars));
+
+	free(vars.decls);
+}
@@ -0,0 +1,10 @@
+#ifndef TYPING_H
+#define TYPING_H
+
+#include "types.h"
+
+// Sets the width (int or long) of every expression of the function
+// and of the variables that the optimizer introduced.
+void assign_widths(ast_t *);
+
+#endif
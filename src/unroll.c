@@ -0,0 +1,423 @@
+/*******
+Unrolling of loops with a constant trip count.
+
+HOW IT WORKS:
+A counted loop is a while whose body ends with the update of its counter,
+which nothing else in the loop assigns, and whose condition compares the
+counter with a constant (for loops are parsed like that, see parse_for()):
+
+	i = 0;
+	while (i < 10) {
+		s = s + a * i;
+		i = i + 1;
+	}
+
+If the last statement before the loop gives the counter a constant value,
+we know every value it takes and how many times the loop runs (the trip
+count). Every iteration pays for the update, the compare and the jump
+back, which for a small body is as much as the body itself. So:
+- If the trip count and the body are small, the loop is unrolled fully:
+  the body is repeated once for every value of the counter, with the value
+  in place of the counter, and the counter gets its final value:
+
+	s = s + a * 0;
+	...
+	s = s + a * 9;
+	i = 10;
+
+- Otherwise, if the body is small, it is repeated 'factor' times in the
+  loop, the copy k with i + k * step in place of i, followed by a single
+  update of i by factor * step. This loop runs for as many iterations as
+  are a multiple of the factor, and the original loop, after it, runs the
+  rest (the remainder loop). The factor is as big as the body allows
+  (the copies shouldn't get bigger than the instruction cache can take
+  comfortably), and a smaller one that divides the trip count is preferred,
+  as then there is no remainder loop.
+
+A body that calls something (print) costs so much more than the loop
+around it that it's only unrolled fully, and a loop that contains another
+loop isn't unrolled at all, as its own overhead doesn't matter.
+The folding that runs after this propagates the constants into the copies.
+
+With -fprofile-use, the counts of the loop decide too. A loop that never ran
+is cold and isn't unrolled, as its copies would only take space. A loop whose
+body ran many times is hot, and its copies can be twice as big. The copies
+keep the numbers of the branches they were made from, so the profile still
+fits (the instrumented program isn't unrolled, so it counts the loops of the
+source).
+*******/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "types.h"
+#include "ast.h"
+#include "profile.h"
+#include "unroll.h"
+
+// Fully unrolled loops run at most this many times
+#define MAX_FULL_TRIPS 16
+// and their copies of the body have at most this many expressions and statements.
+#define MAX_FULL_SIZE 128
+// The same for the copies of the body in a partially unrolled loop.
+#define MAX_FACTOR 8
+#define MAX_PARTIAL_SIZE 48
+// The longest trip count we unroll for.
+#define MAX_TRIPS (1 << 24)
+// The iterations in the profile that make a loop hot, which doubles the sizes above.
+#define HOT_ITERATIONS 10000
+
+typedef struct {
+	char *id;            // the counter
+	long long start;     // its value before the loop
+	long long step;      // what the update adds to it
+	long long trips;
+	int wide;            // whether the counter is a long
+	statement_node_t *update;
+} counted_t;
+
+internal int assigns(exp_t *exp, char *id) {
+	if (exp->type == assign_exp)
+		return !strcmp(exp->assignExp.id, id) || assigns(exp->assignExp.rvalue, id);
+	if (exp->type == unary_exp)
+		return assigns(exp->unaryExp.operand, id);
+	if (exp->type == bin_exp)
+		return assigns(exp->binExp.leftOperand, id) || assigns(exp->binExp.rightOperand, id);
+	return 0;
+}
+
+internal int count_nodes(exp_t *exp) {
+	if (exp->type == assign_exp)
+		return 1 + count_nodes(exp->assignExp.rvalue);
+	if (exp->type == unary_exp)
+		return 1 + count_nodes(exp->unaryExp.operand);
+	if (exp->type == bin_exp)
+		return 1 + count_nodes(exp->binExp.leftOperand) + count_nodes(exp->binExp.rightOperand);
+	return 1;
+}
+
+// If 'exp' is 'id + c', 'c + id' or 'id - c', return the c that it adds.
+internal int constant_increment(exp_t *exp, char *id, long long *step) {
+	if (exp->type != bin_exp)
+		return 0;
+	exp_t *left = exp->binExp.leftOperand;
+	exp_t *right = exp->binExp.rightOperand;
+	char op = exp->binExp.operator[0];
+
+	if (op == '+' && left->type == int_exp && right->type == id_exp && !strcmp(right->id, id)) {
+		*step = left->intExp;
+		return 1;
+	}
+	if ((op == '+' || op == '-') && left->type == id_exp && !strcmp(left->id, id) && right->type == int_exp) {
+		*step = (op == '+') ? right->intExp : -(long long) right->intExp;
+		return 1;
+	}
+	return 0;
+}
+
+// The value of 'id' right before 'node', if the statement before gives it a
+// constant and it is not in a block (whose end could be jumped to).
+internal int value_before(statement_node_t *node, char *id, long long *value) {
+	for (node = node->prev; node != NULL; node = node->prev) {
+		statement_t *stat = &(node->stat);
+		exp_t **slot = statement_expression(stat);
+		exp_t *exp = (slot != NULL) ? *slot : NULL;
+
+		if (stat->type == decl_stat && !strcmp(stat->declStat.id, id)) {
+			*value = (exp != NULL && exp->type == int_exp) ? exp->intExp : 0;
+			return exp == NULL || exp->type == int_exp;
+		}
+		if (stat->type == simple_stat && exp->type == assign_exp &&
+			!strcmp(exp->assignExp.id, id)) {
+			*value = exp->assignExp.rvalue->intExp;
+			return exp->assignExp.rvalue->type == int_exp;
+		}
+		if ((stat->type != simple_stat && stat->type != decl_stat && stat->type != print_stat) ||
+			(exp != NULL && assigns(exp, id)))
+			return 0;
+	}
+	return 0;
+}
+
+internal int holds(char *operator, long long l, long long r) {
+	switch (operator[0]) {
+		case '<': return (operator[1] == '=') ? l <= r : l < r;
+		case '>': return (operator[1] == '=') ? l >= r : l > r;
+		case '=': return l == r;
+		case '!': return l != r;
+	}
+	return 0;
+}
+
+// The operator with its operands swapped (a < b is b > a).
+internal char *swapped(char *operator) {
+	if (operator[0] == '<')
+		return (operator[1] == '=') ? ">=" : ">";
+	if (operator[0] == '>')
+		return (operator[1] == '=') ? "<=" : "<";
+	return operator;
+}
+
+// How many times a loop runs whose counter starts at 'start' and moves by
+// 'step' (not 0) while it is 'operator' 'bound'. -1 if that is more than
+// MAX_TRIPS or the counter leaves the ints before the loop ends.
+internal long long trip_count(char *operator, long long start, long long step, long long bound) {
+	if (!holds(operator, start, bound))
+		return 0;
+	long long trips = -1;
+	long long distance = bound - start;
+	if (operator[0] == '=') {
+		trips = 1;
+	} else if (operator[0] == '!') {
+		if (distance % step == 0 && distance / step > 0)
+			trips = distance / step;
+	} else if (operator[0] == '<' && step > 0) {
+		trips = (operator[1] == '=') ? distance / step + 1 : (distance + step - 1) / step;
+	} else if (operator[0] == '>' && step < 0) {
+		trips = (operator[1] == '=') ? distance / step + 1 : (distance + step + 1) / step;
+	}
+	// Otherwise the counter moves away from the bound.
+	long long last = start + trips * step;
+	if (trips > MAX_TRIPS || last < INT_MIN || last > INT_MAX)
+		return -1;
+	return trips;
+}
+
+// Whether the loop at 'node' is counted and we know how many times it runs.
+internal int is_counted(statement_node_t *node, counted_t *loop) {
+	statement_node_t *body_start = node->next;
+	statement_node_t *body_end = block_end(body_start);
+	exp_t *cond = node->stat.whileStat.cond;
+	statement_node_t *update = body_end->prev;
+
+	// The update, last in the body.
+	if (update == body_start || update->stat.type != simple_stat)
+		return 0;
+	exp_t *exp = update->stat.simpleStat.exp;
+	if (exp->type != assign_exp || !constant_increment(exp->assignExp.rvalue, exp->assignExp.id, &(loop->step)) ||
+		loop->step == 0)
+		return 0;
+	loop->id = exp->assignExp.id;
+	loop->wide = exp->wide;
+	loop->update = update;
+
+	// The condition, the counter against a constant.
+	if (cond->type != bin_exp || strchr("<>=!", cond->binExp.operator[0]) == NULL)
+		return 0;
+	exp_t *left = cond->binExp.leftOperand;
+	exp_t *right = cond->binExp.rightOperand;
+	char *operator = cond->binExp.operator;
+	long long bound;
+	if (left->type == id_exp && !strcmp(left->id, loop->id) && right->type == int_exp) {
+		bound = right->intExp;
+	} else if (right->type == id_exp && !strcmp(right->id, loop->id) && left->type == int_exp) {
+		bound = left->intExp;
+		operator = swapped(operator);
+	} else {
+		return 0;
+	}
+
+	// Nothing else assigns the counter or leaves the iteration early. An
+	// inner loop, or a declaration, which can't be repeated, rules it out.
+	for (statement_node_t *it = body_start->next; it != update; it = it->next) {
+		statement_t *stat = &(it->stat);
+		exp_t **exp = statement_expression(stat);
+		if (stat->type == while_stat || stat->type == decl_stat || stat->type == break_stat ||
+			stat->type == cont_stat || (exp != NULL && assigns(*exp, loop->id)))
+			return 0;
+	}
+
+	if (!value_before(node, loop->id, &(loop->start)))
+		return 0;
+	loop->trips = trip_count(operator, loop->start, loop->step, bound);
+	return loop->trips != -1;
+}
+
+internal exp_t *new_integer(long long value, int wide) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = int_exp;
+	exp->intExp = (int) value;
+	exp->wide = wide;
+	return exp;
+}
+
+internal exp_t *new_binary(char *operator, exp_t *left, exp_t *right) {
+	exp_t *exp = calloc(1, sizeof(exp_t));
+	exp->type = bin_exp;
+	exp->binExp.operator = operator;
+	exp->binExp.leftOperand = left;
+	exp->binExp.rightOperand = right;
+	return exp;
+}
+
+// 'exp' with copies of 'value' in place of the reads of 'id'.
+internal exp_t *substitute(exp_t *exp, char *id, exp_t *value) {
+	if (exp->type == id_exp && !strcmp(exp->id, id))
+		return copy_expression(value);
+
+	exp_t *copy = malloc(sizeof(exp_t));
+	*copy = *exp;
+	if (exp->type == unary_exp) {
+		copy->unaryExp.operand = substitute(exp->unaryExp.operand, id, value);
+	} else if (exp->type == bin_exp) {
+		copy->binExp.leftOperand = substitute(exp->binExp.leftOperand, id, value);
+		copy->binExp.rightOperand = substitute(exp->binExp.rightOperand, id, value);
+	} else if (exp->type == assign_exp) {
+		copy->assignExp.rvalue = substitute(exp->assignExp.rvalue, id, value);
+	}
+	return copy;
+}
+
+// Put a copy of the body of 'loop' (without the update) before 'before',
+// with 'value' in place of the counter.
+internal void copy_body(ast_t *ast, statement_node_t *node, counted_t *loop,
+						exp_t *value, statement_node_t *before) {
+	for (statement_node_t *it = node->next->next; it != loop->update; it = it->next) {
+		statement_t stat = it->stat;
+		exp_t **exp = statement_expression(&stat);
+		if (exp != NULL)
+			*exp = substitute(*exp, loop->id, value);
+		insert_statement_before(ast, before, stat);
+	}
+}
+
+internal statement_t new_statement(int type, int line) {
+	statement_t stat;
+	memset(&stat, 0, sizeof(stat));
+	stat.type = type;
+	stat.line = line;
+	return stat;
+}
+
+// counter = value, before 'before'.
+internal void assign_counter(ast_t *ast, counted_t *loop, long long value, statement_node_t *before) {
+	statement_t stat = new_statement(simple_stat, before->stat.line);
+	exp_t *assign = calloc(1, sizeof(exp_t));
+	assign->type = assign_exp;
+	assign->assignExp.id = loop->id;
+	assign->assignExp.rvalue = new_integer(value, 0);
+	stat.simpleStat.exp = assign;
+	insert_statement_before(ast, before, stat);
+}
+
+internal void unroll_fully(ast_t *ast, statement_node_t *node, counted_t *loop) {
+	statement_node_t *body_end = block_end(node->next);
+
+	for (long long k = 0; k < loop->trips; ++k) {
+		// A constant in place of a long is a long (see typing.c).
+		exp_t *value = new_integer(loop->start + k * loop->step, loop->wide);
+		copy_body(ast, node, loop, value, node);
+		free(value);
+	}
+	assign_counter(ast, loop, loop->start + loop->trips * loop->step, node);
+	remove_statements(ast, node, body_end);
+}
+
+internal void unroll_partially(ast_t *ast, statement_node_t *node, counted_t *loop, int factor) {
+	statement_node_t *body_end = block_end(node->next);
+	int line = node->stat.line;
+	long long remainder = loop->trips % factor;
+	// The counter after the iterations of the unrolled loop.
+	long long end = loop->start + (loop->trips - remainder) * loop->step;
+
+	statement_t stat = new_statement(while_stat, line);
+	exp_t *counter = calloc(1, sizeof(exp_t));
+	counter->type = id_exp;
+	counter->id = loop->id;
+	stat.whileStat.cond = new_binary((loop->step > 0) ? "<" : ">", copy_expression(counter), new_integer(end, 0));
+	stat.whileStat.branch = node->stat.whileStat.branch;
+	insert_statement_before(ast, node, stat);
+	insert_statement_before(ast, node, new_statement(start_block, line));
+
+	for (int k = 0; k < factor; ++k) {
+		exp_t *value = (k) ? new_binary("+", copy_expression(counter), new_integer(k * loop->step, 0)) :
+			copy_expression(counter);
+		copy_body(ast, node, loop, value, node);
+		clean_expression(value);
+		free(value);
+	}
+	stat = new_statement(simple_stat, line);
+	exp_t *assign = calloc(1, sizeof(exp_t));
+	assign->type = assign_exp;
+	assign->assignExp.id = loop->id;
+	assign->assignExp.rvalue = new_binary("+", copy_expression(counter), new_integer(factor * loop->step, 0));
+	stat.simpleStat.exp = assign;
+	insert_statement_before(ast, node, stat);
+	insert_statement_before(ast, node, new_statement(end_block, line));
+	free(counter);
+
+	// The remainder loop.
+	if (remainder == 0)
+		remove_statements(ast, node, body_end);
+}
+
+// The number of expressions and statements in the body (without the
+// update), and whether it calls anything.
+internal int body_size(statement_node_t *node, counted_t *loop, int *calls) {
+	int size = 0;
+	*calls = 0;
+	for (statement_node_t *it = node->next->next; it != loop->update; it = it->next) {
+		exp_t **exp = statement_expression(&(it->stat));
+		size += 1 + ((exp != NULL) ? count_nodes(*exp) : 0);
+		if (it->stat.type == print_stat)
+			*calls = 1;
+	}
+	return size;
+}
+
+// Returns whether the loop at 'node' was unrolled.
+internal int unroll_loop(ast_t *ast, statement_node_t *node, profile_t *profile) {
+	counted_t loop;
+	int calls;
+	long long runs, taken;
+	int scale = 1;
+
+	if (!is_counted(node, &loop) || loop.trips < 2)
+		return 0;
+	if (branch_counts(profile, node->stat.whileStat.branch, &runs, &taken)) {
+		if (runs == 0)
+			return 0;
+		if (taken >= HOT_ITERATIONS)
+			scale = 2;
+	}
+	int size = body_size(node, &loop, &calls);
+
+	if (loop.trips <= MAX_FULL_TRIPS && loop.trips * size <= scale * MAX_FULL_SIZE) {
+		unroll_fully(ast, node, &loop);
+		return 1;
+	}
+	if (calls || size == 0)
+		return 0;
+
+	int factor = scale * MAX_PARTIAL_SIZE / size;
+	if (factor > MAX_FACTOR)
+		factor = MAX_FACTOR;
+	if (factor > loop.trips)
+		factor = (int) loop.trips;
+	// One that divides the trip count, if it isn't much smaller.
+	for (int f = factor; f > factor / 2; --f) {
+		if (loop.trips % f == 0) {
+			factor = f;
+			break;
+		}
+	}
+	if (factor < 2)
+		return 0;
+	unroll_partially(ast, node, &loop, factor);
+	return 1;
+}
+
+void unroll_loops(ast_t *ast, profile_t *profile) {
+	statement_node_t *next;
+
+	for (statement_node_t *node = ast->root; node != NULL; node = next) {
+		next = node->next;
+		// An unrolled loop has no loops in it, and it may be gone.
+		if (node->stat.type == while_stat) {
+			statement_node_t *after = block_end(next)->next;
+			if (unroll_loop(ast, node, profile))
+				next = after;
+		}
+	}
+}
@@ -0,0 +1,9 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include "types.h"
+
+// 'profile' has the counts of -fprofile-use, if any.
+void unroll_loops(ast_t *, profile_t *);
+
+#endif
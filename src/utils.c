@@ -1,13 +1,54 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
-void report_error(int line, char *fmt, ...)
+#include "utils.h"
+
+const char *registers[NUM_REGISTERS][3] = {
+	{ "rax", "eax", "al" },   { "rbx", "ebx", "bl" },
+	{ "rcx", "ecx", "cl" },   { "rdx", "edx", "dl" },
+	{ "rsi", "esi", "sil" },  { "rdi", "edi", "dil" },
+	{ "rbp", "ebp", "bpl" },  { "rsp", "esp", "spl" },
+	{ "r8", "r8d", "r8b" },   { "r9", "r9d", "r9b" },
+	{ "r10", "r10d", "r10b" }, { "r11", "r11d", "r11b" },
+	{ "r12", "r12d", "r12b" }, { "r13", "r13d", "r13b" },
+	{ "r14", "r14d", "r14b" }, { "r15", "r15d", "r15b" },
+};
+
+int register_index(const char *operand) {
+	for (int i = 0; i < NUM_REGISTERS; ++i) {
+		for (int size = 0; size < 3; ++size) {
+			if (!strcmp(operand, registers[i][size]))
+				return i;
+		}
+	}
+	return -1;
+}
+
+void report_error(dicc_sink *sink, int line, char *fmt, ...)
+{
+	char msg[512];
+	va_list args;
+
+	if(sink == NULL || sink->error == NULL)
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	sink->error(sink->ctx, line, msg);
+}
+
+void report_note(dicc_sink *sink, char *fmt, ...)
 {
+	char msg[512];
 	va_list args;
+
+	if(sink == NULL || sink->note == NULL)
+		return;
+
 	va_start(args, fmt);
-	fprintf(stderr, "[ERROR]: ");
-	if(line != -1)
-		fprintf(stderr, "Line %d: ", line);
-	vfprintf(stderr, fmt, args);
+	vsnprintf(msg, sizeof(msg), fmt, args);
 	va_end(args);
+	sink->note(sink->ctx, msg);
 }
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <time.h>
 
+#include "dicc.h"
+
 /*
 #define TIME(code) \
 { \
@@ -22,6 +24,16 @@
 } \
 */
 
-void report_error(int, char *fmt, ...);
+// The general-purpose registers as 64, 32 and 8 bit, for the passes
+// that read the generated assembly (see peephole.c and schedule.c).
+#define NUM_REGISTERS 16
+extern const char *registers[NUM_REGISTERS][3];
+// Index of a register (any size) or -1 if it's not one.
+int register_index(const char *);
+
+// Formats an error message and hands it to the error callback of the sink.
+void report_error(dicc_sink *, int, char *fmt, ...);
+// Same, for the note callback.
+void report_note(dicc_sink *, char *fmt, ...);
 
 #endif
@@ -0,0 +1,18 @@
+.data
+fmt: .asciz "int: %d\n"
+.intel_syntax noprefix
+.align 4
+.text
+.globl main
+main:
+push rbp
+mov eax, 191
+mov rbp, rsp
+lea rdi, fmt[rip]
+mov esi, eax
+xor eax, eax
+call printf
+mov eax, 0
+.func_epilogue:
+pop rbp
+ret
@@ -0,0 +1,67 @@
+/* Divisions and remainders round toward zero, whatever the signs. */
+
+int main() {
+	int min = -2147483647 - 1;
+	print min / 3;
+	print min % 8;
+	print min / 8;
+	print -7 / 2;
+	print -7 % 2;
+	print 7 / -2;
+	print 7 % -2;
+
+	/* The same, with values that only a loop that prints knows, so
+	   that the generated code does the divisions. */
+	int n = 0;
+	int d = 0;
+	long big = 0;
+	int i = 0;
+	while (i < 1) {
+		n = -2147483647 - 1;
+		d = -7;
+		big = 65536;
+		big = big * 65536 * 3 + 5;
+		print i;
+		i = i + 1;
+	}
+
+	/* INT_MIN by constants. */
+	print n / 3;
+	print n % 3;
+	print n / 8;
+	print n % 8;
+	print n / -3;
+	print n % -3;
+	print n / -8;
+	print n % -8;
+	print n / 2147483647;
+	print n % 2147483647;
+
+	/* Negative divisors. */
+	print n / d;
+	print n % d;
+	print 100 / d;
+	print 100 % d;
+	print -100 / d;
+	print -100 % d;
+
+	/* A long divisor above 2^31 (12884901893). */
+	long x = big * 5 + 11;
+	print x / big;
+	print x % big;
+	print -x / big;
+	print -x % big;
+	print x / -big;
+	print x % -big;
+	print n / big;
+	print n % big;
+	long q = big / 3;
+	print q / 1000000;
+	print q % 1000000;
+	q = -big / 7;
+	print q / 1000000;
+	print q % 1000000;
+	print big % 1000003;
+	print -big % 65536;
+	return 0;
+}
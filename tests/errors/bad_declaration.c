@@ -0,0 +1,5 @@
+/* A declaration without a name, after one with an initializer. */
+int main() {
+	int x = 1;
+	int 3;
+}
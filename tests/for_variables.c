@@ -0,0 +1,10 @@
+/* A for can declare the variable of an earlier for again. */
+
+int main() {
+	for (int i = 0; i < 3; i = i + 1) { print i; }
+	for (int i; i < 2; i = i + 1) { print i + 10; }
+	for (long j = 5; j > 3; j = j - 1) {
+		for (int i = 7; i < 9; i = i + 1) { print i * j; }
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+/* !x is 1 when x is 0 and 0 otherwise. */
+
+int main() {
+	print !0;
+	print !1;
+	print !5;
+	print !-3;
+	print !!7;
+	print !(2 < 1);
+	print !(2 > 1);
+
+	/* With values that only a loop that prints knows. */
+	int zero = 1;
+	int x = 0;
+	long wide = 0;
+	int i = 0;
+	while (i < 1) {
+		zero = 0;
+		x = -2147483647 - 1;
+		wide = 65536;
+		wide = wide * 65536;
+		print i;
+		i = i + 1;
+	}
+	print !zero;
+	print !x;
+	print !!x;
+	print !(x - x);
+	print !zero + !zero;
+	print -!zero;
+
+	/* A long that isn't 0, whose lower 32 bits are. */
+	print !wide;
+	print !(wide - wide);
+
+	/* In conditions. */
+	if (!x) {
+		print -1;
+	} else {
+		print 1;
+	}
+	if (!zero) {
+		print 2;
+	}
+	int n = 3;
+	while (!(n == 0)) {
+		n = n - 1;
+	}
+	print n;
+	return 0;
+}
@@ -0,0 +1,30 @@
+/* An int keeps the lower 32 bits of a long that is assigned to it. */
+
+int main() {
+	long a = 65536;
+	a = a * 50000;
+	int x = a;
+	print x / 2;
+	if (x < 0) {
+		print 1;
+	} else {
+		print 0;
+	}
+
+	/* The same, with a long that only a loop knows. */
+	long b = 0;
+	int i = 0;
+	while (i < 2000000) {
+		b = b + 3000000;
+		i = i + 1;
+	}
+	int y;
+	y = b;
+	print y % 1000;
+	if (y < 0) {
+		print 1;
+	} else {
+		print 0;
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+# Compile every tests/*.c at -O0 and -O1 and compare what it
+# prints with tests/*.out. Every tests/errors/*.c must instead be
+# rejected with an error, not crash the compiler.
+# Run it from the root, after ./compile.sh.
+fail=0
+for src in tests/*.c; do
+	name=${src%.c}
+	for level in -O0 -O1; do
+		./dicc $level $src > /dev/null && gcc -z noexecstack $name.s -o $name &&
+			./$name | diff -q - $name.out > /dev/null
+		if [ $? != 0 ]; then
+			echo "FAIL: $src ($level)"
+			fail=1
+		fi
+		rm -f $name $name.s
+	done
+done
+for src in tests/errors/*.c; do
+	for level in -O0 -O1; do
+		errors=$(./dicc $level $src 2>&1 > /dev/null)
+		if [ $? -ge 128 ] || ! echo "$errors" | grep -q '^\[ERROR\]'; then
+			echo "FAIL: $src ($level)"
+			fail=1
+		fi
+		rm -f ${src%.c}.s
+	done
+done
+[ $fail = 0 ] && echo 'All tests passed'
+exit $fail
@@ -0,0 +1,68 @@
+/* && and || don't evaluate their right operand, and so don't
+   run its assignments, when the left one decides the result. */
+
+int main() {
+	int a = 0;
+	int b = 0;
+	int c;
+	c = a && (b = 5);
+	print c;
+	print b;
+	c = !a || (b = 6);
+	print c;
+	print b;
+	c = !a && (b = 7);
+	print c;
+	print b;
+	c = a || (b = 0);
+	print c;
+	print b;
+
+	/* With values that only a loop that prints knows. */
+	int zero = 1;
+	int one = 0;
+	int i = 0;
+	while (i < 1) {
+		zero = 0;
+		one = 1;
+		print i;
+		i = i + 1;
+	}
+	int k = 0;
+	c = zero && (k = k + 1);
+	print k;
+	c = one || (k = k + 10);
+	print k;
+	c = one && (k = k + 100);
+	print k;
+	c = zero || (k = k + 1000);
+	print k;
+	print c;
+
+	/* In the conditions of ifs and loops. */
+	if (zero && (k = 1)) {
+		print -1;
+	}
+	print k;
+	if (one || (k = 2)) {
+		print k;
+	}
+	int n = 0;
+	int runs = 0;
+	while (n < 5 && (runs = runs + 1)) {
+		n = n + 1;
+	}
+	print n;
+	print runs;
+	n = 0;
+	while ((n < 3 || (k = -1)) && n < 3) {
+		n = n + 1;
+	}
+	print k;
+
+	/* Nested, the innermost one that is skipped. */
+	c = one && (zero || (k = 42)) && (zero && (k = 43));
+	print c;
+	print k;
+	return 0;
+}
@@ -0,0 +1,82 @@
+/* Loops with a constant trip count, which -O1 unrolls. */
+
+int main() {
+	int i;
+	int j;
+	long k;
+	int s = 3;
+
+	/* Unrolled fully. */
+	for (i = 0; i < 5; i = i + 1) {
+		print i * i + s;
+	}
+	print i;
+
+	/* Downward and with <=, fully. */
+	for (i = 10; i > 0; i = i - 3) {
+		print i;
+	}
+	print i;
+	for (i = 1; i <= 4; i = i + 1) {
+		print -i;
+	}
+	print i;
+
+	/* A long counter, fully. */
+	long w = 0;
+	for (k = 3; k < 7; k = k + 1) {
+		print k;
+	}
+	print k;
+
+	/* Partially, inside a loop that prints, so that the compiler doesn't
+	   run them. The trip counts are primes, which leaves a remainder. */
+	int r = 0;
+	while (r < 2) {
+		s = 0;
+		for (j = 0; j < 103; j = j + 1) {
+			s = s + j * r + 1;
+		}
+		print s;
+		print j;
+		s = 0;
+		for (j = 106; j >= 1; j = j - 2) {
+			s = s + j;
+		}
+		print s;
+		print j;
+		s = 0;
+		for (j = 0; j <= 60; j = j + 1) {
+			s = s + j * j;
+		}
+		print s;
+		print j;
+		w = 0;
+		for (k = 0; k < 37; k = k + 1) {
+			w = w + k * 4096 * 4096 * 64;
+		}
+		print w / 65536;
+		print k;
+		r = r + 1;
+	}
+
+	/* A continue goes to the update of a for, and to the condition of
+	   a do-while. */
+	for (i = 0; i < 6; i = i + 1) {
+		if (i == 2) {
+			continue;
+		}
+		print i;
+	}
+	print i;
+	int n = 0;
+	do {
+		n = n + 1;
+		if (n % 3 == 0) {
+			continue;
+		}
+		print n;
+	} while (n < 10);
+	print n;
+	return 0;
+}